@@ -29,5 +29,8 @@
 #define __MExpr_H__
 
 #include <MExprExpression.h>
+#include <MExprCsv.h>
+#include <MExprBulkLoader.h>
+#include <MExprRegistry.h>
 
 #endif
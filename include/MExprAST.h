@@ -44,7 +44,17 @@ namespace MExpr {
      */
     class ASTNode {
 
+    protected:
+        ValueType cache; /* result of the last incremental evaluation */
+        bool cacheValid; /* true if the cache contains the result */
+        unsigned long long varMask; /* variables used in the subtree (see Environment::getVarBit) */
+
     public:
+        ASTNode() {
+            cacheValid = false;
+            varMask = 0;
+        }
+
         virtual ~ASTNode() {
         }
 
@@ -96,6 +106,31 @@ namespace MExpr {
          */
         virtual ValueType evaluate(Environment* env) throw (Error) = 0;
 
+        /**
+         * Returns the result of the tree/subtree like evaluate, but it reuses the results of the previous incremental
+         * evaluation for the subtrees that don't use the changed variables (the cache of the nodes): only the paths
+         * from the changed variables to the root are evaluated again.
+         * The calls of fnPURE functions are evaluated again only if their arguments or a function change, the
+         * subtrees that call the other functions are always evaluated again (see Environment::IMPURE_BIT).
+         *
+         * @param env the Environment class to evalutate the expression (for variables and functions)
+         * @param changed mask of the variables changed after the previous incremental evaluation
+         *        (see Environment::getChangedMask)
+         * @return the result
+         */
+        virtual ValueType evaluateIncremental(Environment* env, unsigned long long changed) throw (Error) {
+            return evaluate(env);
+        }
+
+        /**
+         * Prepares the tree/subtree for the incremental evaluation: it calculates the mask of the variables used by
+         * every subtree and invalidates the cached results. It must be called again when the functions change.
+         *
+         * @param env the Environment class with the functions (for their attributes)
+         * @return the mask of the variables used by this subtree
+         */
+        virtual unsigned long long prepareIncremental(Environment* env) = 0;
+
         /**
          * Deallocate the tree/subtree that have this node as root. This function deallocate this node too.
          */
@@ -115,6 +150,12 @@ namespace MExpr {
 
     /**
      * A class that represents a generic primitive operation, for examplel +, -, *, ...
+     *
+     * The comparisons and the logical operators return 1 (true) or 0 (false), their operands are true if they are not
+     * zero. The select SEL (the function _if(c, a, b)) has three children and returns a if c is true, otherwise b.
+     * All the children are always evaluated (there are no branches, also && and || evaluate both operands), so the
+     * divisions inside the second and third child of a SEL are "guarded": their division by zero doesn't throw an
+     * error but returns the IEEE result (inf or NaN), that the select discards (e.g. _if(x != 0, 1/x, 0)).
      */
     class ASTPrimitiveOp: public ASTNode {
 
@@ -124,13 +165,23 @@ namespace MExpr {
             SUB, // '-'
             MUL, // '*'
             DIV, // '/'
-            POW  // '^'
+            POW, // '^'
+            LT, // '<'
+            LE, // '<='
+            GT, // '>'
+            GE, // '>='
+            EQ, // '=='
+            NE, // '!='
+            AND, // '&&'
+            OR, // '||'
+            SEL // '_if(c, a, b)'
         };
 
     protected:
         ASTNode** children; //array of numChildren elements
         unsigned int numChildren; //depends on the PrimitiveOp::Type
         Type type;
+        bool guarded; //DIV inside a SEL, the division by zero doesn't throw an error
 
     public:
         ASTPrimitiveOp(ASTPrimitiveOp::Type type) throw (Error);
@@ -140,12 +191,23 @@ namespace MExpr {
         ASTNode* getChild(unsigned int c) throw (Error);
         void setChild(unsigned int c, ASTNode* node) throw (Error);
         ValueType evaluate(Environment* env) throw (Error);
+        ValueType evaluateIncremental(Environment* env, unsigned long long changed) throw (Error);
+        unsigned long long prepareIncremental(Environment* env);
         void deleteTree();
         MExpr::Instruction getMExprInstr();
 
+        /**
+         * Marks a division as guarded (see the class description), it is done by setChild for the divisions inside
+         * the second and third child of a SEL.
+         */
+        void setGuarded(bool guarded);
+
     protected:
         void getExprTreeString_rec(std::stringstream* ris, std::string* tabs, bool sameLine);
 
+        /* result of the comparisons and of the logical operators */
+        ValueType compare(ValueType a, ValueType b);
+
     };
     /*-------------------------------------------*/
 
@@ -167,6 +229,8 @@ namespace MExpr {
         ASTNode* getChild(unsigned int c) throw (Error);
         void setChild(unsigned int c, ASTNode* node) throw (Error);
         ValueType evaluate(Environment* env) throw (Error);
+        ValueType evaluateIncremental(Environment* env, unsigned long long changed) throw (Error);
+        unsigned long long prepareIncremental(Environment* env);
         void deleteTree();
         MExpr::Instruction getMExprInstr();
 
@@ -194,6 +258,8 @@ namespace MExpr {
         ASTNode* getChild(unsigned int c) throw (Error);
         void setChild(unsigned int c, ASTNode* node) throw (Error);
         ValueType evaluate(Environment* env) throw (Error);
+        ValueType evaluateIncremental(Environment* env, unsigned long long changed) throw (Error);
+        unsigned long long prepareIncremental(Environment* env);
         void deleteTree();
         MExpr::Instruction getMExprInstr();
 
@@ -221,9 +287,76 @@ namespace MExpr {
         ASTNode* getChild(unsigned int c) throw (Error);
         void setChild(unsigned int c, ASTNode* node) throw (Error);
         ValueType evaluate(Environment* env) throw (Error);
+        ValueType evaluateIncremental(Environment* env, unsigned long long changed) throw (Error);
+        unsigned long long prepareIncremental(Environment* env);
+        void deleteTree();
+        MExpr::Instruction getMExprInstr();
+
+    protected:
+        void getExprTreeString_rec(std::stringstream* ris, std::string* tabs, bool sameLine);
+
+    };
+    /*-------------------------------------------*/
+
+    /*-- Polynomial -----------------------------*/
+    /* A class that represents a polynomial with constant coefficients in the value of its only child (a variable),
+     * c0 + c1 x + c2 x^2 + ... + cn x^n. It is built by Optimizer::recognizePolynomials, the parser doesn't produce it.
+     * */
+    class ASTPolynomial: public ASTNode {
+
+    public:
+        enum {
+            MAX_DEGREE = 32, /* maximum degree of the recognized polynomials */
+            ESTRIN_MIN_DEGREE = 8 /* minimum degree evaluated with the Estrin's scheme instead of the Horner's one */
+        };
+
+    private:
+        ValueType* coefficients; //degree + 1 elements, coefficients[k] multiplies x^k
+        unsigned int degree;
+        ASTNode* child;
+
+    public:
+        ASTPolynomial(const ValueType* coefficients, unsigned int degree);
+        ~ASTPolynomial();
+        unsigned int countNodes();
+        unsigned int countChildren();
+        ASTNode* getChild(unsigned int c) throw (Error);
+        void setChild(unsigned int c, ASTNode* node) throw (Error);
+        ValueType evaluate(Environment* env) throw (Error);
+        ValueType evaluateIncremental(Environment* env, unsigned long long changed) throw (Error);
+        unsigned long long prepareIncremental(Environment* env);
         void deleteTree();
         MExpr::Instruction getMExprInstr();
 
+        /**
+         * Returns the value of the polynomial in x: the Horner's scheme, (cn x + cn-1) x + ..., needs the fewest
+         * operations, but every step waits for the previous one; from ESTRIN_MIN_DEGREE the Estrin's scheme computes
+         * the pairs (c0 + c1 x), (c2 + c3 x), ... at the same time and combines them with x^2, x^4, ...
+         * The tree, the code and the batches use this function, so they have the same results.
+         *
+         * @param coefficients degree + 1 coefficients, coefficients[k] multiplies x^k
+         */
+        static inline ValueType evaluatePolynomial(const ValueType* coefficients, unsigned int degree, ValueType x) {
+            if (degree < ESTRIN_MIN_DEGREE) {
+                ValueType r = coefficients[degree];
+                for (unsigned int k = degree; k > 0; k--)
+                    r = r * x + coefficients[k - 1];
+                return r;
+            }
+
+            ValueType t[MAX_DEGREE / 2 + 1];
+            unsigned int m = degree / 2 + 1; //number of terms
+            for (unsigned int i = 0; i < m; i++)
+                t[i] = (2 * i < degree) ? coefficients[2 * i] + coefficients[2 * i + 1] * x : coefficients[2 * i];
+            for (ValueType p = x * x; m > 1; p = p * p) {
+                unsigned int h = (m + 1) / 2;
+                for (unsigned int i = 0; i < h; i++)
+                    t[i] = (2 * i + 1 < m) ? t[2 * i] + t[2 * i + 1] * p : t[2 * i];
+                m = h;
+            }
+            return t[0];
+        }
+
     protected:
         void getExprTreeString_rec(std::stringstream* ris, std::string* tabs, bool sameLine);
 
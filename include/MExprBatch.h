@@ -0,0 +1,200 @@
+/*
+ * Mathematical Expressions - Batch
+ * Headers
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __MExprBatch_H__
+#define __MExprBatch_H__
+
+#include <cstddef>
+#include <MExprDefinitions.h>
+#include <MExprError.h>
+
+namespace MExpr {
+
+    /**
+     * Batch is a set of rows to evaluate with a single call (see Expression::evaluateBatch).
+     *
+     * A variable can be bound to a column: an array with a value for each row. The batch doesn't copy the columns and
+     * doesn't own them, they must live until the evaluation ends. The values of a column can be strided, e.g. a field
+     * of an array of structs. A variable can also be bound to a scalar: the same
+     * value for all the rows. The variables that are not bound have the value of the environment of the expression in
+     * all the rows.
+     *
+     * The subexpressions that don't use the columns are evaluated once for the whole batch (see Code::evaluateBatch).
+     */
+    class Batch {
+        size_t rows; /* number of rows */
+        const ValueType* columns[128]; /* column of each variable, NULL if the variable is not bound to a column */
+        size_t strides[128]; /* bytes between two values of each column */
+        ValueType scalars[128]; /* scalar of each variable */
+        bool scalarSet[128]; /* true if the variable is bound to a scalar */
+
+    public:
+        /**
+         * Creates a batch of the given number of rows, without columns
+         */
+        Batch(size_t rows);
+
+        /**
+         * Binds a variable to a column of 'rows' values, or unbinds it if values is NULL.
+         * The stride is the distance in bytes between the values of two rows, e.g. with an array of structs
+         * setColumn('x', &rows[0].price, sizeof(rows[0])) reads the field price of every struct.
+         */
+        void setColumn(char var, const ValueType* values, size_t stride = sizeof(ValueType)) throw (Error);
+
+        /**
+         * Binds a variable to a scalar (the same value in all the rows). A variable is bound to a column or to a scalar,
+         * setScalar unbinds the column and setColumn unbinds the scalar.
+         */
+        void setScalar(char var, ValueType value) throw (Error);
+
+        /**
+         * Unbinds a variable from its column or scalar, it will take the value of the environment
+         */
+        void unbind(char var) throw (Error);
+
+        /**
+         * Returns the column of a variable, or NULL if the variable is not bound to a column
+         */
+        inline const ValueType* getColumn(char var) {
+            return columns[var & 127];
+        }
+
+        /**
+         * Returns the stride in bytes of the column of a variable
+         */
+        inline size_t getStride(char var) {
+            return strides[var & 127];
+        }
+
+        /**
+         * Returns true and sets *value if the variable is bound to a scalar
+         */
+        inline bool getScalar(char var, ValueType* value) {
+            if (!scalarSet[var & 127])
+                return false;
+            *value = scalars[var & 127];
+            return true;
+        }
+
+        /**
+         * Changes the number of rows (the columns must have at least 'rows' values)
+         */
+        void setRows(size_t rows);
+
+        size_t getRows();
+    };
+
+    /**
+     * Reduction aggregates the results of a batch evaluation while they are computed (see
+     * Expression::evaluateBatch(Batch*, Reduction*)): the results of each block of rows are added to the aggregates
+     * and never written to an array, so a batch of any size is reduced without its results in memory.
+     *
+     * The aggregates to compute are chosen with the constructor (an or of Aggregate), the others are not computed
+     * and their getters return NaN (or 0 for the count). The rows are added to the previous ones, so the same
+     * reduction can aggregate several batches, until reset is called.
+     *
+     * The sum is computed with a blocked pairwise summation: the rows are summed in chunks of CHUNK rows (with eight
+     * accumulators), and the sums of the chunks are added pairwise (the sum of 2^k chunks with the sum of the next
+     * 2^k chunks), so the error grows with the logarithm of the rows instead of the rows. The chunks are always the
+     * same CHUNK consecutive rows, so the sum of the same rows is the same, bit by bit, however they are added (one
+     * by one, by block or by batch). Min and max ignore the NaN results.
+     */
+    class Reduction {
+
+    public:
+        enum Aggregate {
+            SUM = 1, /* sum and mean */
+            MIN = 2,
+            MAX = 4,
+            COUNT_ABOVE = 8, /* number of rows with a result greater than the threshold */
+            ALL = 15
+        };
+
+        enum {
+            CHUNK = 256 /* rows of the chunks of the pairwise summation */
+        };
+
+    private:
+        unsigned int aggregates;
+        ValueType threshold;
+        size_t rows; /* rows added */
+        ValueType pending[CHUNK]; /* last rows, not summed yet because they are less than a chunk */
+        size_t pendingSize;
+        ValueType partial[64]; /* partial[k] is the sum of 2^k chunks, if the bit k of 'chunks' is set */
+        unsigned long long chunks; /* chunks summed */
+        ValueType minValue;
+        ValueType maxValue;
+        size_t countAbove;
+
+    public:
+        /**
+         * Creates an empty reduction that computes the given aggregates (Aggregate values joined by or)
+         */
+        Reduction(unsigned int aggregates = ALL, ValueType threshold = 0);
+
+        /**
+         * Removes all the rows
+         */
+        void reset();
+
+        /**
+         * Adds n rows to the aggregates
+         */
+        void add(const ValueType* values, size_t n);
+
+        size_t getRows();
+        ValueType getSum();
+
+        /**
+         * Returns the sum divided by the rows, NaN if there are no rows
+         */
+        ValueType getMean();
+
+        /**
+         * Returns the minimum result, +inf if there are no rows (or they are all NaN)
+         */
+        ValueType getMin();
+
+        /**
+         * Returns the maximum result, -inf if there are no rows (or they are all NaN)
+         */
+        ValueType getMax();
+
+        size_t getCountAbove();
+
+    private:
+        /** sum of n <= CHUNK rows */
+        static ValueType sumChunk(const ValueType* values, size_t n);
+
+        /** adds the sum of a chunk to the partial sums */
+        void addChunk(ValueType sum);
+    };
+
+} //end of namespace MExpr
+
+#endif
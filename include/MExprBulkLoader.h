@@ -0,0 +1,155 @@
+/*
+ * Mathematical Expressions - Bulk loader
+ * Headers
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __MExprBulkLoader_H__
+#define __MExprBulkLoader_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <MExprDefinitions.h>
+#include <MExprError.h>
+#include <MExprEnvironment.h>
+#include <MExprExpression.h>
+
+namespace MExpr {
+
+    /**
+     * BulkLoader parses and compiles many expressions on a pool of threads (see load).
+     *
+     * The expressions are added as strings or read from a file (one expression for each line), then load creates an
+     * Expression for each of them. An expression that can't be parsed doesn't stop the others: its error is kept
+     * (getError) and its expression is NULL.
+     *
+     * Every expression has its own environment, a copy of the environment of the loader (getEnvironment): the
+     * functions set there before load are known by the compilation, so their attributes are used by the optimizations
+     * (see Environment::setFunction). The environment of the loader and the added strings must not change while load
+     * is running.
+     *
+     * The loader owns the loaded expressions until they are released (release), the others are deleted with the
+     * loader. The programs that use the loader must be linked with -lpthread.
+     */
+    class BulkLoader {
+
+    public:
+        enum {
+            CHUNK = 32 /* expressions taken together by a thread */
+        };
+
+    private:
+        std::vector<std::string> exprs; /* added expressions */
+        std::vector<Expression*> expressions; /* loaded expressions, NULL if not loaded */
+        std::vector<int> errors; /* error of each expression (an Error::Type), -1 if there is no error */
+        Environment* env; /* environment copied in every expression */
+        unsigned int threads;
+        bool astOptimization;
+        size_t next; /* first expression not taken by a thread */
+        size_t loaded; /* expressions already loaded */
+
+    public:
+        /**
+         * Creates a loader that uses the given number of threads, 0 for one thread for each processor
+         */
+        BulkLoader(unsigned int threads = 0);
+
+        /**
+         * Destroyer, it deletes the expressions that are not released
+         */
+        ~BulkLoader();
+
+        /**
+         * Returns the environment copied in every loaded expression (with the standard functions)
+         */
+        Environment* getEnvironment();
+
+        /**
+         * Sets the compilation of the expressions: with the optimizations of the tree or not (see
+         * Expression::compile(bool)), by default they are optimized
+         */
+        void setOptimization(bool astOptimization);
+
+        /**
+         * Adds an expression to load, it returns its index
+         */
+        size_t add(const std::string& expr);
+
+        /**
+         * Adds an expression for each line of a file (the empty lines are skipped)
+         *
+         * @return the number of expressions added
+         */
+        size_t addFile(const std::string& path) throw (Error);
+
+        /**
+         * Parses and compiles the expressions added after the last load, each thread takes CHUNK expressions at a time
+         *
+         * @return the number of expressions that can't be loaded
+         */
+        size_t load();
+
+        /**
+         * Returns the number of expressions added
+         */
+        size_t size();
+
+        /**
+         * Returns the string of an expression
+         */
+        const std::string& getString(size_t index);
+
+        /**
+         * Returns a loaded expression (owned by the loader), NULL if it has an error or it was released
+         */
+        Expression* getExpression(size_t index);
+
+        /**
+         * Returns a loaded expression and gives it to the caller, that must deallocate it
+         */
+        Expression* release(size_t index);
+
+        /**
+         * Returns true if the expression can't be loaded
+         */
+        bool hasError(size_t index);
+
+        /**
+         * Returns the error of an expression that can't be loaded
+         */
+        Error::Type getError(size_t index);
+
+    private:
+        /** loads the expressions taken by a thread until all are taken */
+        void loadChunks();
+
+        /** entry point of the threads */
+        static void* run(void* loader);
+    };
+
+} //end of namespace MExpr
+
+#endif
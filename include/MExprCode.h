@@ -33,8 +33,13 @@
 #include <MExprInstruction.h>
 #include <MExprEnvironment.h>
 #include <MExprAST.h>
+#include <MExprProfile.h>
+#include <MExprBatch.h>
 
 #include <string>
+#include <map>
+#include <set>
+#include <vector>
 #include <cstddef>
 
 namespace MExpr {
@@ -49,9 +54,50 @@ namespace MExpr {
      *
      */
     class Code {
-        Instruction* code; /* array of instructions */
+    public:
+        enum {
+            BLOCK_SIZE = 256, /* rows evaluated together by evaluateBatch */
+            MAX_OPERAND = 1 << 24 /* limit of the operands of the instructions (see PackedInstruction) */
+        };
+
+    private:
+        /** element of the stack simulated by planBatch */
+        typedef struct {
+            bool invariant; /* the value is the same for all the rows of the batch */
+            ValueType value; /* the value, if invariant */
+            size_t start; /* index in batchCode of the first instruction that computes the element */
+        } BatchPlanElement;
+
+        /** pools of the code built by compile, the constants and the functions without duplicates */
+        typedef struct {
+            std::vector<ValueType> constants;
+            std::map<std::string, unsigned int> constantIndex; /* bytes of a constant -> index in constants */
+            std::vector<std::string> functions;
+            std::map<std::string, unsigned int> functionIndex;
+            std::vector<unsigned int> polynomials;
+        } CodePools;
+
+        PackedInstruction* code; /* array of instructions, shared by the clones with the pools (see clone) */
+        unsigned int* codeRefs; /* number of codes that share the array of instructions */
         size_t codeSize; /* size of the array */
+        ValueType* constants; /* constants of iVAL and coefficients of iPOLY */
+        unsigned int numConstants;
+        std::string* functions; /* names of the functions called by iFUN */
+        unsigned int numFunctions;
+        unsigned int* polynomials; /* pairs (index of the first coefficient in constants, degree) of iPOLY */
+        unsigned int numPolynomials;
         StackType stack; /* array that memorize the stack used to evaluate the code */
+        ProfileCounterType* profile; /* counters of each instruction, NULL if the profiling is not compiled */
+        ProfileCounterType profileTotal; /* counters of the whole evaluations */
+        ValueType* blockStack; /* stack of evaluateBatch (BLOCK_SIZE values for each element), NULL until it is used */
+        Instruction* batchCode; /* code of the current batch (see planBatch), NULL until it is used */
+        size_t batchCodeSize;
+        BatchPlanElement* planStack; /* stack of planBatch */
+        bool batchVectorizable; /* all the calls in batchCode are fnVECTORIZABLE */
+        ValueType* slots; /* values of the common subexpressions (iSTORE, iLOAD), NULL if there are no slots */
+        unsigned int numSlots;
+        ValueType* blockSlots; /* slots of evaluateBlock (BLOCK_SIZE values for each slot) */
+        BatchPlanElement* planSlots; /* slots of planBatch */
 
     public:
 
@@ -61,14 +107,35 @@ namespace MExpr {
          * this array has the same length of the nodes in the abstract syntax tree.
          * Then, with a recursive navigation of the tree, it calculate the stack size and copy all the instruction in the
          * code array.
+         * It throws Error::codeTooLarge if the pools of the code have more than MAX_OPERAND elements.
+         * */
+        Code(ASTNode* exprAST) throw (Error);
+
+        /**
+         * Creates the Code like Code(exprAST), but the common subexpressions are computed once: the first occurrence
+         * stores its value in a slot (STORE), the others load it (LOAD). Only the subexpressions made of operations,
+         * variables and calls of fnPURE functions are shared (see Optimizer::findCommonSubexpressions), so the code
+         * must be created again if the functions of the environment change.
+         * The operands are also evaluated in the order that minimizes the stack (see
+         * Optimizer::findEvaluationOrder): the heavier operand of a binary operation is evaluated first, with the
+         * reversed instructions (RSUB, RDIV, RPOW) when the operation is not commutative.
          * */
-        Code(ASTNode* exprAST);
+        Code(ASTNode* exprAST, Environment* env) throw (Error);
 
         /**
          * Destroyer
          * */
         ~Code();
 
+        /**
+         * Returns a code that shares the instructions of this code (they never change), with its own stack, slots
+         * and profiling counters, so the two codes can be evaluated at the same time by two threads. The instructions
+         * don't refer to the tree, they only contain indexes in the pools of the code, so the tree can be deleted.
+         *
+         * Note: you must deallocate the new code
+         * */
+        Code* clone();
+
         /**
          * Evaluate the code.
          * This evaluation is faster than the evaluation used in the abstract syntax tree. In fact this evaluation
@@ -76,6 +143,26 @@ namespace MExpr {
          **/
         ValueType evaluate(Environment* env) throw (Error);
 
+        /**
+         * Evaluates the code for every row of a batch, and writes the results in the 'results' array (it must have
+         * batch->getRows() elements).
+         * First, the subexpressions that don't depend on the columns of the batch (loop invariants, for example
+         * _exp(r*t) with r and t scalars) are evaluated once and replaced by their value. The calls are replaced
+         * only for the fnPURE functions, the others could have side effects.
+         * Then the rows are evaluated in blocks of BLOCK_SIZE rows: every instruction is executed once for all the
+         * rows of a block, so the dispatch is paid once a block, and the arithmetic runs in tight loops over arrays.
+         * The functions with a batch version (see Environment::setBatchFunction) are called once a block.
+         * If a function that is not fnVECTORIZABLE is still called, the rows are evaluated one by one, so its calls
+         * happen in the same order of evaluate.
+         **/
+        void evaluateBatch(Environment* env, Batch* batch, ValueType* results) throw (Error);
+
+        /**
+         * Evaluates the code for every row of a batch like evaluateBatch, but the results of each block are added to
+         * the reduction instead of being written in an array.
+         **/
+        void evaluateBatch(Environment* env, Batch* batch, Reduction* reduction) throw (Error);
+
         /**
          * Returns a string representation of the code.
          *
@@ -83,13 +170,97 @@ namespace MExpr {
          */
         std::string* getCodeString();
 
+        /**
+         * Returns the number of instructions of the code
+         */
+        size_t getCodeSize();
+
+        /**
+         * Returns the bytes used by the instructions and their pools (4 bytes for each instruction, the constants
+         * without duplicates, the names of the functions), shared by the clones of the code
+         */
+        size_t getCodeBytes();
+
+        /**
+         * Returns the maximum number of stack elements needed to evaluate the code
+         */
+        unsigned int getStackSize();
+
+        /**
+         * Returns the profiling report of the evaluations: for each instruction the number of executions and the
+         * cycles spent (function calls included). It returns NULL if the library was compiled without the
+         * MEXPR_PROFILE definition: in that case the evaluation is not instrumented at all.
+         *
+         * Note: you must deallocate the report
+         */
+        ProfileType* getProfile();
+
+        /**
+         * Returns the code string annotated with the profiling counters, followed by a summary of the cycles
+         * spent for each instruction type, inside the called functions and in the evaluation loop.
+         * It returns NULL if the library was compiled without MEXPR_PROFILE.
+         *
+         * Note: you must deallocate the string
+         */
+        std::string* getProfileString();
+
+        /**
+         * Sets all the profiling counters to zero
+         */
+        void resetProfile();
+
     private:
 
+        /** used by clone */
+        Code();
+
+        /**
+         * Allocates the stack and the slots of the evaluations, the code must be already built
+         * */
+        void initState();
+
         /**
          * This method is used by the constructor to navigate the abstract syntax tree (populating the bytecode and
          * calculating the stack size)
          * */
-        void compile(ASTNode* exprAST, int* i, int* stackP);
+        void compile(ASTNode* exprAST, int* i, int* stackP, const std::map<ASTNode*, unsigned int>* cse,
+                bool* stored, const std::set<ASTNode*>* reversed, CodePools* pools) throw (Error);
+
+        /**
+         * Returns the compact instruction, with its operand added to the pools.
+         * It throws Error::codeTooLarge if the operand is not less than MAX_OPERAND.
+         * */
+        static PackedInstruction pack(const Instruction& in, CodePools* pools) throw (Error);
+
+        /**
+         * Returns the instruction with its operand taken from the pools (the pointers refer to the pools)
+         * */
+        Instruction unpack(PackedInstruction in);
+
+        /**
+         * Initializes the code of the tree, with the common subexpressions of 'cse' (NULL if there are none) in
+         * numSlots slots, and the operands of the nodes in 'reversed' (NULL if there are none) evaluated from the
+         * second
+         * */
+        void init(ASTNode* exprAST, const std::map<ASTNode*, unsigned int>* cse, unsigned int numSlots,
+                const std::set<ASTNode*>* reversed) throw (Error);
+
+        /**
+         * Builds batchCode: the code with the subexpressions that are invariant in the batch replaced by their value
+         * */
+        void planBatch(Environment* env, Batch* batch) throw (Error);
+
+        /**
+         * Evaluates batchCode on the rows [first, first + n) of a batch (n <= BLOCK_SIZE), the results are left in
+         * the first element of blockStack
+         * */
+        void evaluateBlock(Environment* env, Batch* batch, size_t first, size_t n) throw (Error);
+
+        /**
+         * Evaluates all the rows of a batch, the results of each block are copied in 'results' or added to 'reduction'
+         * (one of the two is NULL)
+         * */
+        void evaluateBlocks(Environment* env, Batch* batch, ValueType* results, Reduction* reduction) throw (Error);
     };
 
 } //end of namespace MExpr
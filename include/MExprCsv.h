@@ -0,0 +1,127 @@
+/*
+ * Mathematical Expressions - Delimited files evaluation
+ * Headers
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __MExprCsv_H__
+#define __MExprCsv_H__
+
+#include <stdio.h>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <MExprDefinitions.h>
+#include <MExprError.h>
+#include <MExprExpression.h>
+
+namespace MExpr {
+
+    /**
+     * CsvEvaluator evaluates an expression for each row of a delimited file (CSV, TSV, ...) and writes the results.
+     *
+     * The variables are bound to columns of the file, by index or by name (when the file has a header). With a header,
+     * the columns named with a single letter are bound to the variable with the same name, if they are not bound
+     * explicitly. The variables that are not bound to a column take the value of the environment of the expression.
+     *
+     * The input is read in place (the files are mapped in memory with mmap): the fields are never copied, the numbers
+     * are parsed directly from the input. The rows are evaluated in blocks with Expression::evaluateBatch.
+     *
+     * The output contains the result of each row, or the row followed by the result if append is set.
+     */
+    class CsvEvaluator {
+
+    public:
+        enum {
+            BLOCK_ROWS = 4096, /* rows parsed and evaluated together */
+            MAX_PRECISION = 17 /* significant digits of a double, more are not meaningful */
+        };
+
+    private:
+        Expression* expr;
+        char delimiter;
+        bool header;
+        bool append;
+        int precision;
+        std::string resultName;
+        std::map<char, std::string> namedColumns; /* variables bound to a column by name */
+        std::map<char, size_t> indexedColumns; /* variables bound to a column by index */
+        size_t line; /* current line of the input (from 1) */
+
+    public:
+        /**
+         * Creates an evaluator of the given expression (it doesn't own the expression).
+         * By default the delimiter is ',', the file has a header, and the output contains only the results (with
+         * 17 significant digits, so the values are exact)
+         */
+        CsvEvaluator(Expression* expr);
+
+        void setDelimiter(char delimiter);
+        void setHeader(bool header);
+        void setAppend(bool append);
+
+        /**
+         * Sets the significant digits of the results, between 1 and MAX_PRECISION (other values are clamped)
+         */
+        void setPrecision(int precision);
+
+        /**
+         * Sets the name of the result column in the output header (by default "result")
+         */
+        void setResultName(const std::string& name);
+
+        /**
+         * Binds a variable to the column with the given name (the file must have a header)
+         */
+        void bindColumn(char var, const std::string& name) throw (Error);
+
+        /**
+         * Binds a variable to the column with the given index (from 0)
+         */
+        void bindColumn(char var, size_t index) throw (Error);
+
+        /**
+         * Evaluates the rows of the data in memory and writes the output in the given file.
+         *
+         * @return the number of evaluated rows
+         */
+        size_t evaluate(const char* data, size_t size, FILE* out) throw (Error);
+
+        /**
+         * Evaluates the rows of the input file and writes the output file ("-" is the standard output)
+         *
+         * @return the number of evaluated rows
+         */
+        size_t evaluateFile(const std::string& inPath, const std::string& outPath) throw (Error);
+
+        /**
+         * Returns the line of the input where the last evaluation stopped (to report the errors)
+         */
+        size_t getLine();
+    };
+
+} //end of namespace MExpr
+
+#endif
@@ -29,6 +29,8 @@
 #ifndef __MExprDefinitions_H__
 #define __MExprDefinitions_H__
 
+#include <cstddef>
+
 namespace MExpr {
 
     /** Instruction value type */
@@ -43,11 +45,84 @@ namespace MExpr {
 
     /** functions type */
     typedef void (*FunctionPntrType)(StackType*);
+
+    /**
+     * Typed functions: they take the arguments as values and return the result, without a stack, so they can be
+     * plain C functions (e.g. sin, hypot). The n-ary functions receive the array of the arguments.
+     */
+    typedef ValueType (*UnaryFunctionPntrType)(ValueType);
+    typedef ValueType (*BinaryFunctionPntrType)(ValueType, ValueType);
+    typedef ValueType (*NaryFunctionPntrType)(const ValueType* args, unsigned int numArgs);
+
+    /**
+     * Batch functions: out[j] = f(args[0][j], ..., args[numArgs - 1][j]) for every j in [0, n).
+     * The arrays of the arguments and 'out' never overlap.
+     */
+    typedef void (*BatchFunctionPntrType)(const ValueType* const* args, ValueType* out, size_t n);
+
+    /** a function of the environment: only one of the pointers is not NULL (all NULL if it is not defined) */
     typedef struct {
-        FunctionPntrType fnPntr;
+        FunctionPntrType fnPntr; /* stack function */
+        UnaryFunctionPntrType fn1;
+        BinaryFunctionPntrType fn2;
+        NaryFunctionPntrType fnN;
+        BatchFunctionPntrType fnBatch; /* optional batch version of the function, used by the batch evaluation */
         unsigned int numArgs;
+        unsigned int attributes; /* FunctionAttribute flags */
+        unsigned int cost; /* approximate cost of a call in nanoseconds, 0 if unknown */
     } FunctionType;
 
+    /** returns true if the function is defined */
+    inline bool isFunctionDefined(const FunctionType& fn) {
+        return fn.fnPntr != NULL || fn.fn1 != NULL || fn.fn2 != NULL || fn.fnN != NULL;
+    }
+
+    /**
+     * Calls a function: its numArgs arguments on the top of the stack (the last argument is the top) are replaced by
+     * the result. The function must be defined.
+     */
+    inline void callFunction(const FunctionType& fn, StackType* s) {
+        if (fn.fn1 != NULL) {
+            s->stack[s->stp - 1] = fn.fn1(s->stack[s->stp - 1]);
+        } else if (fn.fn2 != NULL) {
+            s->stack[s->stp - 2] = fn.fn2(s->stack[s->stp - 2], s->stack[s->stp - 1]);
+            s->stp--;
+        } else if (fn.fnN != NULL) {
+            ValueType* args = s->stack + s->stp - fn.numArgs;
+            args[0] = fn.fnN(args, fn.numArgs);
+            s->stp = s->stp - fn.numArgs + 1;
+        } else {
+            (fn.fnPntr)(s);
+        }
+    }
+
+    /**
+     * Attributes of a function (see Environment::setFunction), they can be combined with '|'.
+     * A function without attributes is assumed to have side effects: it is called every time it appears in the
+     * expression, in the order of the evaluation.
+     */
+    typedef enum FunctionAttributeEnum {
+        /* no side effects, and the result depends only on the arguments and on memory that doesn't change during an
+         * evaluation: the repeated calls with the same arguments are computed once (Code), the calls with arguments
+         * that don't change are not repeated (incremental evaluation, batch invariants) */
+        fnPURE = 1,
+        /* pure, and the result depends only on the arguments: the calls with constant arguments are computed when the
+         * expression is compiled */
+        fnCONST = 2,
+        /* the function keeps no state between the calls: the batch evaluation can call it for a block of rows before
+         * the next instruction, otherwise it evaluates the rows one by one */
+        fnVECTORIZABLE = 4
+    } FunctionAttribute;
+
+    /**
+     * Accuracy of the standard functions in the batch evaluation (see Environment::setMathAccuracy and VecMath)
+     */
+    typedef enum MathAccuracyEnum {
+        mathACCURATE, /* the functions of math.h, the batch results are the same of the scalar evaluation */
+        mathULP1, /* vector implementations with errors within 1 ULP */
+        mathFAST /* faster vector implementations with errors within 4 ULP */
+    } MathAccuracy;
+
 } //end of namespace MExpr
 
 #endif
@@ -45,9 +45,36 @@ namespace MExpr {
 	 */
 	class Environment {
 
+	public:
+		/** bit of the functions in the masks of getChangedMask (the variables use the bits from 0 to 51) */
+		static const unsigned long long FUNCTIONS_BIT = 1ULL << 63;
+		/** bit of the calls of functions that are not fnPURE in the masks of ASTNode::prepareIncremental, the
+		 * incremental evaluation adds it to the changed mask so that these calls are never cached */
+		static const unsigned long long IMPURE_BIT = 1ULL << 62;
+
 	private:
-		std::map<char, ValueType>* variables;
-		std::map<std::string, FunctionType>* functions;
+		enum {
+			NUM_VARS = 52 /* 'a'-'z' and 'A'-'Z', indexed like the bits of getVarBit */
+		};
+
+		/** values of the variables, allocated by the first setVar or bindVar */
+		typedef struct {
+			ValueType values[NUM_VARS]; /* value of each variable */
+			const ValueType* pointers[NUM_VARS]; /* external value of each variable bound with bindVar, or NULL */
+			unsigned long long versions[NUM_VARS]; /* version of the last change of each variable */
+		} Variables;
+
+		Variables* vars; /* NULL until a variable is set, the environments of the clones often have none */
+		unsigned long long definedMask; /* mask of the variables that exist */
+		unsigned long long boundMask; /* mask of the variables bound with bindVar */
+		std::map<std::string, FunctionType>* functions; /* user functions, NULL until the first setFunction */
+		bool stdFunctions; /* true if the standard functions are visible (see setStdFunctions) */
+		MathAccuracy mathAccuracy; /* version of the standard functions (see setMathAccuracy) */
+		bool fastMath; /* the optimizations can reassociate the operations (see setFastMath) */
+		unsigned long long version; /* incremented at every change of a variable or function */
+		unsigned long long functionsVersion; /* version of the last change of a function */
+		unsigned long long markVersion; /* version of the last getChangedMask */
+		unsigned long long markMask; /* mask of the changes after markVersion */
 
 	public:
 		/**
@@ -55,6 +82,11 @@ namespace MExpr {
 		 * */
 		Environment();
 
+		/**
+		 * Creates a copy of an environment: the variables (also the bound ones), the functions and the options
+		 * */
+		Environment(const Environment& env);
+
 		/**
 		 * Destroyer
 		 * */
@@ -78,20 +110,156 @@ namespace MExpr {
 		bool isSetVar(char var);
 
 		/**
-		 * Returns the value of a variable. If it doesn't exist, it returns {NULL,0}
+		 * Binds a variable to an external value: the evaluations read the variable directly from *pointer, so it
+		 * is set up once and the value is changed by writing in the memory (e.g. the field of a struct), without
+		 * calling setVar. The memory must live until the variable is unbound.
+		 * Since the environment can't see the changes of a bound variable, the incremental evaluation considers it
+		 * changed at every evaluation (see getChangedMask).
+		 * setVar or a NULL pointer unbind the variable.
+		 * */
+		void bindVar(char var, const ValueType* pointer) throw(Error);
+
+		/**
+		 * Unbinds a variable bound with bindVar, it keeps the current value of the external memory
+		 * */
+		void unbindVar(char var) throw(Error);
+
+		/**
+		 * checks if a variable is bound to an external value
+		 * */
+		bool isBoundVar(char var);
+
+		/**
+		 * Returns a function given its name with the number of arguments (e.g. "_sin_1"). If it doesn't exist,
+		 * it returns {NULL,0}. The functions set with setFunction hide the standard functions with the same name.
 		 * */
-		FunctionType getFunction(std::string funcName);
+		FunctionType getFunction(const std::string& funcName);
 
 		/**
 		 * Sets the value of a function giving its pointer
 		 * if the function exists it will be overwritten
+		 *
+		 * The attributes (fnPURE, fnCONST, fnVECTORIZABLE combined with '|', see FunctionAttribute) say what the
+		 * optimizations can do with the calls, fnCONST implies fnPURE. The cost is the approximate time of a call in
+		 * nanoseconds (0 if unknown), the cheap calls are not worth keeping in a slot of the Code.
+		 * */
+		void setFunction(const std::string& funcName, FunctionPntrType funcPntr, unsigned int numArgs,
+				unsigned int attributes = 0, unsigned int cost = 0) throw(Error);
+
+		/**
+		 * Sets a typed function (e.g. setFunction("_gauss", &gauss) with 'double gauss(double)'): the number of
+		 * arguments is given by the type for the unary and binary functions. The typed functions are called directly,
+		 * without a stack, so they are cheaper than the stack functions.
+		 * */
+		void setFunction(const std::string& funcName, UnaryFunctionPntrType funcPntr, unsigned int attributes = 0,
+				unsigned int cost = 0) throw(Error);
+		void setFunction(const std::string& funcName, BinaryFunctionPntrType funcPntr, unsigned int attributes = 0,
+				unsigned int cost = 0) throw(Error);
+		void setFunction(const std::string& funcName, NaryFunctionPntrType funcPntr, unsigned int numArgs,
+				unsigned int attributes = 0, unsigned int cost = 0) throw(Error);
+
+		/**
+		 * Sets the batch version of a function already set (also of a standard function): the batch evaluation calls
+		 * it once for a block of rows instead of calling the function once per row (see BatchFunctionPntrType).
+		 * The function becomes fnVECTORIZABLE. Setting the function again removes its batch version.
+		 * It throws functionNotDefined if the function with numArgs arguments doesn't exist.
 		 * */
-		void setFunction(std::string funcName, FunctionPntrType funcPntr, unsigned int numArgs) throw(Error);
+		void setBatchFunction(const std::string& funcName, unsigned int numArgs, BatchFunctionPntrType funcPntr)
+				throw(Error);
 
 		/**
 		 * checks if a function exists
 		 * */
-		bool isSetFunction(std::string funcName);
+		bool isSetFunction(const std::string& funcName);
+
+		/**
+		 * Shows or hides the standard functions (_sin, _sqrt, ...). They are not copied in the environment: all the
+		 * environments share the same immutable table, so an environment with the standard functions costs as much
+		 * as an empty one. The Expression enables them in the environments that it creates.
+		 * */
+		void setStdFunctions(bool enabled);
+		bool hasStdFunctions();
+
+		/**
+		 * Sets the accuracy of the standard functions in the batch evaluation. With mathULP1 (errors within 1 ULP)
+		 * and mathFAST (within 4 ULP) _exp, _log, _sin, _cos and _tanh have the vector versions of VecMath, faster
+		 * than math.h, and the batch results can differ in the last bits from the ones of evaluate. The default is
+		 * mathACCURATE: math.h, the same results of evaluate. The functions set with setFunction are not affected.
+		 * */
+		void setMathAccuracy(MathAccuracy accuracy);
+		MathAccuracy getMathAccuracy();
+
+		/**
+		 * Allows the optimizations of Expression::compile(true) to reassociate the additions and multiplications:
+		 * the long chains are balanced (see Optimizer::reassociate) and the sums of monomials are computed as
+		 * polynomials (see Optimizer::recognizePolynomials), so the results can differ in the last bits from the ones
+		 * of the written order. By default it is disabled.
+		 * */
+		void setFastMath(bool enabled);
+		bool isFastMath();
+
+		/**
+		 * Returns the current version of the environment. It changes every time a variable takes a different value
+		 * or a function is set.
+		 * */
+		unsigned long long getVersion();
+
+		/**
+		 * Returns the version of the last change of the functions (setFunction, setStdFunctions, setMathAccuracy or
+		 * setFastMath)
+		 * */
+		inline unsigned long long getFunctionsVersion() {
+			return functionsVersion;
+		}
+
+		/**
+		 * Returns the mask of the variables (see getVarBit) and functions (FUNCTIONS_BIT) changed after the given
+		 * version. If the version is the current version of the previous call (the usual case with a single
+		 * expression), the mask is ready, otherwise it compares the versions of all the variables.
+		 * The variables bound with bindVar are always in the mask.
+		 * */
+		unsigned long long getChangedMask(unsigned long long sinceVersion);
+
+		/**
+		 * Returns the name of a function with the number of arguments, as it is stored in the environment and used by
+		 * the expressions (e.g. "_hypot", 2 -> "_hypot_2")
+		 * */
+		static std::string getMangledName(const std::string& funcName, unsigned int numArgs);
+
+		/**
+		 * Returns the bit of a variable in the masks: 'a'-'z' are the bits 0-25, 'A'-'Z' the bits 26-51
+		 * */
+		static inline unsigned long long getVarBit(char var) {
+			int i = getVarIndex(var);
+			return (i >= 0) ? 1ULL << i : 0;
+		}
+
+	private:
+		/**
+		 * Returns the index of a variable in Variables (the number of its bit in the masks), -1 if it is not a letter
+		 * */
+		static inline int getVarIndex(char var) {
+			if (var >= 'a' && var <= 'z')
+				return var - 'a';
+			if (var >= 'A' && var <= 'Z')
+				return 26 + var - 'A';
+			return -1;
+		}
+
+		/**
+		 * Returns the values of the variables, allocating them at the first call
+		 * */
+		Variables* getVariables();
+
+		/**
+		 * Sets a function with the name mangled with its number of arguments
+		 * */
+		void addFunction(const std::string& funcName, FunctionType fn) throw(Error);
+
+		/**
+		 * getChangedMask comparing the versions of all the variables
+		 * */
+		unsigned long long scanChangedMask(unsigned long long sinceVersion);
 
 	};
 
@@ -48,7 +48,11 @@ namespace MExpr {
 			unknownPrimitiveOp,
 			illegalArgsNum,
 			illegalFunctionName,
-			functionNotDefined
+			functionNotDefined,
+			fileError,
+			numberFormatError,
+			columnNotDefined,
+			codeTooLarge
 		};
 
 		Error(Error::Type t);
@@ -34,8 +34,16 @@
 #include <MExprError.h>
 #include <MExprAST.h>
 #include <MExprCode.h>
+#include <MExprGrid.h>
+#include <MExprTelemetry.h>
 
+/**
+ * Parses an expression and returns its abstract syntax tree (you must deallocate it with deleteTree).
+ * MExpr_ParseExpression is the hand-written parser used by the Expression, MExpr_ParseExpressionBison is the parser
+ * generated by bison from MExprParser.y: they accept the same expressions and build the same trees.
+ */
 extern MExpr::ASTNode* MExpr_ParseExpression(const std::string* expr) throw(MExpr::Error);
+extern MExpr::ASTNode* MExpr_ParseExpressionBison(const std::string* expr) throw(MExpr::Error);
 
 #include <cstddef>
 #include <stdexcept>
@@ -58,16 +66,31 @@ namespace MExpr {
 	 *
 	 * The evaluate method calculates the result recursively navigating the syntax abstract tree, if you have compiled the
 	 * expression, it use a faster non-recursive function that execute the bytecode.
+	 * An expression that is evaluated many times is compiled by itself (see setTiering).
 	 *
 	 */
 	class Expression {
 
+	public:
+		enum {
+			DEFAULT_COMPILE_AFTER = 16, /* evaluations with the tree before the compilation (see setTiering) */
+			DEFAULT_OPTIMIZE_AFTER = 1024 /* evaluations with the code before the optimized compilation */
+		};
+
 	private:
 		std::string* expr; /* expression string */
-		ASTNode* ast; /* expression abstract syntax tree */
+		ASTNode* ast; /* expression abstract syntax tree, shared by the clones (see clone) */
+		unsigned int* astRefs; /* number of expressions that share the abstract syntax tree */
 		bool optimizedAST; /* specify if the abstract syntax tree is optimized or not */
+		unsigned long long optimizedVersion; /* functions version of the environment used by the optimizations */
 		Code* code; /* compiled expression */
 		Environment* env; /* environment to evaluate the expression */
+		Histogram* latency; /* latencies of each Telemetry::Stage, NULL if the telemetry is not compiled */
+		bool incremental; /* incremental evaluation enabled */
+		unsigned long long incrementalVersion; /* version of the environment at the last incremental evaluation */
+		unsigned int compileAfter; /* see setTiering */
+		unsigned int optimizeAfter;
+		unsigned int promoteIn; /* evaluations before the next tier (see setTiering), 0 if the tier doesn't change */
 
 	public:
 		/**
@@ -95,6 +118,18 @@ namespace MExpr {
 		 * */
 		~Expression();
 
+		/**
+		 * Returns a copy of the expression that doesn't parse and compile it again: the abstract syntax tree and the
+		 * instructions of the code are shared (they are deleted with the last expression that uses them), the clone
+		 * has its own copy of the environment and its own stack. So the clones can be evaluated at the same time by
+		 * different threads, each with its own variables.
+		 * An incremental expression (see setIncrementalEvaluation) keeps the results in the tree, so its clone and an
+		 * expression that becomes incremental have their own copy of the tree.
+		 *
+		 * Note: you must deallocate the new expression
+		 * */
+		Expression* clone();
+
 		/**
 		 * Return a string representation of the tree.
 		 *
@@ -114,14 +149,70 @@ namespace MExpr {
 		std::string* getExprCodeString();
 
 		/**
+		 * Return the compiled expression annotated with the profiling counters (see Code::getProfileString).
+		 * It returns NULL if the expression is not compiled or if the library was compiled without MEXPR_PROFILE.
 		 *
+		 * Important: you must deallocate this string.
+		 *
+		 * @return a new string
 		 * */
-		void setVariable(char var, ValueType val) throw(Error);
+		std::string* getExprProfileString();
+
+		/**
+		 * Return the profiling report of the compiled expression (see Code::getProfile).
+		 * It returns NULL if the expression is not compiled or if the library was compiled without MEXPR_PROFILE.
+		 *
+		 * Important: you must deallocate the report.
+		 * */
+		ProfileType* getExprProfile();
 
 		/**
+		 * Return a copy of the latency histogram of a stage of this expression (see Telemetry).
+		 * It returns NULL if the library was compiled without MEXPR_TELEMETRY.
 		 *
+		 * Important: you must deallocate the histogram.
+		 * */
+		Histogram* getExprLatency(Telemetry::Stage stage);
+
+		/**
+		 *
+		 * */
+		void setVariable(char var, ValueType val) throw(Error);
+
+		/**
+		 * Binds a variable to an external value read at every evaluation, see Environment::bindVar
+		 * */
+		void bindVariable(char var, const ValueType* pointer) throw(Error);
+		void unbindVariable(char var) throw(Error);
+
+		/**
+		 * Sets a function of the environment, see Environment::setFunction for the attributes and the cost
+		 * */
+		void setFunction(std::string funcName, FunctionPntrType funcPntr, unsigned int numArgs,
+				unsigned int attributes = 0, unsigned int cost = 0) throw(Error);
+		void setFunction(std::string funcName, UnaryFunctionPntrType funcPntr, unsigned int attributes = 0,
+				unsigned int cost = 0) throw(Error);
+		void setFunction(std::string funcName, BinaryFunctionPntrType funcPntr, unsigned int attributes = 0,
+				unsigned int cost = 0) throw(Error);
+		void setFunction(std::string funcName, NaryFunctionPntrType funcPntr, unsigned int numArgs,
+				unsigned int attributes = 0, unsigned int cost = 0) throw(Error);
+
+		/**
+		 * Sets the batch version of a function, see Environment::setBatchFunction
+		 * */
+		void setBatchFunction(std::string funcName, unsigned int numArgs, BatchFunctionPntrType funcPntr)
+				throw(Error);
+
+		/**
+		 * Sets the accuracy of the standard functions in the batch evaluation, see Environment::setMathAccuracy
+		 * */
+		void setMathAccuracy(MathAccuracy accuracy);
+
+		/**
+		 * Allows the compilation to balance the chains of additions and multiplications and to compute the sums of
+		 * monomials as polynomials, see Environment::setFastMath
 		 * */
-		void setFunction(std::string funcName, FunctionPntrType funcPntr, unsigned int numArgs) throw(Error);
+		void setFastMath(bool enabled);
 
 		/**
 		 * Compile the abstract syntax tree. It creates a new Code class, this navigates the entire abstract syntax tree and
@@ -129,12 +220,26 @@ namespace MExpr {
 		 *
 		 * @param astOptimization if true the compile function create a new optimized abstract syntax tree, then it use this
 		 * new tree to compile the expression. After the compilation, the older tree will be replaced with the newer optimized
-		 * tree.
+		 * tree. The optimized tree has the constant subexpressions folded (also the calls of fnCONST functions), and
+		 * the Code computes the repeated subexpressions once (see Optimizer). The optimizations depend on the
+		 * attributes of the functions: if the functions of the environment change, the next evaluation parses and
+		 * optimizes the expression again.
+		 * A compilation requested by the caller stops the automatic compilations (see setTiering).
 		 *
 		 * */
 		void compile(bool astOptimization);
 		void compile();
 
+		/**
+		 * Sets the automatic compilation (tiering): a new expression is evaluated with the tree, that costs nothing to
+		 * prepare, after 'compileAfter' evaluations it is compiled without optimizations (compile(false)), then after
+		 * 'optimizeAfter' evaluations of the code it is compiled with the optimizations (compile(true)). So the
+		 * expressions evaluated few times don't pay the compilations, the ones evaluated many times reach the
+		 * optimized code. The evaluations with treeEvaluation and the incremental evaluations are not counted.
+		 * By default DEFAULT_COMPILE_AFTER and DEFAULT_OPTIMIZE_AFTER, 0 stops at the current tier.
+		 * */
+		void setTiering(unsigned int compileAfter, unsigned int optimizeAfter);
+
 		/**
 		 * Evaluate the expression
 		 *
@@ -150,7 +255,66 @@ namespace MExpr {
 		ValueType evaluate() throw(Error);
 		ValueType evaluate(bool treeEvaluation) throw(Error);
 
+		/**
+		 * Enable or disable the incremental evaluation (disabled by default).
+		 *
+		 * When it is enabled, every node of the abstract syntax tree keeps the result of its subtree, and the evaluate
+		 * method computes again only the subtrees that use the variables changed after the previous evaluation (setting
+		 * a variable to the same value is not a change). If only few variables change between two evaluations, the
+		 * cost is proportional to the depth of the tree instead of its size.
+		 * The incremental evaluation always uses the abstract syntax tree, also when the expression is compiled.
+		 * A call of a fnPURE function is evaluated again only when its arguments or a function of the environment
+		 * change, the calls of the other functions are evaluated every time.
+		 * */
+		void setIncrementalEvaluation(bool incremental);
+		bool isIncrementalEvaluation();
+
+		/**
+		 * Evaluate the expression for every row of a batch, and write the results in the 'results' array (it must
+		 * have batch->getRows() elements). The variables bound to a column of the batch take the value of the row,
+		 * the others take the value of the environment.
+		 *
+		 * The evaluation uses the Code, if the expression is not compiled it is compiled. See Code::evaluateBatch.
+		 * */
+		void evaluateBatch(Batch* batch, ValueType* results) throw(Error);
+
+		/**
+		 * Evaluate the expression for every row of a batch like evaluateBatch, and add the results to a reduction
+		 * (sum, mean, min, max, ... see Reduction) without writing them in an array: each block of results is
+		 * reduced while it is still in the cache. The rows are added to the rows already in the reduction.
+		 * */
+		void evaluateBatch(Batch* batch, Reduction* reduction) throw(Error);
+
+		/**
+		 * Evaluate the expression for every cell of a grid (every combination of the values of its axes), and write
+		 * the results in the 'results' array (it must have grid->getCells() elements, see Grid for the order).
+		 * The subexpressions that depend on only one axis are computed once for each value of the axis.
+		 * */
+		void evaluateGrid(Grid* grid, ValueType* results) throw(Error);
+
 		static ASTNode* createAST(const char* expr) throw(Error);
+
+	private:
+		/** used by clone */
+		Expression();
+
+		/** evaluation without telemetry */
+		ValueType evaluateExpr(bool treeEvaluation) throw(Error);
+
+		/** compilation without telemetry */
+		void compileExpr(bool astOptimization);
+
+		/** optimizes the expression again if it was optimized and the functions of the environment are changed */
+		void reoptimize() throw(Error);
+
+		/** compiles the expression for the next tier (see setTiering) */
+		void promote();
+
+		/** releases the tree, it is deleted if no other expression shares it */
+		void releaseAST();
+
+		/** copies the tree if it is shared with other expressions (the code is built again on the copy) */
+		void detachAST();
 	};
 
 } //end of namespace MExpr
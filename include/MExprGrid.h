@@ -0,0 +1,104 @@
+/*
+ * Mathematical Expressions - Grid
+ * Headers
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __MExprGrid_H__
+#define __MExprGrid_H__
+
+#include <cstddef>
+#include <vector>
+#include <MExprDefinitions.h>
+#include <MExprError.h>
+#include <MExprEnvironment.h>
+#include <MExprAST.h>
+
+namespace MExpr {
+
+    /**
+     * Grid is the Cartesian product of some axes: each axis is a variable with an array of values, and the cells of the
+     * grid are all the combinations of the values (see Expression::evaluateGrid). The results are written in a dense
+     * array in row-major order: the last axis added varies fastest, e.g. with the axes x (nx values) and y (ny values)
+     * the cell (i, j) is at results[i*ny + j].
+     *
+     * The grid doesn't copy the axes and doesn't own them, they must live until the evaluation ends.
+     *
+     * The subexpressions that depend on only one axis (and contain only operations, variables and calls of fnPURE
+     * functions) are computed once for each value of their axis, not once for each cell: with a separable expression
+     * like _sin(x)*_exp(-y^2) the calls are nx + ny instead of nx * ny. The variables that are not axes have the value
+     * of the environment.
+     */
+    class Grid {
+        std::vector<char> vars; /* variable of each axis */
+        std::vector<const ValueType*> values; /* values of each axis */
+        std::vector<size_t> sizes; /* number of values of each axis */
+
+    public:
+        /**
+         * Creates a grid without axes (a single cell)
+         */
+        Grid();
+
+        /**
+         * Adds an axis with 'size' values after the others, or replaces the values of the axis if the variable is
+         * already an axis
+         */
+        void addAxis(char var, const ValueType* values, size_t size) throw (Error);
+
+        /**
+         * Removes all the axes
+         */
+        void clear();
+
+        inline unsigned int getAxes() {
+            return vars.size();
+        }
+
+        inline char getAxisVariable(unsigned int axis) {
+            return vars[axis];
+        }
+
+        inline size_t getAxisSize(unsigned int axis) {
+            return sizes[axis];
+        }
+
+        /**
+         * Returns the number of cells (the product of the sizes of the axes)
+         */
+        size_t getCells();
+
+        /**
+         * Evaluates a tree for every cell of the grid and writes the results in the 'results' array (it must have
+         * getCells() elements). The single-axis subexpressions are computed for each value of their axis, then the
+         * rest of the tree is compiled and evaluated as a batch for each line of the grid (the cells with the same
+         * values of all the axes but the last).
+         */
+        void evaluate(ASTNode* ast, Environment* env, ValueType* results) throw (Error);
+    };
+
+} //end of namespace MExpr
+
+#endif
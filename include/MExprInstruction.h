@@ -43,7 +43,22 @@ namespace MExpr {
         iSUB, // '-'
         iDIV, // '/'
         iPOW, // '^'
-        iFUN  // functions
+        iFUN, // functions
+        iSTORE, // copies the top of the stack in a slot (common subexpressions)
+        iLOAD, // pushes the value of a slot
+        iLT, // '<', the comparisons and the logical operators push 1 (true) or 0 (false)
+        iLE, // '<='
+        iGT, // '>'
+        iGE, // '>='
+        iEQ, // '=='
+        iNE, // '!='
+        iAND, // '&&', the operands are true if they are not zero
+        iOR, // '||'
+        iSEL, // '_if(c, a, b)', a if c is not zero, otherwise b (all three are evaluated)
+        iRSUB, // '-' with the operands reversed: the first operand is on the top of the stack
+        iRDIV, // '/' with the operands reversed
+        iRPOW, // '^' with the operands reversed
+        iPOLY // polynomial with constant coefficients in the top of the stack (see ASTPolynomial)
     } InstructionType;
 
     /** Instruction structure */
@@ -53,9 +68,26 @@ namespace MExpr {
             ValueType value;
             char variable;
             std::string* funName;
+            unsigned int slot;
+            bool guarded; /* iDIV: the division by zero doesn't throw an error (see ASTPrimitiveOp::SEL) */
+            struct {
+                const ValueType* coefficients; /* degree + 1 coefficients, owned by the ASTPolynomial */
+                unsigned int degree;
+            } polynomial;
         } arg;
     } Instruction;
 
+    /**
+     * Compact instruction stored by the Code: the type in a byte and the operand in the other 24 bits. The operand is
+     * the index of the value in the pools of the code for iVAL (the constants), iFUN (the names of the functions) and
+     * iPOLY (the polynomials), the variable for iVAR, the slot for iSTORE and iLOAD, 1 for the guarded divisions.
+     * The indexes are less than Code::MAX_OPERAND, the Code of a larger expression can't be created.
+     */
+    typedef struct StructPackedInstr {
+        unsigned int type : 8;
+        unsigned int operand : 24;
+    } PackedInstruction;
+
 } //end of namespace MExpr
 
 #endif
@@ -0,0 +1,128 @@
+/*
+ * Mathematical Expressions - Optimizer
+ * Headers
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __MExprOptimizer_H__
+#define __MExprOptimizer_H__
+
+#include <map>
+#include <set>
+#include <MExprDefinitions.h>
+#include <MExprEnvironment.h>
+#include <MExprAST.h>
+
+namespace MExpr {
+
+    /**
+     * Optimizations of the abstract syntax trees, used by Expression::compile(true) and by the Code.
+     * The calls are optimized only if the function has the right attributes in the environment (fnPURE, fnCONST, see
+     * Environment::setFunction), so the optimized tree or code is valid until the functions of the environment change.
+     */
+    class Optimizer {
+
+    public:
+        enum {
+            DEFAULT_FUNCTION_COST = 20, /* cost of the functions without a cost hint */
+            CSE_MIN_COST = 3 /* minimum cost of a common subexpression kept in a slot (a STORE and a LOAD cost ~2) */
+        };
+
+        /**
+         * Returns a copy of the tree where the subtrees without variables are replaced by their value: the
+         * operations with constant operands and the calls of fnCONST functions with constant arguments.
+         * The operations that would throw an error (e.g. division by zero) are not folded, so the error is thrown by
+         * the evaluation.
+         *
+         * Note: you must deallocate the new tree (deleteTree)
+         */
+        static ASTNode* foldConstants(ASTNode* ast, Environment* env);
+
+        /**
+         * Returns a copy of the tree where the chains of additions and subtractions, and the chains of
+         * multiplications, are balanced: a + b + c + d becomes (a + b) + (c + d), so the operations of the two halves
+         * don't wait for each other. The subtractions are additions of negated terms (a - b + c becomes
+         * (a - b) + c with the terms in the same order), and the constant terms are moved together in front of the
+         * others, so foldConstants computes them. The terms keep their order, the results can differ only in the
+         * rounding (see Environment::setFastMath).
+         *
+         * Note: you must deallocate the new tree (deleteTree)
+         */
+        static ASTNode* reassociate(ASTNode* ast);
+
+        /**
+         * Returns a copy of the tree where the sums of monomials of a variable with constant coefficients, like
+         * 3x^4 + 2x^3 - x^2 + 5x + 1, are replaced by polynomials (see ASTPolynomial): the code computes them with a
+         * POLY instruction, a multiplication and an addition for each degree, instead of a power for each monomial.
+         * The monomials of different variables in the same sum become a polynomial for each variable, and the
+         * constant terms are added to the first polynomial. A variable needs a power or more than one monomial.
+         * The results can differ in the rounding (see Environment::setFastMath).
+         *
+         * Note: you must deallocate the new tree (deleteTree)
+         */
+        static ASTNode* recognizePolynomials(ASTNode* ast);
+
+        /**
+         * Returns a copy of the tree where the given subtrees are replaced by variables, e.g. to compute the
+         * subtrees apart and bind their values to the variables (see Grid).
+         *
+         * Note: you must deallocate the new tree (deleteTree)
+         */
+        static ASTNode* replaceSubtrees(ASTNode* ast, const std::map<ASTNode*, char>& variables);
+
+        /**
+         * Finds the subtrees that are computed more than once with the same result: the repeated subtrees that contain
+         * only operations, variables and calls of fnPURE functions, and cost at least CSE_MIN_COST.
+         * Every occurrence of a repeated subtree is added to 'slots' with the index of the slot that keeps its value:
+         * the first occurrence (in evaluation order) computes and stores the value, the others load it.
+         *
+         * @return the number of slots
+         */
+        static unsigned int findCommonSubexpressions(ASTNode* ast, Environment* env,
+                std::map<ASTNode*, unsigned int>* slots);
+
+        /**
+         * Chooses the order of evaluation of the operands that minimizes the stack needed by the code (Sethi-Ullman
+         * numbering): the operand that needs more stack elements is evaluated first, then the other one is evaluated
+         * while the result of the first waits in a single element. The binary operations whose second operand is
+         * evaluated first are added to 'reversed' (their code uses the reversed instructions, e.g. RSUB, or the
+         * mirrored comparisons). The operands of the functions are always evaluated in order, and two operands that
+         * both call functions without fnPURE are not swapped, so the calls that could have side effects keep their
+         * order.
+         *
+         * @return the stack elements needed by the tree (the common subexpressions are not considered)
+         */
+        static unsigned int findEvaluationOrder(ASTNode* ast, Environment* env, std::set<ASTNode*>* reversed);
+
+        /**
+         * Returns the approximate cost of the evaluation of a tree: the functions cost their cost hint (or
+         * DEFAULT_FUNCTION_COST), the instructions cost 1, the divisions 4, the powers 20 and the polynomials 2 for each degree
+         */
+        static unsigned int getCost(ASTNode* ast, Environment* env);
+    };
+
+} //end of namespace MExpr
+
+#endif
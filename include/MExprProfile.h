@@ -0,0 +1,89 @@
+/*
+ * Mathematical Expressions - Profiling
+ * Headers
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __MExprProfile_H__
+#define __MExprProfile_H__
+
+#include <cstddef>
+#include <vector>
+#include <MExprInstruction.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+namespace MExpr {
+
+    /**
+     * Reads the CPU cycle counter (the time stamp counter on x86, the virtual counter on ARM64).
+     * On other architectures it returns a monotonic time in nanoseconds.
+     */
+    inline unsigned long long readCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        unsigned long long v;
+        __asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (v));
+        return v;
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+    }
+
+    /** profiling counters of an instruction */
+    typedef struct {
+        unsigned long long count; /* number of executions */
+        unsigned long long cycles; /* cycles spent executing the instruction (function calls included) */
+        unsigned long long callCycles; /* cycles spent inside the called function (only for FUN) */
+    } ProfileCounterType;
+
+    /** profiling counters of the instruction at the given index of the code */
+    typedef struct {
+        size_t index;
+        Instruction instruction;
+        ProfileCounterType counter;
+    } ProfileEntryType;
+
+    /**
+     * Profiling report of a Code.
+     * The difference between totalCycles and the sum of the instruction cycles is the overhead of the
+     * evaluation loop (dispatch, stack setup and the reading of the cycle counter itself).
+     */
+    typedef struct {
+        unsigned long long evaluations; /* number of evaluations */
+        unsigned long long totalCycles; /* cycles spent in the evaluations */
+        std::vector<ProfileEntryType> entries; /* one entry for each instruction, in code order */
+    } ProfileType;
+
+} //end of namespace MExpr
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * Mathematical Expressions - Registry
+ * Headers
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __MExprRegistry_H__
+#define __MExprRegistry_H__
+
+#include <pthread.h>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+#include <MExprDefinitions.h>
+#include <MExprError.h>
+#include <MExprEnvironment.h>
+#include <MExprExpression.h>
+
+namespace MExpr {
+
+    /**
+     * Registry keeps compiled expressions by name, and lets the threads evaluate them while other threads publish
+     * new versions.
+     *
+     * A published expression never changes: publishing a name again replaces it with a new version, that the
+     * readers take at their next get. Every thread reads through its own Reader, that keeps a clone of the current
+     * version of each name (see Expression::clone: the tree and the code are shared, the variables are its own).
+     * As long as the version doesn't change, get only compares the version number, without locks. When it changes,
+     * the reader clones the new version inside an epoch: the replaced versions are deleted only after all the
+     * readers that could still be cloning them have left their epoch (epoch-based reclamation), by the writers
+     * (publish, remove, reclaim).
+     *
+     * The writers are serialized by a mutex, that the readers take only to create the Reader and the first time they
+     * get a name. Every version has its own environment, a copy of the environment of the registry (getEnvironment),
+     * that must not change while the other threads publish. The programs that use the registry must be linked with
+     * -lpthread.
+     */
+    class Registry {
+
+    private:
+        /** published expression */
+        typedef struct {
+            Expression* expression;
+            unsigned long long number;
+        } Version;
+
+        /** name published or got by a reader, never deleted before the registry */
+        typedef struct {
+            Version* current; /* NULL if the name is removed */
+            unsigned long long version; /* number of the last change */
+        } Entry;
+
+        /** version replaced in the given epoch */
+        typedef struct {
+            Version* version;
+            unsigned long long epoch;
+        } Retired;
+
+        /** epoch of a reader, 0 when the reader doesn't read the versions */
+        typedef struct StructReaderSlot {
+            unsigned long long epoch;
+            bool used;
+            struct StructReaderSlot* next;
+        } ReaderSlot;
+
+        std::map<std::string, Entry*> entries;
+        std::vector<Retired> retired; /* versions not yet deleted */
+        ReaderSlot* slots; /* list of the slots of the readers */
+        unsigned long long epoch; /* current epoch, starting from 1 */
+        unsigned long long versions; /* number of the last version */
+        Environment* env; /* environment copied in every version */
+        bool astOptimization;
+        pthread_mutex_t mutex; /* taken by the writers */
+
+    public:
+
+        /**
+         * A thread that evaluates the expressions of a registry.
+         * A reader must be used by one thread at a time, and deleted before the registry.
+         */
+        class Reader {
+
+        private:
+            /** clone of the version of a name */
+            typedef struct {
+                Entry* entry;
+                unsigned long long version;
+                Expression* expression;
+            } Cached;
+
+            Registry* registry;
+            ReaderSlot* slot;
+            std::map<std::string, Cached> cache;
+
+        public:
+            Reader(Registry* registry);
+
+            /**
+             * Destroyer, it deletes the clones of the reader
+             */
+            ~Reader();
+
+            /**
+             * Returns the clone of the current version of an expression, owned by the reader: it is valid until the
+             * next get of the same name, that returns another clone if a new version was published (the variables
+             * must be set again). It returns NULL if the name is not published.
+             */
+            Expression* get(const std::string& name);
+        };
+
+        Registry();
+
+        /**
+         * Destroyer, it deletes all the versions: the readers must be deleted before
+         */
+        ~Registry();
+
+        /**
+         * Returns the environment copied in every published version (with the standard functions)
+         */
+        Environment* getEnvironment();
+
+        /**
+         * Sets the compilation of the published expressions: with the optimizations of the tree or not (see
+         * Expression::compile(bool)), by default they are optimized
+         */
+        void setOptimization(bool astOptimization);
+
+        /**
+         * Parses and compiles an expression, then publishes it with the given name: the readers take it at their
+         * next get. The previous version is deleted when no reader can still use it.
+         * It throws the errors of the parsing, in that case the previous version stays published.
+         *
+         * @return the number of the new version
+         */
+        unsigned long long publish(const std::string& name, const std::string& expr) throw (Error);
+
+        /**
+         * Removes a name, the readers get NULL at their next get
+         *
+         * @return false if the name was not published
+         */
+        bool remove(const std::string& name);
+
+        /**
+         * Returns the number of the current version of a name, 0 if it is not published
+         */
+        unsigned long long getVersion(const std::string& name);
+
+        /**
+         * Deletes the replaced versions that the readers can't use anymore (done by publish and remove too)
+         */
+        void reclaim();
+
+        /**
+         * Returns the number of the replaced versions not yet deleted
+         */
+        size_t getRetiredCount();
+
+    private:
+        /**
+         * Returns the entry of a name, created without a version if it was never published
+         */
+        Entry* getEntry(const std::string& name);
+
+        /**
+         * Like getEntry, the mutex must be taken
+         */
+        Entry* createEntry(const std::string& name);
+
+        /**
+         * Replaces the version of an entry, the mutex must be taken
+         */
+        void replace(Entry* entry, Version* version);
+
+        /**
+         * Deletes the retired versions older than the epochs of the readers, the mutex must be taken
+         */
+        void reclaimRetired();
+    };
+
+} //end of namespace MExpr
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * Mathematical Expressions - Telemetry
+ * Headers
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __MExprTelemetry_H__
+#define __MExprTelemetry_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <MExprProfile.h>
+
+namespace MExpr {
+
+    /**
+     * Log-linear histogram of latencies (in cycles of the cycle counter, see readCycleCounter).
+     *
+     * The values lower than SUB_BUCKETS have a bucket each, the others are grouped by power of two and every power of
+     * two is split in SUB_BUCKETS linear buckets, so the relative error of a percentile is at most 1/SUB_BUCKETS.
+     * The histogram has a fixed size and never allocates memory.
+     *
+     * Only one thread can record in a histogram, but other threads can read or merge it while it is updated
+     * (the counters are read and written with relaxed atomic operations, without locked instructions).
+     */
+    class Histogram {
+
+    public:
+        enum {
+            SUB_BUCKETS = 8,
+            BUCKETS = 62 * 8
+        };
+
+    private:
+        unsigned long long counts[BUCKETS];
+        unsigned long long count; /* number of recorded values */
+        unsigned long long sum; /* sum of the recorded values */
+        unsigned long long min;
+        unsigned long long max;
+
+    public:
+        Histogram();
+
+        /**
+         * Records a value
+         */
+        inline void record(unsigned long long v) {
+            unsigned int b = bucketIndex(v);
+            __atomic_store_n(&counts[b], __atomic_load_n(&counts[b], __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&sum, __atomic_load_n(&sum, __ATOMIC_RELAXED) + v, __ATOMIC_RELAXED);
+            if (v < __atomic_load_n(&min, __ATOMIC_RELAXED))
+                __atomic_store_n(&min, v, __ATOMIC_RELAXED);
+            if (v > __atomic_load_n(&max, __ATOMIC_RELAXED))
+                __atomic_store_n(&max, v, __ATOMIC_RELAXED);
+            /* the count is the last one, a reader never sees more values than the buckets contain */
+            __atomic_store_n(&count, __atomic_load_n(&count, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+        }
+
+        /**
+         * Adds the values of another histogram
+         */
+        void merge(const Histogram& h);
+
+        /**
+         * Removes all the values
+         */
+        void reset();
+
+        unsigned long long getCount() const;
+        unsigned long long getSum() const;
+        unsigned long long getMin() const; /* 0 if the histogram is empty */
+        unsigned long long getMax() const;
+        double getMean() const;
+
+        /**
+         * Returns the value under which there are the p percent of the recorded values (p in [0, 100]),
+         * for example getPercentile(99.9) is the p999. It returns 0 if the histogram is empty.
+         */
+        unsigned long long getPercentile(double p) const;
+
+        /**
+         * Returns the bucket of a value
+         */
+        static inline unsigned int bucketIndex(unsigned long long v) {
+            if (v < SUB_BUCKETS)
+                return (unsigned int) v;
+            unsigned int e = 63 - __builtin_clzll(v); /* e >= 3 */
+            return (e - 2) * SUB_BUCKETS + (unsigned int) ((v >> (e - 3)) & (SUB_BUCKETS - 1));
+        }
+
+        /**
+         * Returns the smallest and the greatest value of a bucket
+         */
+        static unsigned long long bucketLow(unsigned int b);
+        static unsigned long long bucketHigh(unsigned int b);
+    };
+
+    /**
+     * Copy of the latencies at a given time.
+     * The first entry is the aggregate of all the expressions (also the deleted ones), the others are the expressions
+     * alive when the snapshot was taken.
+     */
+    class TelemetrySnapshot {
+    public:
+        double cyclesPerNs; /* to convert the cycles of the histograms in nanoseconds */
+        std::vector<std::string> exprs; /* expression strings, the first one is empty (aggregate) */
+        std::vector<Histogram> latency; /* Telemetry::STAGES histograms for each expression */
+
+        /**
+         * Returns the histogram of an entry and a stage
+         */
+        Histogram& getLatency(size_t entry, unsigned int stage);
+
+        /**
+         * Converts cycles in nanoseconds
+         */
+        double toNs(unsigned long long cycles);
+    };
+
+    /** function called for each histogram by Telemetry::exportTo: expr is NULL for the aggregate */
+    typedef void (*TelemetryExportFnType)(const std::string* expr, unsigned int stage, const Histogram& latency,
+            double cyclesPerNs, void* data);
+
+    /**
+     * Latency histograms of the parsing, compilation and evaluation of the expressions.
+     *
+     * The library records in these histograms only if it was compiled with the MEXPR_TELEMETRY definition, otherwise
+     * the Expression doesn't read the cycle counter at all. When it is compiled, the recording can be paused at runtime
+     * with setEnabled.
+     *
+     * Every Expression records in its own histograms and in the aggregate histograms of the current thread, so the
+     * recording never takes locks and never shares cache lines with other threads. A lock is taken only when a thread
+     * records for the first time, when an Expression is created or deleted, and when a snapshot is taken.
+     * The aggregate histograms of a thread are kept after the end of the thread.
+     */
+    class Telemetry {
+
+    public:
+        enum Stage {
+            PARSE, // MExpr_ParseExpression in the Expression constructor
+            COMPILE, // Code construction in Expression::compile
+            EVALUATE // Expression::evaluate (tree or code)
+        };
+
+        enum {
+            STAGES = 3
+        };
+
+        /**
+         * Returns true if the library was compiled with MEXPR_TELEMETRY
+         */
+        static bool isCompiled();
+
+        /**
+         * Pauses or resumes the recording (it is enabled by default)
+         */
+        static void setEnabled(bool enabled);
+        static bool isEnabled();
+
+        /**
+         * Returns the name of a stage ("parse", "compile" or "evaluate")
+         */
+        static const char* getStageName(unsigned int stage);
+
+        /**
+         * Records a latency of the current thread in the aggregate histograms, and in the histograms of an expression
+         * if exprLatency is not NULL. It is used by the Expression.
+         */
+        static void record(Stage stage, unsigned long long cycles, Histogram* exprLatency);
+
+        /**
+         * Registers (or unregisters) the histograms of an expression, so they are included in the snapshots.
+         * They are used by the Expression.
+         */
+        static void registerExpression(const std::string* expr, Histogram* latency);
+        static void unregisterExpression(Histogram* latency);
+
+        /**
+         * Returns a copy of all the histograms. The aggregate is the merge of the histograms of all the threads.
+         *
+         * Note: you must deallocate the snapshot
+         */
+        static TelemetrySnapshot* snapshot();
+
+        /**
+         * Calls the given function for each histogram of a new snapshot (to export them in a metrics system)
+         */
+        static void exportTo(TelemetryExportFnType fn, void* data);
+
+        /**
+         * Removes the values of the aggregate histograms
+         */
+        static void reset();
+
+        /**
+         * Returns the cycles of the cycle counter in a nanosecond. It is measured the first time (~10ms).
+         */
+        static double getCyclesPerNs();
+    };
+
+} //end of namespace MExpr
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Mathematical Expressions - Vector Math
+ * Headers
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __MExprVecMath_H__
+#define __MExprVecMath_H__
+
+#include <cstddef>
+#include <string>
+#include <MExprDefinitions.h>
+
+namespace MExpr {
+
+    /**
+     * Vector implementations of the most expensive standard functions, used by the batch evaluation when the
+     * environment has the mathULP1 or mathFAST accuracy (see Environment::setMathAccuracy).
+     *
+     * Every function computes out[i] = f(x[i]) for i in [0, n). The loops are branch free (polynomials and bit
+     * manipulations, no table lookups), so the compiler can vectorize them; the arguments outside the range of the
+     * polynomials (e.g. |x| > 708 for exp, the subnormals for log, |x| > 1e5 for sin and cos) and the special values
+     * are computed by math.h in a second pass. 'x' and 'out' can be the same array.
+     *
+     * With mathULP1 the errors are within 1 ULP, with mathFAST within 4 ULP (shorter polynomials),
+     * mathACCURATE calls the functions of math.h.
+     */
+    class VecMath {
+
+    public:
+        static void vexp(const ValueType* x, ValueType* out, size_t n, MathAccuracy accuracy);
+        static void vlog(const ValueType* x, ValueType* out, size_t n, MathAccuracy accuracy);
+        static void vsin(const ValueType* x, ValueType* out, size_t n, MathAccuracy accuracy);
+        static void vcos(const ValueType* x, ValueType* out, size_t n, MathAccuracy accuracy);
+        static void vtanh(const ValueType* x, ValueType* out, size_t n, MathAccuracy accuracy);
+
+        /**
+         * Returns the batch version of a standard function (the name without the number of arguments, e.g. "_exp")
+         * for an accuracy, or NULL if it doesn't have a vector implementation (or the accuracy is mathACCURATE)
+         */
+        static BatchFunctionPntrType getBatchFunction(const std::string& funcName, MathAccuracy accuracy);
+    };
+
+} //end of namespace MExpr
+
+#endif
@@ -26,6 +26,7 @@
  *
  */
 
+#include <string.h>
 #include <MExprAST.h>
 #include <cstddef>
 #include <string>
@@ -51,13 +52,26 @@ ASTPrimitiveOp::ASTPrimitiveOp(ASTPrimitiveOp::Type type) throw (Error) {
     case ASTPrimitiveOp::MUL:
     case ASTPrimitiveOp::DIV:
     case ASTPrimitiveOp::POW:
+    case ASTPrimitiveOp::LT:
+    case ASTPrimitiveOp::LE:
+    case ASTPrimitiveOp::GT:
+    case ASTPrimitiveOp::GE:
+    case ASTPrimitiveOp::EQ:
+    case ASTPrimitiveOp::NE:
+    case ASTPrimitiveOp::AND:
+    case ASTPrimitiveOp::OR:
         numChildren = 2;
         this->type = type;
         break;
+    case ASTPrimitiveOp::SEL:
+        numChildren = 3;
+        this->type = type;
+        break;
     default:
         throw Error(Error::unknownPrimitiveOp);
     }
 
+    guarded = false;
     children = new ASTNode*[numChildren];
 }
 
@@ -66,35 +80,73 @@ ASTPrimitiveOp::~ASTPrimitiveOp() {
 }
 
 void ASTPrimitiveOp::getExprTreeString_rec(stringstream* s, string* tabs, bool sameLine) {
+    const char* label = "";
     switch (type) {
     case ASTPrimitiveOp::ADD:
-        *s << "[ + ]";
+        label = "[ + ]";
         break;
     case ASTPrimitiveOp::SUB:
-        *s << "[ - ]";
+        label = "[ - ]";
         break;
     case ASTPrimitiveOp::MUL:
-        *s << "[ * ]";
+        label = "[ * ]";
         break;
     case ASTPrimitiveOp::DIV:
-        *s << "[ / ]";
+        label = "[ / ]";
         break;
     case ASTPrimitiveOp::POW:
-        *s << "[ ^ ]";
+        label = "[ ^ ]";
+        break;
+    case ASTPrimitiveOp::LT:
+        label = "[ < ]";
+        break;
+    case ASTPrimitiveOp::LE:
+        label = "[ <= ]";
+        break;
+    case ASTPrimitiveOp::GT:
+        label = "[ > ]";
+        break;
+    case ASTPrimitiveOp::GE:
+        label = "[ >= ]";
+        break;
+    case ASTPrimitiveOp::EQ:
+        label = "[ == ]";
+        break;
+    case ASTPrimitiveOp::NE:
+        label = "[ != ]";
+        break;
+    case ASTPrimitiveOp::AND:
+        label = "[ && ]";
+        break;
+    case ASTPrimitiveOp::OR:
+        label = "[ || ]";
+        break;
+    case ASTPrimitiveOp::SEL:
+        label = "[ if ]";
         break;
     }
+    *s << label;
+
+    /* the branches are as long as the label */
+    string pad(strlen(label) - 2, ' ');
+    string line;
+    for (size_t i = 2; i < strlen(label); i++)
+        line += "─";
 
     /* first child, print on the same line */
     *s << "─";
     string nt(*tabs);
-    nt += "  │   ";
+    nt += "  │" + pad;
     children[0]->getExprTreeString_rec(s, &nt, true);
 
-    /* second child */
-    *s << *tabs << "  └───";
-    string nt2(*tabs);
-    nt2 += "      ";
-    children[1]->getExprTreeString_rec(s, &nt2, false);
+    /* the other children, the select has three */
+    for (unsigned int i = 1; i < numChildren; i++) {
+        bool last = (i == numChildren - 1);
+        *s << *tabs << (last ? "  └" : "  ├") << line;
+        string nt2(*tabs);
+        nt2 += (last ? "   " : "  │") + pad;
+        children[i]->getExprTreeString_rec(s, &nt2, false);
+    }
 }
 
 unsigned int ASTPrimitiveOp::countNodes() {
@@ -114,14 +166,49 @@ ASTNode* ASTPrimitiveOp::getChild(unsigned int c) throw (Error) {
     return children[c];
 }
 
+/* marks as guarded the divisions of a subtree */
+static void guardDivisions(ASTNode* node) {
+    if (node->getMExprInstr().type == iDIV) //only the ASTPrimitiveOp are divisions
+        static_cast<ASTPrimitiveOp*>(node)->setGuarded(true);
+    for (unsigned int i = 0; i < node->countChildren(); i++)
+        guardDivisions(node->getChild(i));
+}
+
 void ASTPrimitiveOp::setChild(unsigned int c, ASTNode* node) throw (Error) {
     if (c >= numChildren)
         throw Error(Error::astWrongChild);
     children[c] = node;
+    if (type == ASTPrimitiveOp::SEL && c > 0) //the value of a discarded branch can be the result of a division by zero
+        guardDivisions(node);
+}
+
+void ASTPrimitiveOp::setGuarded(bool guarded) {
+    this->guarded = guarded;
+}
+
+ValueType ASTPrimitiveOp::compare(ValueType a, ValueType b) {
+    switch (type) {
+    case ASTPrimitiveOp::LT:
+        return (a < b) ? 1 : 0;
+    case ASTPrimitiveOp::LE:
+        return (a <= b) ? 1 : 0;
+    case ASTPrimitiveOp::GT:
+        return (a > b) ? 1 : 0;
+    case ASTPrimitiveOp::GE:
+        return (a >= b) ? 1 : 0;
+    case ASTPrimitiveOp::EQ:
+        return (a == b) ? 1 : 0;
+    case ASTPrimitiveOp::NE:
+        return (a != b) ? 1 : 0;
+    case ASTPrimitiveOp::AND:
+        return (a != 0 && b != 0) ? 1 : 0;
+    default: //OR
+        return (a != 0 || b != 0) ? 1 : 0;
+    }
 }
 
 ValueType ASTPrimitiveOp::evaluate(Environment* env) throw (Error) {
-    ValueType q;
+    ValueType q, c, b;
 
     switch (type) {
     case ASTPrimitiveOp::ADD:
@@ -132,15 +219,76 @@ ValueType ASTPrimitiveOp::evaluate(Environment* env) throw (Error) {
         return children[0]->evaluate(env) * children[1]->evaluate(env);
     case ASTPrimitiveOp::DIV:
         q = children[1]->evaluate(env);
-        if (q == 0)
+        if (q == 0 && !guarded)
             throw Error(Error::divisionByZero);
         return children[0]->evaluate(env) / q;
     case ASTPrimitiveOp::POW:
         return pow(children[0]->evaluate(env), children[1]->evaluate(env));
-        /*default:*/
-        /* no possible errors, the type was filtered by constructor */
+    case ASTPrimitiveOp::SEL: //all the children are evaluated, like the Code does
+        c = children[0]->evaluate(env);
+        q = children[1]->evaluate(env);
+        b = children[2]->evaluate(env);
+        return (c != 0) ? q : b;
+    default:
+        q = children[0]->evaluate(env);
+        return compare(q, children[1]->evaluate(env));
+    }
+}
+
+ValueType ASTPrimitiveOp::evaluateIncremental(Environment* env, unsigned long long changed) throw (Error) {
+    ValueType a, b, c;
+
+    if (cacheValid && (varMask & changed) == 0)
+        return cache;
+
+    cacheValid = false;
+    if (type == ASTPrimitiveOp::SEL) {
+        c = children[0]->evaluateIncremental(env, changed);
+        a = children[1]->evaluateIncremental(env, changed);
+        b = children[2]->evaluateIncremental(env, changed);
+        cache = (c != 0) ? a : b;
+        cacheValid = true;
+        return cache;
+    }
+    if (type == ASTPrimitiveOp::DIV) { //same order of evaluate
+        b = children[1]->evaluateIncremental(env, changed);
+        if (b == 0 && !guarded)
+            throw Error(Error::divisionByZero);
+        a = children[0]->evaluateIncremental(env, changed);
+    } else {
+        a = children[0]->evaluateIncremental(env, changed);
+        b = children[1]->evaluateIncremental(env, changed);
+    }
+    switch (type) {
+    case ASTPrimitiveOp::ADD:
+        cache = a + b;
+        break;
+    case ASTPrimitiveOp::SUB:
+        cache = a - b;
+        break;
+    case ASTPrimitiveOp::MUL:
+        cache = a * b;
+        break;
+    case ASTPrimitiveOp::DIV:
+        cache = a / b;
+        break;
+    case ASTPrimitiveOp::POW:
+        cache = pow(a, b);
+        break;
+    default:
+        cache = compare(a, b);
+        break;
     }
+    cacheValid = true;
+    return cache;
+}
 
+unsigned long long ASTPrimitiveOp::prepareIncremental(Environment* env) {
+    varMask = 0;
+    for (int i = 0; i < numChildren; i++)
+        varMask |= children[i]->prepareIncremental(env);
+    cacheValid = false;
+    return varMask;
 }
 
 void ASTPrimitiveOp::deleteTree() {
@@ -163,10 +311,38 @@ Instruction ASTPrimitiveOp::getMExprInstr() {
         break;
     case ASTPrimitiveOp::DIV:
         ris.type = iDIV;
+        ris.arg.guarded = guarded;
         break;
     case ASTPrimitiveOp::POW:
         ris.type = iPOW;
         break;
+    case ASTPrimitiveOp::LT:
+        ris.type = iLT;
+        break;
+    case ASTPrimitiveOp::LE:
+        ris.type = iLE;
+        break;
+    case ASTPrimitiveOp::GT:
+        ris.type = iGT;
+        break;
+    case ASTPrimitiveOp::GE:
+        ris.type = iGE;
+        break;
+    case ASTPrimitiveOp::EQ:
+        ris.type = iEQ;
+        break;
+    case ASTPrimitiveOp::NE:
+        ris.type = iNE;
+        break;
+    case ASTPrimitiveOp::AND:
+        ris.type = iAND;
+        break;
+    case ASTPrimitiveOp::OR:
+        ris.type = iOR;
+        break;
+    case ASTPrimitiveOp::SEL:
+        ris.type = iSEL;
+        break;
         /*default:*/
         /* no possible errors, the type was filtered by constructor */
     }
@@ -254,7 +430,7 @@ void ASTFunction::setChild(unsigned int c, ASTNode* node) throw (Error) {
 
 ValueType ASTFunction::evaluate(Environment* env) throw (Error) {
     FunctionType fn = env->getFunction(funcName);
-    if (fn.fnPntr == NULL)
+    if (!isFunctionDefined(fn))
         throw Error(Error::functionNotDefined);
     if (fn.numArgs != numChildren)
         throw Error(Error::illegalArgsNum);
@@ -269,10 +445,46 @@ ValueType ASTFunction::evaluate(Environment* env) throw (Error) {
     stack.size = numChildren;
     stack.stack = vals;
     stack.stp = numChildren;
-    (fn.fnPntr)(&stack);
+    callFunction(fn, &stack);
     return stack.stack[stack.stp - 1];
 }
 
+ValueType ASTFunction::evaluateIncremental(Environment* env, unsigned long long changed) throw (Error) {
+    if (cacheValid && (varMask & changed) == 0)
+        return cache;
+
+    cacheValid = false;
+    FunctionType fn = env->getFunction(funcName);
+    if (!isFunctionDefined(fn))
+        throw Error(Error::functionNotDefined);
+    if (fn.numArgs != numChildren)
+        throw Error(Error::illegalArgsNum);
+    ValueType vals[numChildren];
+
+    for (int i = 0; i < numChildren; i++)
+        vals[i] = children[i]->evaluateIncremental(env, changed);
+
+    StackType stack;
+    stack.size = numChildren;
+    stack.stack = vals;
+    stack.stp = numChildren;
+    callFunction(fn, &stack);
+    cache = stack.stack[stack.stp - 1];
+    cacheValid = true;
+    return cache;
+}
+
+unsigned long long ASTFunction::prepareIncremental(Environment* env) {
+    varMask = Environment::FUNCTIONS_BIT; //the subtree must be evaluated again if the function changes
+    FunctionType fn = env->getFunction(funcName);
+    if (!isFunctionDefined(fn) || !(fn.attributes & fnPURE))
+        varMask |= Environment::IMPURE_BIT; //the call could return a different value every time
+    for (int i = 0; i < numChildren; i++)
+        varMask |= children[i]->prepareIncremental(env);
+    cacheValid = false;
+    return varMask;
+}
+
 void ASTFunction::deleteTree() {
     for (int i = 0; i < numChildren; i++)
         children[i]->deleteTree(); // deallocate subtree
@@ -326,6 +538,14 @@ ValueType ASTValue::evaluate(Environment* env) throw (Error) {
     return value;
 }
 
+ValueType ASTValue::evaluateIncremental(Environment* env, unsigned long long changed) throw (Error) {
+    return value;
+}
+
+unsigned long long ASTValue::prepareIncremental(Environment* env) {
+    return 0;
+}
+
 Instruction ASTValue::getMExprInstr() {
     Instruction ris;
     ris.type = iVAL;
@@ -375,6 +595,17 @@ ValueType ASTVariable::evaluate(Environment* env) throw (Error) {
     return env->getVar(var);
 }
 
+ValueType ASTVariable::evaluateIncremental(Environment* env, unsigned long long changed) throw (Error) {
+    if (!env->isSetVar(var))
+        throw Error(Error::variableNotDefined);
+    return env->getVar(var);
+}
+
+unsigned long long ASTVariable::prepareIncremental(Environment* env) {
+    varMask = Environment::getVarBit(var);
+    return varMask;
+}
+
 Instruction ASTVariable::getMExprInstr() {
     Instruction ris;
     ris.type = iVAR;
@@ -383,3 +614,85 @@ Instruction ASTVariable::getMExprInstr() {
 }
 
 /*-------------------------------------------*/
+
+/*-- Polynomial -----------------------------*/
+
+ASTPolynomial::ASTPolynomial(const ValueType* coefficients, unsigned int degree) {
+    this->degree = degree;
+    this->coefficients = new ValueType[degree + 1];
+    memcpy(this->coefficients, coefficients, (degree + 1) * sizeof(ValueType));
+    child = NULL;
+}
+
+ASTPolynomial::~ASTPolynomial() {
+    delete[] coefficients;
+}
+
+void ASTPolynomial::getExprTreeString_rec(stringstream* s, string* tabs, bool sameLine) {
+    stringstream label(stringstream::in | stringstream::out);
+    label << "poly:";
+    for (unsigned int k = 0; k <= degree; k++)
+        label << " " << coefficients[k];
+    *s << "[ " << label.str() << " ]─";
+
+    string nt(*tabs);
+    nt += "     ";
+    for (int i = 0; i < label.str().length(); i++)
+        nt += " ";
+    child->getExprTreeString_rec(s, &nt, true);
+}
+
+unsigned int ASTPolynomial::countNodes() {
+    return 1 + child->countNodes();
+}
+
+unsigned int ASTPolynomial::countChildren() {
+    return 1;
+}
+
+ASTNode* ASTPolynomial::getChild(unsigned int c) throw (Error) {
+    if (c >= 1)
+        throw Error(Error::astWrongChild);
+    return child;
+}
+
+void ASTPolynomial::setChild(unsigned int c, ASTNode* node) throw (Error) {
+    if (c >= 1)
+        throw Error(Error::astWrongChild);
+    child = node;
+}
+
+ValueType ASTPolynomial::evaluate(Environment* env) throw (Error) {
+    return evaluatePolynomial(coefficients, degree, child->evaluate(env));
+}
+
+ValueType ASTPolynomial::evaluateIncremental(Environment* env, unsigned long long changed) throw (Error) {
+    if (cacheValid && (varMask & changed) == 0)
+        return cache;
+
+    cacheValid = false;
+    cache = evaluatePolynomial(coefficients, degree, child->evaluateIncremental(env, changed));
+    cacheValid = true;
+    return cache;
+}
+
+unsigned long long ASTPolynomial::prepareIncremental(Environment* env) {
+    varMask = child->prepareIncremental(env);
+    cacheValid = false;
+    return varMask;
+}
+
+void ASTPolynomial::deleteTree() {
+    child->deleteTree();
+    delete this;
+}
+
+Instruction ASTPolynomial::getMExprInstr() {
+    Instruction ris;
+    ris.type = iPOLY;
+    ris.arg.polynomial.coefficients = coefficients;
+    ris.arg.polynomial.degree = degree;
+    return ris;
+}
+
+/*-------------------------------------------*/
@@ -0,0 +1,195 @@
+/*
+ * Mathematical Expressions - Batch
+ * Implementation
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <math.h>
+#include <string.h>
+#include <MExprBatch.h>
+using namespace MExpr;
+
+Batch::Batch(size_t rows) {
+    this->rows = rows;
+    for (int i = 0; i < 128; i++) {
+        columns[i] = NULL;
+        strides[i] = sizeof(ValueType);
+        scalars[i] = 0;
+        scalarSet[i] = false;
+    }
+}
+
+void Batch::setColumn(char var, const ValueType* values, size_t stride) throw (Error) {
+    //check if not is [a-zA-Z]
+    if (var < 'A' || var > 'z' || ('Z' < var && var < 'a'))
+        throw Error(Error::illegalVariableName);
+
+    columns[(int) var] = values;
+    strides[(int) var] = stride;
+    scalarSet[(int) var] = false;
+}
+
+void Batch::setScalar(char var, ValueType value) throw (Error) {
+    //check if not is [a-zA-Z]
+    if (var < 'A' || var > 'z' || ('Z' < var && var < 'a'))
+        throw Error(Error::illegalVariableName);
+
+    columns[(int) var] = NULL;
+    scalars[(int) var] = value;
+    scalarSet[(int) var] = true;
+}
+
+void Batch::unbind(char var) throw (Error) {
+    //check if not is [a-zA-Z]
+    if (var < 'A' || var > 'z' || ('Z' < var && var < 'a'))
+        throw Error(Error::illegalVariableName);
+
+    columns[(int) var] = NULL;
+    scalarSet[(int) var] = false;
+}
+
+void Batch::setRows(size_t rows) {
+    this->rows = rows;
+}
+
+size_t Batch::getRows() {
+    return rows;
+}
+
+
+/*-- Reduction ------------------------------*/
+
+Reduction::Reduction(unsigned int aggregates, ValueType threshold) {
+    this->aggregates = aggregates;
+    this->threshold = threshold;
+    reset();
+}
+
+void Reduction::reset() {
+    rows = 0;
+    pendingSize = 0;
+    chunks = 0;
+    minValue = HUGE_VAL;
+    maxValue = -HUGE_VAL;
+    countAbove = 0;
+}
+
+void Reduction::add(const ValueType* values, size_t n) {
+    rows += n;
+
+    /* a loop for each aggregate, with the accumulators in registers */
+    if (aggregates & MIN) {
+        ValueType m = minValue;
+        for (size_t i = 0; i < n; i++)
+            m = (values[i] < m) ? values[i] : m;
+        minValue = m;
+    }
+    if (aggregates & MAX) {
+        ValueType m = maxValue;
+        for (size_t i = 0; i < n; i++)
+            m = (values[i] > m) ? values[i] : m;
+        maxValue = m;
+    }
+    if (aggregates & COUNT_ABOVE) {
+        size_t c = 0;
+        for (size_t i = 0; i < n; i++)
+            c += (values[i] > threshold) ? 1 : 0;
+        countAbove += c;
+    }
+
+    if (!(aggregates & SUM))
+        return;
+    while (n > 0) {
+        if (pendingSize == 0 && n >= CHUNK) { //a whole chunk, summed without copying it
+            addChunk(sumChunk(values, CHUNK));
+            values += CHUNK;
+            n -= CHUNK;
+            continue;
+        }
+        size_t k = (n < CHUNK - pendingSize) ? n : CHUNK - pendingSize;
+        memcpy(pending + pendingSize, values, k * sizeof(ValueType));
+        pendingSize += k;
+        values += k;
+        n -= k;
+        if (pendingSize == CHUNK) {
+            addChunk(sumChunk(pending, CHUNK));
+            pendingSize = 0;
+        }
+    }
+}
+
+ValueType Reduction::sumChunk(const ValueType* values, size_t n) {
+    ValueType acc[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        for (int k = 0; k < 8; k++)
+            acc[k] += values[i + k];
+    for (int k = 0; i < n; i++, k++)
+        acc[k] += values[i];
+    return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+}
+
+void Reduction::addChunk(ValueType sum) {
+    /* like the increment of a binary counter: the sums of the same number of chunks are added together */
+    int k = 0;
+    while (chunks & (1ULL << k)) {
+        sum = partial[k] + sum;
+        k++;
+    }
+    partial[k] = sum;
+    chunks++;
+}
+
+size_t Reduction::getRows() {
+    return rows;
+}
+
+ValueType Reduction::getSum() {
+    if (!(aggregates & SUM))
+        return NAN;
+    ValueType sum = sumChunk(pending, pendingSize);
+    for (int k = 0; k < 64; k++)
+        if (chunks & (1ULL << k))
+            sum = partial[k] + sum;
+    return sum;
+}
+
+ValueType Reduction::getMean() {
+    if (!(aggregates & SUM) || rows == 0)
+        return NAN;
+    return getSum() / rows;
+}
+
+ValueType Reduction::getMin() {
+    return (aggregates & MIN) ? minValue : NAN;
+}
+
+ValueType Reduction::getMax() {
+    return (aggregates & MAX) ? maxValue : NAN;
+}
+
+size_t Reduction::getCountAbove() {
+    return countAbove;
+}
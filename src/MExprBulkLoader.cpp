@@ -0,0 +1,169 @@
+/*
+ * Mathematical Expressions - Bulk loader
+ * Implementation
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <unistd.h>
+#include <pthread.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <MExprBulkLoader.h>
+#include <MExprStdFunc.h>
+using namespace std;
+using namespace MExpr;
+
+BulkLoader::BulkLoader(unsigned int threads) {
+    this->threads = threads;
+    astOptimization = true;
+    next = 0;
+    loaded = 0;
+    env = new Environment();
+    StdFunc::initializeEnv(env);
+}
+
+BulkLoader::~BulkLoader() {
+    for (size_t i = 0; i < expressions.size(); i++)
+        delete expressions[i];
+    delete env;
+}
+
+Environment* BulkLoader::getEnvironment() {
+    return env;
+}
+
+void BulkLoader::setOptimization(bool astOptimization) {
+    this->astOptimization = astOptimization;
+}
+
+size_t BulkLoader::add(const string& expr) {
+    exprs.push_back(expr);
+    return exprs.size() - 1;
+}
+
+size_t BulkLoader::addFile(const string& path) throw (Error) {
+    ifstream in(path.c_str());
+    if (!in)
+        throw Error(Error::fileError);
+
+    size_t n = 0;
+    string line;
+    while (getline(in, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (line.empty())
+            continue;
+        exprs.push_back(line);
+        n++;
+    }
+    if (in.bad())
+        throw Error(Error::fileError);
+    return n;
+}
+
+size_t BulkLoader::load() {
+    size_t first = loaded;
+    size_t n = exprs.size();
+    expressions.resize(n, NULL);
+    errors.resize(n, -1);
+    next = first;
+
+    unsigned int t = threads;
+    if (t == 0) {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        t = (processors > 0) ? (unsigned int) processors : 1;
+    }
+    size_t chunks = (n - first + CHUNK - 1) / CHUNK;
+    if (t > chunks)
+        t = (chunks > 0) ? chunks : 1;
+
+    /* the calling thread loads the expressions too, with t - 1 other threads */
+    vector<pthread_t> pool(t - 1);
+    size_t started = 0;
+    while (started < pool.size() && pthread_create(&pool[started], NULL, &BulkLoader::run, this) == 0)
+        started++;
+    loadChunks();
+    for (size_t i = 0; i < started; i++)
+        pthread_join(pool[i], NULL);
+    loaded = n;
+
+    size_t failed = 0;
+    for (size_t i = first; i < n; i++)
+        if (errors[i] >= 0)
+            failed++;
+    return failed;
+}
+
+void BulkLoader::loadChunks() {
+    size_t n = exprs.size();
+    for (;;) {
+        size_t first = __atomic_fetch_add(&next, (size_t) CHUNK, __ATOMIC_RELAXED);
+        if (first >= n)
+            return;
+        size_t last = (n - first < CHUNK) ? n : first + CHUNK;
+        for (size_t i = first; i < last; i++) {
+            try {
+                Expression* e = new Expression(exprs[i], new Environment(*env)); //the expression owns the copy
+                e->compile(astOptimization);
+                expressions[i] = e;
+            } catch (Error& ex) {
+                errors[i] = ex.getType();
+            }
+        }
+    }
+}
+
+void* BulkLoader::run(void* loader) {
+    ((BulkLoader*) loader)->loadChunks();
+    return NULL;
+}
+
+size_t BulkLoader::size() {
+    return exprs.size();
+}
+
+const string& BulkLoader::getString(size_t index) {
+    return exprs[index];
+}
+
+Expression* BulkLoader::getExpression(size_t index) {
+    return (index < expressions.size()) ? expressions[index] : NULL;
+}
+
+Expression* BulkLoader::release(size_t index) {
+    Expression* e = getExpression(index);
+    if (e != NULL)
+        expressions[index] = NULL;
+    return e;
+}
+
+bool BulkLoader::hasError(size_t index) {
+    return index < errors.size() && errors[index] >= 0;
+}
+
+Error::Type BulkLoader::getError(size_t index) {
+    return (Error::Type) errors[index];
+}
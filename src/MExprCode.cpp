@@ -27,87 +27,417 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <string>
 #include <sstream>
+#include <iomanip>
 #include <MExprCode.h>
+#include <MExprOptimizer.h>
 using namespace std;
 using namespace MExpr;
 
 
-Code::Code(ASTNode* exprAST) {
+Code::Code(ASTNode* exprAST) throw (Error) {
+    init(exprAST, NULL, 0, NULL);
+}
+
+Code::Code(ASTNode* exprAST, Environment* env) throw (Error) {
+    map<ASTNode*, unsigned int> cse;
+    set<ASTNode*> reversed;
+    unsigned int n = Optimizer::findCommonSubexpressions(exprAST, env, &cse);
+    Optimizer::findEvaluationOrder(exprAST, env, &reversed);
+    init(exprAST, (n > 0) ? &cse : NULL, n, reversed.empty() ? NULL : &reversed);
+}
+
+Code::Code() {
+}
+
+Code* Code::clone() {
+    Code* c = new Code();
+    c->code = code;
+    c->codeRefs = codeRefs;
+    __atomic_add_fetch(codeRefs, 1, __ATOMIC_RELAXED);
+    c->codeSize = codeSize;
+    c->constants = constants;
+    c->numConstants = numConstants;
+    c->functions = functions;
+    c->numFunctions = numFunctions;
+    c->polynomials = polynomials;
+    c->numPolynomials = numPolynomials;
+    c->stack.size = stack.size;
+    c->numSlots = numSlots;
+    c->initState();
+    return c;
+}
+
+void Code::init(ASTNode* exprAST, const map<ASTNode*, unsigned int>* cse, unsigned int numSlots,
+        const set<ASTNode*>* reversed) throw (Error) {
     int i = 0; //shared integer for all functions (called recursively)
     int stackP = 0; //shared integer (represent the current stack size (not the max))
+    if (numSlots > MAX_OPERAND) //the operands of STORE and LOAD, the others are checked by pack
+        throw Error(Error::codeTooLarge);
 
-    codeSize = (size_t) exprAST->countNodes();
-    code = new Instruction[codeSize];
+    /* every slot adds a STORE, the loaded subexpressions are shorter than their nodes */
+    code = new PackedInstruction[exprAST->countNodes() + numSlots];
+    codeRefs = new unsigned int(1);
     stack.size = 0;
-    compile(exprAST, &i, &stackP);
+    this->numSlots = numSlots;
+    bool* stored = NULL;
+    if (numSlots > 0) {
+        stored = new bool[numSlots];
+        memset(stored, 0, numSlots * sizeof(bool));
+    }
+    CodePools pools;
+    try {
+        compile(exprAST, &i, &stackP, cse, stored, reversed, &pools);
+    } catch (Error& ex) { //the destroyer is not called
+        delete[] stored;
+        delete[] code;
+        delete codeRefs;
+        throw;
+    }
+    delete[] stored;
+    codeSize = (size_t) i;
+
+    numConstants = pools.constants.size();
+    constants = (numConstants > 0) ? new ValueType[numConstants] : NULL;
+    for (unsigned int k = 0; k < numConstants; k++)
+        constants[k] = pools.constants[k];
+    numFunctions = pools.functions.size();
+    functions = (numFunctions > 0) ? new string[numFunctions] : NULL;
+    for (unsigned int k = 0; k < numFunctions; k++)
+        functions[k] = pools.functions[k];
+    numPolynomials = pools.polynomials.size() / 2;
+    polynomials = (numPolynomials > 0) ? new unsigned int[2 * numPolynomials] : NULL;
+    for (unsigned int k = 0; k < 2 * numPolynomials; k++)
+        polynomials[k] = pools.polynomials[k];
+    initState();
+}
+
+void Code::initState() {
     stack.stack = new ValueType[stack.size];
+    slots = (numSlots > 0) ? new ValueType[numSlots] : NULL;
+    blockStack = NULL;
+    batchCode = NULL;
+    batchCodeSize = 0;
+    batchVectorizable = true;
+    planStack = NULL;
+    blockSlots = NULL;
+    planSlots = NULL;
+
+    profile = NULL;
+#ifdef MEXPR_PROFILE
+    profile = new ProfileCounterType[codeSize];
+    resetProfile();
+#endif
+}
+
+/** instruction of a binary operation with the operands evaluated in the reversed order */
+static InstructionType reverse(InstructionType type) {
+    switch (type) {
+    case iSUB:
+        return iRSUB;
+    case iDIV:
+        return iRDIV;
+    case iPOW:
+        return iRPOW;
+    case iLT:
+        return iGT;
+    case iLE:
+        return iGE;
+    case iGT:
+        return iLT;
+    case iGE:
+        return iLE;
+    default: //commutative
+        return type;
+    }
+}
+
+PackedInstruction Code::pack(const Instruction& in, CodePools* pools) throw (Error) {
+    PackedInstruction ris;
+    ris.type = in.type;
+    unsigned int operand = 0; //checked before it is stored in the 24 bits
+
+    switch (in.type) {
+    case iVAL: {
+        string key((const char*) &in.arg.value, sizeof(ValueType)); //-0 and the NaNs are kept apart
+        map<string, unsigned int>::iterator it = pools->constantIndex.find(key);
+        if (it != pools->constantIndex.end()) {
+            operand = it->second;
+        } else {
+            operand = pools->constants.size();
+            pools->constantIndex[key] = operand;
+            pools->constants.push_back(in.arg.value);
+        }
+        break;
+    }
+    case iVAR:
+        operand = (unsigned char) in.arg.variable;
+        break;
+    case iFUN: {
+        map<string, unsigned int>::iterator it = pools->functionIndex.find(*in.arg.funName);
+        if (it != pools->functionIndex.end()) {
+            operand = it->second;
+        } else {
+            operand = pools->functions.size();
+            pools->functionIndex[*in.arg.funName] = operand;
+            pools->functions.push_back(*in.arg.funName);
+        }
+        break;
+    }
+    case iSTORE:
+    case iLOAD:
+        operand = in.arg.slot;
+        break;
+    case iDIV:
+    case iRDIV:
+        operand = in.arg.guarded ? 1 : 0;
+        break;
+    case iPOLY: //the coefficients are contiguous in the constants
+        operand = pools->polynomials.size() / 2;
+        pools->polynomials.push_back(pools->constants.size());
+        pools->polynomials.push_back(in.arg.polynomial.degree);
+        for (unsigned int k = 0; k <= in.arg.polynomial.degree; k++)
+            pools->constants.push_back(in.arg.polynomial.coefficients[k]);
+        break;
+    default:
+        break;
+    }
+    if (operand >= MAX_OPERAND)
+        throw Error(Error::codeTooLarge);
+    ris.operand = operand;
+    return ris;
+}
+
+Instruction Code::unpack(PackedInstruction in) {
+    Instruction ris;
+    ris.type = (InstructionType) in.type;
+
+    switch (ris.type) {
+    case iVAL:
+        ris.arg.value = constants[in.operand];
+        break;
+    case iVAR:
+        ris.arg.variable = (char) in.operand;
+        break;
+    case iFUN:
+        ris.arg.funName = &functions[in.operand];
+        break;
+    case iSTORE:
+    case iLOAD:
+        ris.arg.slot = in.operand;
+        break;
+    case iDIV:
+    case iRDIV:
+        ris.arg.guarded = in.operand != 0;
+        break;
+    case iPOLY:
+        ris.arg.polynomial.coefficients = constants + polynomials[2 * in.operand];
+        ris.arg.polynomial.degree = polynomials[2 * in.operand + 1];
+        break;
+    default:
+        ris.arg.value = 0;
+        break;
+    }
+    return ris;
 }
 
 /** code array population and stack size calculation */
-void Code::compile(ASTNode* exprAST, int* i, int* stackP) {
+void Code::compile(ASTNode* exprAST, int* i, int* stackP, const map<ASTNode*, unsigned int>* cse, bool* stored,
+        const set<ASTNode*>* reversed, CodePools* pools) throw (Error) {
     unsigned int chsNum = exprAST->countChildren();
+    int slot = -1;
 
-    for (int j = 0; j < chsNum; j++)
-        compile(exprAST->getChild(j), i, stackP);
-    code[*i] = exprAST->getMExprInstr(); //instruction copy on array
+    if (cse != NULL) {
+        map<ASTNode*, unsigned int>::const_iterator it = cse->find(exprAST);
+        if (it != cse->end()) {
+            slot = it->second;
+            if (stored[slot]) { //the subexpression was already computed
+                code[*i].type = iLOAD;
+                code[*i].operand = slot;
+                (*stackP)++;
+                if (*stackP > stack.size)
+                    stack.size = *stackP;
+                (*i)++;
+                return;
+            }
+        }
+    }
+
+    if (reversed != NULL && reversed->find(exprAST) != reversed->end()) { //the second operand first
+        compile(exprAST->getChild(1), i, stackP, cse, stored, reversed, pools);
+        compile(exprAST->getChild(0), i, stackP, cse, stored, reversed, pools);
+        Instruction in = exprAST->getMExprInstr();
+        in.type = reverse(in.type);
+        code[*i] = pack(in, pools);
+    } else {
+        for (int j = 0; j < chsNum; j++)
+            compile(exprAST->getChild(j), i, stackP, cse, stored, reversed, pools);
+        code[*i] = pack(exprAST->getMExprInstr(), pools); //instruction copy on array
+    }
     (*stackP) = (*stackP) + 1 - chsNum; //evalutation returns 1 result but needs chsNum arguments
     if (*stackP > stack.size)
         stack.size = *stackP; //stackSize must be the max of stackP
     (*i)++;
+
+    if (slot >= 0) {
+        code[*i].type = iSTORE;
+        code[*i].operand = slot;
+        stored[slot] = true;
+        (*i)++;
+    }
+}
+
+/** writes the text representation of an instruction (without the end of line) */
+static void writeInstruction(stringstream* s, const Instruction& instr) {
+    switch (instr.type) {
+    case iADD:
+        *s << "ADD";
+        break;
+    case iSUB:
+        *s << "SUB";
+        break;
+    case iMUL:
+        *s << "MUL";
+        break;
+    case iDIV:
+        *s << (instr.arg.guarded ? "DIV: guarded" : "DIV");
+        break;
+    case iPOW:
+        *s << "POW";
+        break;
+    case iVAL:
+        *s << "VAL: " << instr.arg.value;
+        break;
+    case iVAR:
+        *s << "VAR: " << instr.arg.variable;
+        break;
+    case iFUN:
+        *s << "FUN: " << *instr.arg.funName;
+        break;
+    case iSTORE:
+        *s << "STORE: " << instr.arg.slot;
+        break;
+    case iLOAD:
+        *s << "LOAD: " << instr.arg.slot;
+        break;
+    case iLT:
+        *s << "LT";
+        break;
+    case iLE:
+        *s << "LE";
+        break;
+    case iGT:
+        *s << "GT";
+        break;
+    case iGE:
+        *s << "GE";
+        break;
+    case iEQ:
+        *s << "EQ";
+        break;
+    case iNE:
+        *s << "NE";
+        break;
+    case iAND:
+        *s << "AND";
+        break;
+    case iOR:
+        *s << "OR";
+        break;
+    case iSEL:
+        *s << "SEL";
+        break;
+    case iRSUB:
+        *s << "RSUB";
+        break;
+    case iRDIV:
+        *s << (instr.arg.guarded ? "RDIV: guarded" : "RDIV");
+        break;
+    case iRPOW:
+        *s << "RPOW";
+        break;
+    case iPOLY:
+        *s << "POLY:";
+        for (unsigned int k = 0; k <= instr.arg.polynomial.degree; k++)
+            *s << " " << instr.arg.polynomial.coefficients[k];
+        break;
+    }
+}
+
+/** result of the comparisons and of the logical operators (1 or 0) */
+static inline ValueType compare(InstructionType type, ValueType a, ValueType b) {
+    switch (type) {
+    case iLT:
+        return (a < b) ? 1 : 0;
+    case iLE:
+        return (a <= b) ? 1 : 0;
+    case iGT:
+        return (a > b) ? 1 : 0;
+    case iGE:
+        return (a >= b) ? 1 : 0;
+    case iEQ:
+        return (a == b) ? 1 : 0;
+    case iNE:
+        return (a != b) ? 1 : 0;
+    case iAND:
+        return (a != 0 && b != 0) ? 1 : 0;
+    default: //iOR
+        return (a != 0 || b != 0) ? 1 : 0;
+    }
 }
 
 string* Code::getCodeString() {
     stringstream s(stringstream::in | stringstream::out);
 
     for (int i = 0; i < codeSize; i++) {
-        switch (code[i].type) {
-        case iADD:
-            s << "ADD" << endl;
-            break;
-        case iSUB:
-            s << "SUB" << endl;
-            break;
-        case iMUL:
-            s << "MUL" << endl;
-            break;
-        case iDIV:
-            s << "DIV" << endl;
-            break;
-        case iPOW:
-            s << "POW" << endl;
-            break;
-        case iVAL:
-            s << "VAL: " << code[i].arg.value << endl;
-            break;
-        case iVAR:
-            s << "VAR: " << code[i].arg.variable << endl;
-            break;
-        case iFUN:
-            s << "FUN: " << *code[i].arg.funName << endl;
-        }
+        writeInstruction(&s, unpack(code[i]));
+        s << endl;
     }
 
     return new string(s.str());
 }
 
+size_t Code::getCodeSize() {
+    return codeSize;
+}
+
+size_t Code::getCodeBytes() {
+    size_t bytes = codeSize * sizeof(PackedInstruction) + numConstants * sizeof(ValueType)
+            + numPolynomials * 2 * sizeof(unsigned int);
+    for (unsigned int k = 0; k < numFunctions; k++)
+        bytes += sizeof(string) + functions[k].length() + 1;
+    return bytes;
+}
+
+unsigned int Code::getStackSize() {
+    return stack.size;
+}
+
 ValueType Code::evaluate(Environment* env) throw (Error) {
     FunctionType fn;
+#ifdef MEXPR_PROFILE
+    unsigned long long evalStart = readCycleCounter();
+    unsigned long long instrStart, callStart;
+#endif
 
     stack.stp = 0;
     for (int i = 0; i < codeSize; i++) {
+#ifdef MEXPR_PROFILE
+        instrStart = readCycleCounter();
+#endif
 
         /* Switch */
         switch (code[i].type) {
         case iVAL:
-            stack.stack[stack.stp] = code[i].arg.value;
+            stack.stack[stack.stp] = constants[code[i].operand];
             stack.stp++;
             break;
         case iVAR:
-            if (!env->isSetVar(code[i].arg.variable))
+            if (!env->isSetVar((char) code[i].operand))
                 throw Error(Error::variableNotDefined);
-            stack.stack[stack.stp] = env->getVar(code[i].arg.variable);
+            stack.stack[stack.stp] = env->getVar((char) code[i].operand);
             stack.stp++;
             break;
         case iADD:
@@ -123,7 +453,7 @@ ValueType Code::evaluate(Environment* env) throw (Error) {
             stack.stp--;
             break;
         case iDIV:
-            if (stack.stack[stack.stp - 1] == 0)
+            if (stack.stack[stack.stp - 1] == 0 && !code[i].operand)
                 throw Error(Error::divisionByZero);
             stack.stack[stack.stp - 2] = stack.stack[stack.stp - 2] / stack.stack[stack.stp - 1];
             stack.stp--;
@@ -133,18 +463,613 @@ ValueType Code::evaluate(Environment* env) throw (Error) {
             stack.stp--;
             break;
         case iFUN:
-            fn = env->getFunction(*code[i].arg.funName);
-            if (fn.fnPntr == NULL)
+            fn = env->getFunction(functions[code[i].operand]);
+            if (!isFunctionDefined(fn))
                 throw Error(Error::functionNotDefined);
-            (fn.fnPntr)(&stack);
+#ifdef MEXPR_PROFILE
+            callStart = readCycleCounter();
+            callFunction(fn, &stack);
+            profile[i].callCycles += readCycleCounter() - callStart;
+#else
+            callFunction(fn, &stack);
+#endif
+            break;
+        case iSTORE:
+            slots[code[i].operand] = stack.stack[stack.stp - 1];
+            break;
+        case iLOAD:
+            stack.stack[stack.stp] = slots[code[i].operand];
+            stack.stp++;
+            break;
+        case iSEL:
+            stack.stack[stack.stp - 3] = (stack.stack[stack.stp - 3] != 0) ? stack.stack[stack.stp - 2]
+                    : stack.stack[stack.stp - 1];
+            stack.stp -= 2;
+            break;
+        case iRSUB:
+            stack.stack[stack.stp - 2] = stack.stack[stack.stp - 1] - stack.stack[stack.stp - 2];
+            stack.stp--;
+            break;
+        case iRDIV:
+            if (stack.stack[stack.stp - 2] == 0 && !code[i].operand)
+                throw Error(Error::divisionByZero);
+            stack.stack[stack.stp - 2] = stack.stack[stack.stp - 1] / stack.stack[stack.stp - 2];
+            stack.stp--;
+            break;
+        case iRPOW:
+            stack.stack[stack.stp - 2] = pow(stack.stack[stack.stp - 1], stack.stack[stack.stp - 2]);
+            stack.stp--;
+            break;
+        case iPOLY:
+            stack.stack[stack.stp - 1] = ASTPolynomial::evaluatePolynomial(constants
+                    + polynomials[2 * code[i].operand], polynomials[2 * code[i].operand + 1], stack.stack[stack.stp - 1]);
+            break;
+        default: //comparisons and logical operators
+            stack.stack[stack.stp - 2] = compare((InstructionType) code[i].type, stack.stack[stack.stp - 2], stack.stack[stack.stp - 1]);
+            stack.stp--;
             break;
         }
 
+#ifdef MEXPR_PROFILE
+        profile[i].cycles += readCycleCounter() - instrStart;
+        profile[i].count++;
+#endif
     }
+
+#ifdef MEXPR_PROFILE
+    profileTotal.cycles += readCycleCounter() - evalStart;
+    profileTotal.count++;
+#endif
     return stack.stack[0];
 }
 
+void Code::evaluateBatch(Environment* env, Batch* batch, ValueType* results) throw (Error) {
+    evaluateBlocks(env, batch, results, NULL);
+}
+
+void Code::evaluateBatch(Environment* env, Batch* batch, Reduction* reduction) throw (Error) {
+    evaluateBlocks(env, batch, NULL, reduction);
+}
+
+void Code::evaluateBlocks(Environment* env, Batch* batch, ValueType* results, Reduction* reduction) throw (Error) {
+    size_t rows = batch->getRows();
+
+    if (rows == 0)
+        return;
+    if (blockStack == NULL) {
+        blockStack = new ValueType[(stack.size + 1) * BLOCK_SIZE]; //one more for the results of the batch functions
+        batchCode = new Instruction[codeSize];
+        planStack = new BatchPlanElement[stack.size];
+        if (numSlots > 0) {
+            blockSlots = new ValueType[numSlots * BLOCK_SIZE];
+            planSlots = new BatchPlanElement[numSlots];
+        }
+    }
+
+    planBatch(env, batch);
+    size_t block = batchVectorizable ? BLOCK_SIZE : 1;
+    for (size_t first = 0; first < rows; first += block) {
+        size_t n = (rows - first < block) ? rows - first : block;
+        evaluateBlock(env, batch, first, n);
+        if (results != NULL)
+            memcpy(results + first, blockStack, n * sizeof(ValueType));
+        else
+            reduction->add(blockStack, n); //the block is still in the cache
+    }
+}
+
+void Code::planBatch(Environment* env, Batch* batch) throw (Error) {
+    BatchPlanElement* st = planStack;
+    unsigned int sp = 0; //number of elements in the simulated stack
+    size_t n = 0; //instructions in batchCode
+    FunctionType fn;
+    ValueType v, a, b;
+    ValueType argsBuf[16];
+    StackType args;
+    bool invariant;
+
+    batchVectorizable = true;
+    for (int i = 0; i < codeSize; i++) {
+        Instruction in = unpack(code[i]);
+
+        switch (in.type) {
+        case iVAL:
+            st[sp].invariant = true;
+            st[sp].value = in.arg.value;
+            st[sp].start = n;
+            sp++;
+            batchCode[n++] = in;
+            break;
+
+        case iVAR:
+            st[sp].start = n;
+            if (batch->getColumn(in.arg.variable) != NULL) {
+                st[sp].invariant = false;
+                batchCode[n++] = in;
+            } else {
+                if (!batch->getScalar(in.arg.variable, &v)) {
+                    if (!env->isSetVar(in.arg.variable))
+                        throw Error(Error::variableNotDefined);
+                    v = env->getVar(in.arg.variable);
+                }
+                st[sp].invariant = true;
+                st[sp].value = v;
+                batchCode[n].type = iVAL;
+                batchCode[n++].arg.value = v;
+            }
+            sp++;
+            break;
+
+        case iADD:
+        case iMUL:
+        case iSUB:
+        case iDIV:
+        case iPOW:
+        case iLT:
+        case iLE:
+        case iGT:
+        case iGE:
+        case iEQ:
+        case iNE:
+        case iAND:
+        case iOR:
+        case iRSUB:
+        case iRDIV:
+        case iRPOW:
+            sp--;
+            if (st[sp - 1].invariant && st[sp].invariant) {
+                a = st[sp - 1].value;
+                b = st[sp].value;
+                switch (in.type) {
+                case iADD:
+                    v = a + b;
+                    break;
+                case iMUL:
+                    v = a * b;
+                    break;
+                case iSUB:
+                    v = a - b;
+                    break;
+                case iDIV:
+                    if (b == 0 && !in.arg.guarded)
+                        throw Error(Error::divisionByZero);
+                    v = a / b;
+                    break;
+                case iPOW:
+                    v = pow(a, b);
+                    break;
+                case iRSUB:
+                    v = b - a;
+                    break;
+                case iRDIV:
+                    if (a == 0 && !in.arg.guarded)
+                        throw Error(Error::divisionByZero);
+                    v = b / a;
+                    break;
+                case iRPOW:
+                    v = pow(b, a);
+                    break;
+                default:
+                    v = compare(in.type, a, b);
+                    break;
+                }
+                st[sp - 1].value = v;
+                n = st[sp - 1].start; //the operands are replaced by the result
+                batchCode[n].type = iVAL;
+                batchCode[n++].arg.value = v;
+            } else {
+                st[sp - 1].invariant = false;
+                batchCode[n++] = in;
+            }
+            break;
+
+        case iFUN:
+            fn = env->getFunction(*in.arg.funName);
+            if (!isFunctionDefined(fn))
+                throw Error(Error::functionNotDefined);
+            invariant = (fn.attributes & fnPURE) != 0;
+            for (unsigned int k = 0; k < fn.numArgs && invariant; k++)
+                invariant = st[sp - fn.numArgs + k].invariant;
+            sp = sp - fn.numArgs + 1;
+
+            if (invariant) {
+                args.size = fn.numArgs;
+                args.stack = (fn.numArgs <= 16) ? argsBuf : new ValueType[fn.numArgs];
+                for (unsigned int k = 0; k < fn.numArgs; k++)
+                    args.stack[k] = st[sp - 1 + k].value;
+                args.stp = fn.numArgs;
+                callFunction(fn, &args);
+                v = args.stack[args.stp - 1];
+                if (args.stack != argsBuf)
+                    delete[] args.stack;
+
+                st[sp - 1].value = v;
+                n = st[sp - 1].start;
+                batchCode[n].type = iVAL;
+                batchCode[n++].arg.value = v;
+            } else {
+                st[sp - 1].invariant = false;
+                batchCode[n++] = in;
+                if (!(fn.attributes & fnVECTORIZABLE) && fn.fnBatch == NULL)
+                    batchVectorizable = false;
+            }
+            break;
+
+        case iSTORE:
+            /* the invariant values are already in batchCode as values: the loads are replaced by the value too */
+            planSlots[in.arg.slot] = st[sp - 1];
+            if (!st[sp - 1].invariant)
+                batchCode[n++] = in;
+            break;
+
+        case iPOLY:
+            if (st[sp - 1].invariant) {
+                v = ASTPolynomial::evaluatePolynomial(in.arg.polynomial.coefficients, in.arg.polynomial.degree,
+                        st[sp - 1].value);
+                st[sp - 1].value = v;
+                n = st[sp - 1].start;
+                batchCode[n].type = iVAL;
+                batchCode[n++].arg.value = v;
+            } else {
+                batchCode[n++] = in;
+            }
+            break;
+
+        case iSEL:
+            /* the select is computed only if all the operands are invariant: the code of a discarded operand could
+             * store a slot loaded later */
+            sp -= 2;
+            if (st[sp - 1].invariant && st[sp].invariant && st[sp + 1].invariant) {
+                v = (st[sp - 1].value != 0) ? st[sp].value : st[sp + 1].value;
+                st[sp - 1].value = v;
+                n = st[sp - 1].start;
+                batchCode[n].type = iVAL;
+                batchCode[n++].arg.value = v;
+            } else {
+                st[sp - 1].invariant = false;
+                batchCode[n++] = in;
+            }
+            break;
+
+        case iLOAD:
+            st[sp].invariant = planSlots[in.arg.slot].invariant;
+            st[sp].value = planSlots[in.arg.slot].value;
+            st[sp].start = n;
+            sp++;
+            if (st[sp - 1].invariant) {
+                batchCode[n].type = iVAL;
+                batchCode[n++].arg.value = st[sp - 1].value;
+            } else {
+                batchCode[n++] = in;
+            }
+            break;
+        }
+    }
+    batchCodeSize = n;
+}
+
+void Code::evaluateBlock(Environment* env, Batch* batch, size_t first, size_t n) throw (Error) {
+    FunctionType fn;
+    unsigned int sp = 0; //number of elements in the stack
+    ValueType* a; //first operand (and result) of the current instruction
+    ValueType* b; //second operand
+    ValueType* c; //condition of the select
+    ValueType v;
+    size_t stride;
+    ValueType argsBuf[16];
+    StackType args;
+
+    for (size_t i = 0; i < batchCodeSize; i++) {
+        Instruction& in = batchCode[i];
+
+        switch (in.type) {
+        case iVAL:
+            a = blockStack + sp * BLOCK_SIZE;
+            v = in.arg.value;
+            for (size_t j = 0; j < n; j++)
+                a[j] = v;
+            sp++;
+            break;
+        case iVAR: //only the columns, the other variables are values in batchCode
+            a = blockStack + sp * BLOCK_SIZE;
+            stride = batch->getStride(in.arg.variable);
+            if (stride == sizeof(ValueType)) {
+                memcpy(a, batch->getColumn(in.arg.variable) + first, n * sizeof(ValueType));
+            } else { //gathered from the rows (e.g. a field of an array of structs)
+                const char* row = (const char*) batch->getColumn(in.arg.variable) + first * stride;
+                for (size_t j = 0; j < n; j++, row += stride)
+                    a[j] = *(const ValueType*) row;
+            }
+            sp++;
+            break;
+        case iADD:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n; j++)
+                a[j] = a[j] + b[j];
+            sp--;
+            break;
+        case iMUL:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n; j++)
+                a[j] = a[j] * b[j];
+            sp--;
+            break;
+        case iSUB:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n; j++)
+                a[j] = a[j] - b[j];
+            sp--;
+            break;
+        case iDIV:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n && !in.arg.guarded; j++)
+                if (b[j] == 0)
+                    throw Error(Error::divisionByZero);
+            for (size_t j = 0; j < n; j++)
+                a[j] = a[j] / b[j];
+            sp--;
+            break;
+        case iPOW:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n; j++)
+                a[j] = pow(a[j], b[j]);
+            sp--;
+            break;
+        case iFUN:
+            fn = env->getFunction(*in.arg.funName);
+            if (!isFunctionDefined(fn))
+                throw Error(Error::functionNotDefined);
+            a = blockStack + (sp - fn.numArgs) * BLOCK_SIZE;
+            if (fn.fnBatch != NULL) { //one call for the block, the result is written after the arguments
+                const ValueType* argsvBuf[16];
+                const ValueType** argsv = (fn.numArgs <= 16) ? argsvBuf : new const ValueType*[fn.numArgs];
+                for (unsigned int k = 0; k < fn.numArgs; k++)
+                    argsv[k] = a + k * BLOCK_SIZE;
+                (fn.fnBatch)(argsv, blockStack + sp * BLOCK_SIZE, n);
+                if (argsv != argsvBuf)
+                    delete[] argsv;
+                memcpy(a, blockStack + sp * BLOCK_SIZE, n * sizeof(ValueType));
+                sp = sp - fn.numArgs + 1;
+                break;
+            }
+            if (fn.fn1 != NULL) { //typed functions: called directly on the rows
+                for (size_t j = 0; j < n; j++)
+                    a[j] = fn.fn1(a[j]);
+                break;
+            }
+            if (fn.fn2 != NULL) {
+                b = a + BLOCK_SIZE;
+                for (size_t j = 0; j < n; j++)
+                    a[j] = fn.fn2(a[j], b[j]);
+                sp--;
+                break;
+            }
+            /* the other functions work on a stack: they are called row by row on a stack with only the arguments */
+            args.size = fn.numArgs;
+            args.stack = (fn.numArgs <= 16) ? argsBuf : new ValueType[fn.numArgs];
+            for (size_t j = 0; j < n; j++) {
+                for (unsigned int k = 0; k < fn.numArgs; k++)
+                    args.stack[k] = a[k * BLOCK_SIZE + j];
+                args.stp = fn.numArgs;
+                callFunction(fn, &args);
+                a[j] = args.stack[0];
+            }
+            if (args.stack != argsBuf)
+                delete[] args.stack;
+            sp = sp - fn.numArgs + 1;
+            break;
+        case iSTORE:
+            memcpy(blockSlots + in.arg.slot * BLOCK_SIZE, blockStack + (sp - 1) * BLOCK_SIZE, n * sizeof(ValueType));
+            break;
+        case iLOAD:
+            memcpy(blockStack + sp * BLOCK_SIZE, blockSlots + in.arg.slot * BLOCK_SIZE, n * sizeof(ValueType));
+            sp++;
+            break;
+        case iLT:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n; j++)
+                a[j] = (a[j] < b[j]) ? 1 : 0;
+            sp--;
+            break;
+        case iLE:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n; j++)
+                a[j] = (a[j] <= b[j]) ? 1 : 0;
+            sp--;
+            break;
+        case iGT:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n; j++)
+                a[j] = (a[j] > b[j]) ? 1 : 0;
+            sp--;
+            break;
+        case iGE:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n; j++)
+                a[j] = (a[j] >= b[j]) ? 1 : 0;
+            sp--;
+            break;
+        case iEQ:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n; j++)
+                a[j] = (a[j] == b[j]) ? 1 : 0;
+            sp--;
+            break;
+        case iNE:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n; j++)
+                a[j] = (a[j] != b[j]) ? 1 : 0;
+            sp--;
+            break;
+        case iAND:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n; j++)
+                a[j] = ((a[j] != 0) & (b[j] != 0)) ? 1 : 0;
+            sp--;
+            break;
+        case iOR:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n; j++)
+                a[j] = ((a[j] != 0) | (b[j] != 0)) ? 1 : 0;
+            sp--;
+            break;
+        case iSEL: //a blend of the two operands, both computed for all the rows
+            c = blockStack + (sp - 3) * BLOCK_SIZE;
+            a = c + BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n; j++) { //the operands are read before the select, so the loop is vectorized
+                ValueType x = a[j], y = b[j];
+                c[j] = (c[j] != 0) ? x : y;
+            }
+            sp -= 2;
+            break;
+        case iRSUB:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n; j++)
+                a[j] = b[j] - a[j];
+            sp--;
+            break;
+        case iRDIV:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n && !in.arg.guarded; j++)
+                if (a[j] == 0)
+                    throw Error(Error::divisionByZero);
+            for (size_t j = 0; j < n; j++)
+                a[j] = b[j] / a[j];
+            sp--;
+            break;
+        case iRPOW:
+            a = blockStack + (sp - 2) * BLOCK_SIZE;
+            b = a + BLOCK_SIZE;
+            for (size_t j = 0; j < n; j++)
+                a[j] = pow(b[j], a[j]);
+            sp--;
+            break;
+        case iPOLY:
+            a = blockStack + (sp - 1) * BLOCK_SIZE;
+            if (in.arg.polynomial.degree < ASTPolynomial::ESTRIN_MIN_DEGREE) {
+                /* the Horner's scheme a coefficient at a time, the rows are computed at the same time */
+                b = blockStack + sp * BLOCK_SIZE;
+                v = in.arg.polynomial.coefficients[in.arg.polynomial.degree];
+                for (size_t j = 0; j < n; j++)
+                    b[j] = v;
+                for (unsigned int k = in.arg.polynomial.degree; k > 0; k--) {
+                    v = in.arg.polynomial.coefficients[k - 1];
+                    for (size_t j = 0; j < n; j++)
+                        b[j] = b[j] * a[j] + v;
+                }
+                memcpy(a, b, n * sizeof(ValueType));
+            } else {
+                for (size_t j = 0; j < n; j++)
+                    a[j] = ASTPolynomial::evaluatePolynomial(in.arg.polynomial.coefficients,
+                            in.arg.polynomial.degree, a[j]);
+            }
+            break;
+        }
+    }
+}
+
+void Code::resetProfile() {
+    if (profile == NULL)
+        return;
+    memset(profile, 0, codeSize * sizeof(ProfileCounterType));
+    memset(&profileTotal, 0, sizeof(ProfileCounterType));
+}
+
+ProfileType* Code::getProfile() {
+    if (profile == NULL)
+        return NULL;
+
+    ProfileType* ris = new ProfileType;
+    ris->evaluations = profileTotal.count;
+    ris->totalCycles = profileTotal.cycles;
+    for (size_t i = 0; i < codeSize; i++) {
+        ProfileEntryType e;
+        e.index = i;
+        e.instruction = unpack(code[i]);
+        e.counter = profile[i];
+        ris->entries.push_back(e);
+    }
+    return ris;
+}
+
+string* Code::getProfileString() {
+    if (profile == NULL)
+        return NULL;
+
+    stringstream s(stringstream::in | stringstream::out);
+    unsigned long long instrCycles = 0, callCycles = 0;
+    unsigned long long opCycles[iPOLY + 1];
+    double total = (profileTotal.cycles > 0) ? (double) profileTotal.cycles : 1;
+
+    memset(opCycles, 0, sizeof(opCycles));
+    s << fixed << setprecision(1);
+    s << "    count        cycles  cycles/exec  cycles%  instruction" << endl;
+    for (size_t i = 0; i < codeSize; i++) {
+        ProfileCounterType& c = profile[i];
+        instrCycles += c.cycles;
+        callCycles += c.callCycles;
+        opCycles[code[i].type] += c.cycles;
+
+        s << setw(9) << c.count << setw(14) << c.cycles;
+        s << setw(13) << ((c.count > 0) ? (double) c.cycles / c.count : 0);
+        s << setw(8) << 100.0 * c.cycles / total << "%  ";
+        stringstream instr(stringstream::in | stringstream::out);
+        writeInstruction(&instr, unpack(code[i])); /* with the default number format */
+        s << instr.str();
+        if (code[i].type == iFUN)
+            s << "  (inside function: " << 100.0 * c.callCycles / total << "%)";
+        s << endl;
+    }
+
+    s << endl << "evaluations: " << profileTotal.count << ", cycles: " << profileTotal.cycles;
+    if (profileTotal.count > 0)
+        s << ", cycles/evaluation: " << (double) profileTotal.cycles / profileTotal.count;
+    s << endl;
+
+    const char* names[] = { "VAL", "VAR", "ADD", "MUL", "SUB", "DIV", "POW", "FUN", "STORE", "LOAD", "LT", "LE", "GT",
+            "GE", "EQ", "NE", "AND", "OR", "SEL", "RSUB", "RDIV", "RPOW", "POLY" };
+    for (int t = 0; t <= iPOLY; t++) {
+        if (opCycles[t] == 0)
+            continue;
+        s << setw(8) << 100.0 * opCycles[t] / total << "%  " << names[t] << endl;
+    }
+    s << setw(8) << 100.0 * callCycles / total << "%  inside functions" << endl;
+    s << setw(8) << 100.0 * (profileTotal.cycles - instrCycles) / total << "%  evaluation loop (dispatch and profiling)"
+            << endl;
+
+    return new string(s.str());
+}
+
 Code::~Code() {
-    delete code;
-    delete stack.stack;
+    if (__atomic_sub_fetch(codeRefs, 1, __ATOMIC_ACQ_REL) == 0) {
+        delete[] code;
+        delete[] constants;
+        delete[] functions;
+        delete[] polynomials;
+        delete codeRefs;
+    }
+    delete[] stack.stack;
+    delete[] profile;
+    delete[] blockStack;
+    delete[] batchCode;
+    delete[] planStack;
+    delete[] slots;
+    delete[] blockSlots;
+    delete[] planSlots;
 }
@@ -0,0 +1,385 @@
+/*
+ * Mathematical Expressions - Delimited files evaluation
+ * Implementation
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <MExprCsv.h>
+#include <MExprBatch.h>
+#include <MExprNumber.h>
+using namespace std;
+using namespace MExpr;
+
+/** buffered output, it throws Error::fileError if the file can't be written */
+class CsvOutput {
+    FILE* f;
+    char buf[1 << 16];
+    size_t n;
+
+public:
+    CsvOutput(FILE* f) {
+        this->f = f;
+        n = 0;
+    }
+
+    void write(const char* s, size_t len) throw (Error) {
+        if (n + len > sizeof(buf)) {
+            flush();
+            if (len > sizeof(buf)) {
+                if (fwrite(s, 1, len, f) != len)
+                    throw Error(Error::fileError);
+                return;
+            }
+        }
+        memcpy(buf + n, s, len);
+        n += len;
+    }
+
+    void put(char c) throw (Error) {
+        if (n == sizeof(buf))
+            flush();
+        buf[n++] = c;
+    }
+
+    void flush() throw (Error) {
+        if (n > 0 && fwrite(buf, 1, n, f) != n)
+            throw Error(Error::fileError);
+        n = 0;
+    }
+};
+
+/** finds the end of the field that starts at p: the delimiter, the end of the line or the end of the data */
+static const char* fieldEnd(const char* p, const char* end, char delimiter) {
+    if (p < end && *p == '"') { //quoted field, "" is an escaped quote
+        for (p++; p < end; p++) {
+            if (*p == '"') {
+                if (p + 1 < end && p[1] == '"')
+                    p++;
+                else
+                    break;
+            }
+        }
+    }
+    while (p < end && *p != delimiter && *p != '\n')
+        p++;
+    return p;
+}
+
+/** removes the spaces, the quotes and the carriage return around a field */
+static void trimField(const char** b, const char** e) {
+    while (*e > *b && ((*e)[-1] == ' ' || (*e)[-1] == '\t' || (*e)[-1] == '\r'))
+        (*e)--;
+    while (*b < *e && (**b == ' ' || **b == '\t'))
+        (*b)++;
+    if (*e - *b >= 2 && **b == '"' && (*e)[-1] == '"') {
+        (*b)++;
+        (*e)--;
+    }
+}
+
+/** writes a result in buf (at least 32 chars), it returns the length */
+static int formatNumber(char* buf, ValueType v, int precision) {
+    /* integers are common and snprintf is much slower than the parsing of the input */
+    if (v > -1e15 && v < 1e15 && v == (ValueType) (long long) v && (v != 0 || 1 / v > 0)) {
+        long long i = (long long) v;
+        unsigned long long u = (i < 0) ? -i : i;
+        char tmp[24];
+        int n = 0;
+        do {
+            tmp[n++] = (char) ('0' + u % 10);
+            u /= 10;
+        } while (u > 0);
+        if (n <= precision) { //otherwise %g uses the exponent
+            int len = 0;
+            if (i < 0)
+                buf[len++] = '-';
+            while (n > 0)
+                buf[len++] = tmp[--n];
+            return len;
+        }
+    }
+    int len = snprintf(buf, 32, "%.*g", precision, v);
+    return (len < 32) ? len : 31; //snprintf returns the length it would have written
+}
+
+CsvEvaluator::CsvEvaluator(Expression* expr) {
+    this->expr = expr;
+    delimiter = ',';
+    header = true;
+    append = false;
+    precision = 17;
+    resultName = "result";
+    line = 0;
+}
+
+void CsvEvaluator::setDelimiter(char delimiter) {
+    this->delimiter = delimiter;
+}
+
+void CsvEvaluator::setHeader(bool header) {
+    this->header = header;
+}
+
+void CsvEvaluator::setAppend(bool append) {
+    this->append = append;
+}
+
+void CsvEvaluator::setPrecision(int precision) {
+    if (precision < 1)
+        precision = 1;
+    else if (precision > MAX_PRECISION)
+        precision = MAX_PRECISION;
+    this->precision = precision;
+}
+
+void CsvEvaluator::setResultName(const string& name) {
+    resultName = name;
+}
+
+void CsvEvaluator::bindColumn(char var, const string& name) throw (Error) {
+    //check if not is [a-zA-Z]
+    if (var < 'A' || var > 'z' || ('Z' < var && var < 'a'))
+        throw Error(Error::illegalVariableName);
+    indexedColumns.erase(var);
+    namedColumns[var] = name;
+}
+
+void CsvEvaluator::bindColumn(char var, size_t index) throw (Error) {
+    //check if not is [a-zA-Z]
+    if (var < 'A' || var > 'z' || ('Z' < var && var < 'a'))
+        throw Error(Error::illegalVariableName);
+    namedColumns.erase(var);
+    indexedColumns[var] = index;
+}
+
+size_t CsvEvaluator::getLine() {
+    return line;
+}
+
+size_t CsvEvaluator::evaluate(const char* data, size_t size, FILE* out) throw (Error) {
+    const char* p = data;
+    const char* end = data + size;
+    map<char, size_t> bound(indexedColumns);
+    CsvOutput o(out);
+    char num[32];
+
+    line = 0;
+
+    /* header: names of the columns */
+    if (header && p < end) {
+        vector<string> names;
+        const char* ls = p;
+        line++;
+        while (true) {
+            const char* b = p;
+            const char* e = fieldEnd(p, end, delimiter);
+            p = e;
+            trimField(&b, &e);
+            names.push_back(string(b, e - b));
+            if (p < end && *p == delimiter) {
+                p++;
+                continue;
+            }
+            break;
+        }
+        const char* le = p;
+        if (p < end)
+            p++; //'\n'
+        if (le > ls && le[-1] == '\r')
+            le--;
+
+        for (map<char, string>::iterator it = namedColumns.begin(); it != namedColumns.end(); it++) {
+            size_t i = 0;
+            while (i < names.size() && names[i] != it->second)
+                i++;
+            if (i == names.size())
+                throw Error(Error::columnNotDefined);
+            bound[it->first] = i;
+        }
+        for (size_t i = 0; i < names.size(); i++) {
+            char v = (names[i].length() == 1) ? names[i][0] : 0;
+            if (((v >= 'a' && v <= 'z') || (v >= 'A' && v <= 'Z')) && bound.find(v) == bound.end())
+                bound[v] = i;
+        }
+
+        if (append) {
+            o.write(ls, le - ls);
+            o.put(delimiter);
+        }
+        o.write(resultName.c_str(), resultName.length());
+        o.put('\n');
+    } else if (!namedColumns.empty()) {
+        throw Error(Error::columnNotDefined);
+    }
+
+    /* the values of a column are parsed in a slot, the variables bound to the same column share the slot */
+    size_t maxCol = 0;
+    for (map<char, size_t>::iterator it = bound.begin(); it != bound.end(); it++)
+        if (it->second > maxCol)
+            maxCol = it->second;
+    vector<int> slotOfCol(maxCol + 1, -1);
+    int slots = 0;
+    for (map<char, size_t>::iterator it = bound.begin(); it != bound.end(); it++)
+        if (slotOfCol[it->second] < 0)
+            slotOfCol[it->second] = slots++;
+
+    vector<ValueType> values(slots * BLOCK_ROWS + 1);
+    vector<ValueType> results(BLOCK_ROWS);
+    vector<const char*> rowStart(append ? BLOCK_ROWS : 0);
+    vector<const char*> rowEnd(append ? BLOCK_ROWS : 0);
+    Batch batch(BLOCK_ROWS);
+    for (map<char, size_t>::iterator it = bound.begin(); it != bound.end(); it++)
+        batch.setColumn(it->first, &values[slotOfCol[it->second] * BLOCK_ROWS]);
+
+    size_t rows = 0;
+    size_t k = 0; //rows in the current block
+    while (p < end || k > 0) {
+        if (p < end) {
+            const char* ls = p;
+            line++;
+
+            if (*p == '\n' || (*p == '\r' && (p + 1 == end || p[1] == '\n'))) { //empty line
+                p += (*p == '\r' && p + 1 < end) ? 2 : 1;
+                continue;
+            }
+
+            if (slots > 0) {
+                size_t col = 0;
+                while (true) {
+                    const char* b = p;
+                    const char* e = fieldEnd(p, end, delimiter);
+                    p = e;
+                    if (slotOfCol[col] >= 0) {
+                        trimField(&b, &e);
+                        if (!parseNumber(b, e, &values[slotOfCol[col] * BLOCK_ROWS + k]))
+                            throw Error(Error::numberFormatError);
+                    }
+                    col++;
+                    if (col <= maxCol && p < end && *p == delimiter) {
+                        p++;
+                        continue;
+                    }
+                    break;
+                }
+                if (col <= maxCol) //missing fields
+                    throw Error(Error::numberFormatError);
+            }
+
+            const char* le = (const char*) memchr(p, '\n', end - p);
+            if (le == NULL)
+                le = end;
+            p = (le < end) ? le + 1 : end;
+            if (append) {
+                if (le > ls && le[-1] == '\r')
+                    le--;
+                rowStart[k] = ls;
+                rowEnd[k] = le;
+            }
+            k++;
+            if (k < BLOCK_ROWS && p < end)
+                continue;
+        }
+
+        /* evaluation and output of a block */
+        batch.setRows(k);
+        expr->evaluateBatch(&batch, &results[0]);
+        for (size_t r = 0; r < k; r++) {
+            if (append) {
+                o.write(rowStart[r], rowEnd[r] - rowStart[r]);
+                o.put(delimiter);
+            }
+            int len = formatNumber(num, results[r], precision);
+            o.write(num, len);
+            o.put('\n');
+        }
+        rows += k;
+        k = 0;
+    }
+
+    o.flush();
+    return rows;
+}
+
+size_t CsvEvaluator::evaluateFile(const string& inPath, const string& outPath) throw (Error) {
+    int fd = open(inPath.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw Error(Error::fileError);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw Error(Error::fileError);
+    }
+
+    size_t size = (size_t) st.st_size;
+    const char* data = NULL;
+    if (size > 0) {
+        void* m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) {
+            close(fd);
+            throw Error(Error::fileError);
+        }
+        madvise(m, size, MADV_SEQUENTIAL);
+        data = (const char*) m;
+    }
+    close(fd); //the mapping stays valid
+
+    FILE* out = (outPath == "-") ? stdout : fopen(outPath.c_str(), "w");
+    if (out == NULL) {
+        if (data != NULL)
+            munmap((void*) data, size);
+        throw Error(Error::fileError);
+    }
+
+    size_t rows;
+    try {
+        rows = evaluate(data, size, out);
+    } catch (Error& ex) {
+        if (out != stdout)
+            fclose(out);
+        if (data != NULL)
+            munmap((void*) data, size);
+        throw; // re-throw
+    }
+
+    if (data != NULL)
+        munmap((void*) data, size);
+    if (out == stdout) {
+        if (fflush(out) != 0)
+            throw Error(Error::fileError);
+    } else if (fclose(out) != 0) {
+        throw Error(Error::fileError);
+    }
+    return rows;
+}
@@ -25,62 +25,280 @@
  *
  */
 
+#include <string.h>
 #include <map>
-#include <sstream>
 #include <MExprEnvironment.h>
+#include <MExprStdFunc.h>
 using namespace MExpr;
 using namespace std;
 
+const unsigned long long Environment::FUNCTIONS_BIT;
+const unsigned long long Environment::IMPURE_BIT;
+
 Environment::~Environment() {
-    variables->clear();
-    functions->clear();
-    delete variables;
+    delete vars;
     delete functions;
 }
 
+Environment::Environment(const Environment& env) {
+    vars = (env.vars != NULL) ? new Variables(*env.vars) : NULL;
+    definedMask = env.definedMask;
+    boundMask = env.boundMask;
+    functions = (env.functions != NULL) ? new map<string, FunctionType>(*env.functions) : NULL;
+    stdFunctions = env.stdFunctions;
+    mathAccuracy = env.mathAccuracy;
+    fastMath = env.fastMath;
+    version = env.version;
+    functionsVersion = env.functionsVersion;
+    markVersion = env.markVersion;
+    markMask = env.markMask;
+}
+
 Environment::Environment() {
-    variables = new map<char, ValueType>;
-    functions = new map<string, FunctionType>;
+    vars = NULL;
+    definedMask = 0;
+    boundMask = 0;
+    functions = NULL;
+    stdFunctions = false;
+    mathAccuracy = mathACCURATE;
+    fastMath = false;
+    version = 0;
+    functionsVersion = 0;
+    markVersion = 0;
+    markMask = 0;
+}
+
+Environment::Variables* Environment::getVariables() {
+    if (vars == NULL) {
+        vars = new Variables;
+        memset(vars, 0, sizeof(Variables));
+    }
+    return vars;
 }
 
 ValueType Environment::getVar(char var) {
-    return (*variables)[var];
+    int i = getVarIndex(var);
+    if (i < 0)
+        return 0;
+    definedMask |= 1ULL << i;
+    if (vars == NULL) //created with the 0 value
+        return 0;
+    if (vars->pointers[i] != NULL)
+        return *vars->pointers[i];
+    return vars->values[i];
 }
 
 void Environment::setVar(char var, ValueType val) throw (Error) {
-    //check if not is [a-zA-Z]
-    if (var < 'A' || var > 'z' || ('Z' < var && var < 'a'))
+    int i = getVarIndex(var);
+    if (i < 0)
         throw Error(Error::illegalVariableName);
 
-    (*variables)[var] = val;
+    Variables* v = getVariables();
+    unsigned long long bit = 1ULL << i;
+    if (v->pointers[i] != NULL) {
+        v->pointers[i] = NULL;
+        boundMask &= ~bit;
+    } else if (definedMask & bit) {
+        if (memcmp(&v->values[i], &val, sizeof(ValueType)) == 0)
+            return; //same value, the version doesn't change
+    } else {
+        definedMask |= bit;
+    }
+    v->values[i] = val;
+    v->versions[i] = ++version;
+    markMask |= bit;
 }
 
 bool Environment::isSetVar(char var) {
-    return variables->find(var) != variables->end();
+    return (definedMask & getVarBit(var)) != 0;
 }
 
-FunctionType Environment::getFunction(string funcName) {
-    map<string, FunctionType>::iterator it;
-    if ((it = functions->find(funcName)) != functions->end()) {
-        return it->second;
-    } else {
-        return (FunctionType ) { NULL, 0 } ;
-            }
-        }
-
-        void Environment::setFunction(string funcName, FunctionPntrType funcPntr, unsigned int numArgs) throw (Error) {
-            //check function name
-            if (funcName[0] != '_')
-                throw Error(Error::illegalFunctionName);
-
-            FunctionType str;
-            str.fnPntr = funcPntr;
-            str.numArgs = numArgs;
-            ostringstream ss;
-            ss << funcName << "_" << numArgs;
-            (*functions)[ss.str()] = str; //save the function name with the number of parameters
-        }
-
-        bool Environment::isSetFunction(string funcName) {
-            return functions->find(funcName) != functions->end();
-        }
+void Environment::bindVar(char var, const ValueType* pointer) throw (Error) {
+    int i = getVarIndex(var);
+    if (i < 0)
+        throw Error(Error::illegalVariableName);
+
+    if (pointer == NULL) {
+        unbindVar(var);
+        return;
+    }
+    Variables* v = getVariables();
+    unsigned long long bit = 1ULL << i;
+    v->pointers[i] = pointer;
+    definedMask |= bit;
+    boundMask |= bit;
+    v->versions[i] = ++version;
+    markMask |= bit;
+}
+
+void Environment::unbindVar(char var) throw (Error) {
+    int i = getVarIndex(var);
+    if (i < 0)
+        throw Error(Error::illegalVariableName);
+
+    if (vars == NULL || vars->pointers[i] == NULL)
+        return;
+    unsigned long long bit = 1ULL << i;
+    vars->values[i] = *vars->pointers[i];
+    vars->pointers[i] = NULL;
+    boundMask &= ~bit;
+    vars->versions[i] = ++version;
+    markMask |= bit;
+}
+
+bool Environment::isBoundVar(char var) {
+    return (boundMask & getVarBit(var)) != 0;
+}
+
+FunctionType Environment::getFunction(const string& funcName) {
+    if (functions != NULL) {
+        map<string, FunctionType>::iterator it = functions->find(funcName);
+        if (it != functions->end())
+            return it->second;
+    }
+    if (stdFunctions) {
+        const FunctionType* fn = StdFunc::getFunction(funcName, mathAccuracy);
+        if (fn != NULL)
+            return *fn;
+    }
+    FunctionType none = { NULL, NULL, NULL, NULL, NULL, 0, 0, 0 };
+    return none;
+}
+
+void Environment::setFunction(const string& funcName, FunctionPntrType funcPntr, unsigned int numArgs,
+        unsigned int attributes, unsigned int cost) throw (Error) {
+    FunctionType str = { funcPntr, NULL, NULL, NULL, NULL, numArgs, attributes, cost };
+    addFunction(funcName, str);
+}
+
+void Environment::setFunction(const string& funcName, UnaryFunctionPntrType funcPntr, unsigned int attributes,
+        unsigned int cost) throw (Error) {
+    FunctionType str = { NULL, funcPntr, NULL, NULL, NULL, 1, attributes, cost };
+    addFunction(funcName, str);
+}
+
+void Environment::setFunction(const string& funcName, BinaryFunctionPntrType funcPntr, unsigned int attributes,
+        unsigned int cost) throw (Error) {
+    FunctionType str = { NULL, NULL, funcPntr, NULL, NULL, 2, attributes, cost };
+    addFunction(funcName, str);
+}
+
+void Environment::setFunction(const string& funcName, NaryFunctionPntrType funcPntr, unsigned int numArgs,
+        unsigned int attributes, unsigned int cost) throw (Error) {
+    FunctionType str = { NULL, NULL, NULL, funcPntr, NULL, numArgs, attributes, cost };
+    addFunction(funcName, str);
+}
+
+void Environment::setBatchFunction(const string& funcName, unsigned int numArgs, BatchFunctionPntrType funcPntr)
+        throw (Error) {
+    string name = getMangledName(funcName, numArgs);
+    FunctionType fn = getFunction(name); //it could be a standard function: it is copied in the user functions
+    if (!isFunctionDefined(fn))
+        throw Error(Error::functionNotDefined);
+
+    fn.fnBatch = funcPntr;
+    fn.attributes |= fnVECTORIZABLE;
+    if (functions == NULL)
+        functions = new map<string, FunctionType>;
+    (*functions)[name] = fn;
+    functionsVersion = ++version;
+    markMask |= FUNCTIONS_BIT;
+}
+
+void Environment::addFunction(const string& funcName, FunctionType fn) throw (Error) {
+    //check function name
+    if (funcName[0] != '_')
+        throw Error(Error::illegalFunctionName);
+
+    if (fn.attributes & fnCONST)
+        fn.attributes |= fnPURE;
+    if (functions == NULL)
+        functions = new map<string, FunctionType>;
+    (*functions)[getMangledName(funcName, fn.numArgs)] = fn; //save the function name with the number of parameters
+    functionsVersion = ++version;
+    markMask |= FUNCTIONS_BIT;
+}
+
+bool Environment::isSetFunction(const string& funcName) {
+    return isFunctionDefined(getFunction(funcName));
+}
+
+void Environment::setStdFunctions(bool enabled) {
+    if (stdFunctions == enabled)
+        return;
+    stdFunctions = enabled;
+    functionsVersion = ++version;
+    markMask |= FUNCTIONS_BIT;
+}
+
+bool Environment::hasStdFunctions() {
+    return stdFunctions;
+}
+
+void Environment::setMathAccuracy(MathAccuracy accuracy) {
+    if (mathAccuracy == accuracy)
+        return;
+    mathAccuracy = accuracy;
+    functionsVersion = ++version;
+    markMask |= FUNCTIONS_BIT;
+}
+
+MathAccuracy Environment::getMathAccuracy() {
+    return mathAccuracy;
+}
+
+void Environment::setFastMath(bool enabled) {
+    if (fastMath == enabled)
+        return;
+    fastMath = enabled;
+    functionsVersion = ++version; //the optimized expressions are optimized again
+    markMask |= FUNCTIONS_BIT;
+}
+
+bool Environment::isFastMath() {
+    return fastMath;
+}
+
+string Environment::getMangledName(const string& funcName, unsigned int numArgs) {
+    char digits[16];
+    int d = sizeof(digits);
+    do {
+        digits[--d] = '0' + numArgs % 10;
+        numArgs /= 10;
+    } while (numArgs > 0);
+
+    string mangled;
+    mangled.reserve(funcName.size() + 1 + sizeof(digits) - d);
+    mangled += funcName;
+    mangled += '_';
+    mangled.append(digits + d, sizeof(digits) - d);
+    return mangled;
+}
+
+unsigned long long Environment::getVersion() {
+    return version;
+}
+
+unsigned long long Environment::getChangedMask(unsigned long long sinceVersion) {
+    unsigned long long mask = 0;
+    if (sinceVersion >= version)
+        return boundMask; //the bound variables could be changed in their memory
+    if (sinceVersion == markVersion)
+        mask = markMask;
+    else
+        mask = scanChangedMask(sinceVersion);
+    markVersion = version;
+    markMask = 0;
+    return mask | boundMask;
+}
+
+unsigned long long Environment::scanChangedMask(unsigned long long sinceVersion) {
+    unsigned long long mask = 0;
+    if (vars != NULL)
+        for (int i = 0; i < NUM_VARS; i++)
+            if (vars->versions[i] > sinceVersion)
+                mask |= 1ULL << i;
+    if (functionsVersion > sinceVersion)
+        mask |= FUNCTIONS_BIT;
+    return mask;
+}
@@ -59,6 +59,14 @@ const char* Error::what() {
         return "wrong number of arguments to call this function";
     case Error::functionNotDefined:
         return "function not defined";
+    case Error::fileError:
+        return "can't read or write the file";
+    case Error::numberFormatError:
+        return "illegal or missing number";
+    case Error::columnNotDefined:
+        return "column not defined";
+    case Error::codeTooLarge:
+        return "the expression is too large to be compiled";
     default:
         return "undefined error";
     }
@@ -28,22 +28,81 @@
 #include <MExprExpression.h>
 #include <MExprInstruction.h>
 #include <MExprStdFunc.h>
+#include <MExprOptimizer.h>
 #include <iostream>
 using namespace std;
 using namespace MExpr;
 
 Expression::~Expression() {
+    if (latency != NULL) {
+        Telemetry::unregisterExpression(latency);
+        delete[] latency;
+    }
     delete expr;
-    ast->deleteTree();
     if (code != NULL)
         delete code;
+    releaseAST();
     delete env;
 }
 
+Expression::Expression() {
+}
+
+Expression* Expression::clone() {
+    Expression* e = new Expression();
+    e->expr = new string(*expr);
+    e->ast = ast;
+    e->astRefs = astRefs;
+    __atomic_add_fetch(astRefs, 1, __ATOMIC_RELAXED);
+    e->optimizedAST = optimizedAST;
+    e->optimizedVersion = optimizedVersion;
+    e->code = (code != NULL) ? code->clone() : NULL;
+    e->env = new Environment(*env);
+    e->latency = NULL;
+#ifdef MEXPR_TELEMETRY
+    if (latency != NULL) {
+        e->latency = new Histogram[Telemetry::STAGES];
+        Telemetry::registerExpression(e->expr, e->latency);
+    }
+#endif
+    e->incremental = false;
+    e->incrementalVersion = 0;
+    e->compileAfter = compileAfter;
+    e->optimizeAfter = optimizeAfter;
+    e->promoteIn = promoteIn;
+    if (incremental)
+        e->setIncrementalEvaluation(true);
+    return e;
+}
+
+void Expression::releaseAST() {
+    if (__atomic_sub_fetch(astRefs, 1, __ATOMIC_ACQ_REL) == 0) {
+        ast->deleteTree();
+        delete astRefs;
+    }
+}
+
+void Expression::detachAST() {
+    if (__atomic_load_n(astRefs, __ATOMIC_ACQUIRE) == 1)
+        return;
+
+    ASTNode* copy = Optimizer::replaceSubtrees(ast, map<ASTNode*, char>()); //nothing replaced: a copy
+    releaseAST(); //the code doesn't refer to the tree, it is kept
+    ast = copy;
+    astRefs = new unsigned int(1);
+}
+
 Expression::Expression(const string& expr, Environment* env) throw (Error) {
     this->expr = new string(expr);
     optimizedAST = false;
+    optimizedVersion = 0;
     code = NULL;
+    latency = NULL;
+    incremental = false;
+    incrementalVersion = 0;
+    compileAfter = DEFAULT_COMPILE_AFTER;
+    optimizeAfter = DEFAULT_OPTIMIZE_AFTER;
+    promoteIn = compileAfter;
 
     if (env == NULL) {
         this->env = new Environment();
@@ -53,9 +112,23 @@ Expression::Expression(const string& expr, Environment* env) throw (Error) {
     }
 
     try {
+#ifdef MEXPR_TELEMETRY
+        if (Telemetry::isEnabled()) {
+            latency = new Histogram[Telemetry::STAGES];
+            unsigned long long start = readCycleCounter();
+            ast = MExpr_ParseExpression(this->expr);
+            Telemetry::record(Telemetry::PARSE, readCycleCounter() - start, latency);
+            Telemetry::registerExpression(this->expr, latency);
+        } else {
+            ast = MExpr_ParseExpression(this->expr);
+        }
+#else
         ast = MExpr_ParseExpression(this->expr);
+#endif
+        astRefs = new unsigned int(1);
     } catch (Error ex) {
         //before, we deallocate the expr and env.
+        delete[] latency;
         delete this->env;
         delete this->expr;
 
@@ -73,12 +146,72 @@ string* Expression::getExprCodeString() {
     return code->getCodeString();
 }
 
+string* Expression::getExprProfileString() {
+    if (code == NULL)
+        return NULL;
+    return code->getProfileString();
+}
+
+ProfileType* Expression::getExprProfile() {
+    if (code == NULL)
+        return NULL;
+    return code->getProfile();
+}
+
+Histogram* Expression::getExprLatency(Telemetry::Stage stage) {
+#ifdef MEXPR_TELEMETRY
+    Histogram* h = new Histogram;
+    if (latency != NULL)
+        h->merge(latency[stage]);
+    return h;
+#else
+    return NULL;
+#endif
+}
+
 void Expression::setVariable(char var, ValueType val) throw (Error) {
     env->setVar(var, val);
 }
 
-void Expression::setFunction(std::string funcName, FunctionPntrType funcPntr, unsigned int numArgs) throw (Error) {
-    env->setFunction(funcName, funcPntr, numArgs);
+void Expression::bindVariable(char var, const ValueType* pointer) throw (Error) {
+    env->bindVar(var, pointer);
+}
+
+void Expression::unbindVariable(char var) throw (Error) {
+    env->unbindVar(var);
+}
+
+void Expression::setFunction(std::string funcName, FunctionPntrType funcPntr, unsigned int numArgs,
+        unsigned int attributes, unsigned int cost) throw (Error) {
+    env->setFunction(funcName, funcPntr, numArgs, attributes, cost);
+}
+
+void Expression::setFunction(std::string funcName, UnaryFunctionPntrType funcPntr, unsigned int attributes,
+        unsigned int cost) throw (Error) {
+    env->setFunction(funcName, funcPntr, attributes, cost);
+}
+
+void Expression::setFunction(std::string funcName, BinaryFunctionPntrType funcPntr, unsigned int attributes,
+        unsigned int cost) throw (Error) {
+    env->setFunction(funcName, funcPntr, attributes, cost);
+}
+
+void Expression::setFunction(std::string funcName, NaryFunctionPntrType funcPntr, unsigned int numArgs,
+        unsigned int attributes, unsigned int cost) throw (Error) {
+    env->setFunction(funcName, funcPntr, numArgs, attributes, cost);
+}
+
+void Expression::setBatchFunction(std::string funcName, unsigned int numArgs, BatchFunctionPntrType funcPntr)
+        throw (Error) {
+    env->setBatchFunction(funcName, numArgs, funcPntr);
+}
+
+void Expression::setMathAccuracy(MathAccuracy accuracy) {
+    env->setMathAccuracy(accuracy);
+}
+
+void Expression::setFastMath(bool enabled) {
+    env->setFastMath(enabled);
 }
 
 void Expression::compile() {
@@ -86,26 +219,156 @@ void Expression::compile() {
 }
 
 void Expression::compile(bool astOptimization) {
+    promoteIn = 0;
+#ifdef MEXPR_TELEMETRY
+    if (Telemetry::isEnabled()) {
+        unsigned long long start = readCycleCounter();
+        compileExpr(astOptimization);
+        Telemetry::record(Telemetry::COMPILE, readCycleCounter() - start, latency);
+        return;
+    }
+#endif
+    compileExpr(astOptimization);
+}
+
+void Expression::compileExpr(bool astOptimization) {
 
     /* check if we need to build the ast */
     if (astOptimization && !optimizedAST) {
-        // TODO: build optimized ast from the current ast
+        ASTNode* optimized;
+        if (env->isFastMath()) {
+            ASTNode* polynomials = Optimizer::recognizePolynomials(ast);
+            ASTNode* balanced = Optimizer::reassociate(polynomials);
+            optimized = Optimizer::foldConstants(balanced, env);
+            polynomials->deleteTree();
+            balanced->deleteTree();
+        } else {
+            optimized = Optimizer::foldConstants(ast, env);
+        }
+        if (code != NULL) { //the code of the old tree
+            delete code;
+            code = NULL;
+        }
+        releaseAST();
+        ast = optimized;
+        astRefs = new unsigned int(1);
+        optimizedAST = true;
+        optimizedVersion = env->getFunctionsVersion();
+        if (incremental)
+            ast->prepareIncremental(env);
     }
 
     if (code == NULL) {
-        code = new Code(ast);
+        if (optimizedAST)
+            code = new Code(ast, env);
+        else
+            code = new Code(ast);
     }
 }
 
-ValueType Expression::evaluate(bool treeEvaluation) throw (Error) {
+void Expression::setTiering(unsigned int compileAfter, unsigned int optimizeAfter) {
+    this->compileAfter = compileAfter;
+    this->optimizeAfter = optimizeAfter;
+    if (code == NULL && !optimizedAST)
+        promoteIn = compileAfter;
+    else if (!optimizedAST)
+        promoteIn = optimizeAfter;
+    else
+        promoteIn = 0;
+}
+
+void Expression::promote() {
+    if (code == NULL && !optimizedAST) {
+        compile(false);
+        promoteIn = optimizeAfter;
+    } else {
+        compile(true);
+    }
+}
+
+void Expression::reoptimize() throw (Error) {
+    if (!optimizedAST || optimizedVersion == env->getFunctionsVersion())
+        return;
+
+    /* the tree was optimized with other functions: it is built again from the expression string */
+    ASTNode* parsed = MExpr_ParseExpression(expr);
+    if (code != NULL) {
+        delete code;
+        code = NULL;
+    }
+    releaseAST();
+    ast = parsed;
+    astRefs = new unsigned int(1);
+    optimizedAST = false;
+    if (incremental)
+        ast->prepareIncremental(env);
+    compileExpr(true);
+}
+
+void Expression::setIncrementalEvaluation(bool incremental) {
+    if (incremental && !this->incremental) {
+        detachAST(); //the incremental evaluation writes the results in the tree
+        ast->prepareIncremental(env);
+        incrementalVersion = env->getVersion();
+    }
+    this->incremental = incremental;
+}
+
+bool Expression::isIncrementalEvaluation() {
+    return incremental;
+}
+
+inline ValueType Expression::evaluateExpr(bool treeEvaluation) throw (Error) {
+    reoptimize();
+    if (incremental) {
+        unsigned long long version = env->getVersion();
+        unsigned long long changed = env->getChangedMask(incrementalVersion);
+        if (changed & Environment::FUNCTIONS_BIT) //the attributes of the functions could be changed
+            ast->prepareIncremental(env);
+        ValueType ris = ast->evaluateIncremental(env, changed | Environment::IMPURE_BIT);
+        incrementalVersion = version; //not updated if the evaluation fails, the same changes are evaluated again
+        return ris;
+    }
+    if (promoteIn != 0 && !treeEvaluation && --promoteIn == 0)
+        promote();
     if (code == NULL || treeEvaluation)
         return ast->evaluate(env);
     return code->evaluate(env);
 }
 
+ValueType Expression::evaluate(bool treeEvaluation) throw (Error) {
+#ifdef MEXPR_TELEMETRY
+    if (Telemetry::isEnabled()) {
+        unsigned long long start = readCycleCounter();
+        ValueType ris = evaluateExpr(treeEvaluation);
+        Telemetry::record(Telemetry::EVALUATE, readCycleCounter() - start, latency);
+        return ris;
+    }
+#endif
+    return evaluateExpr(treeEvaluation);
+}
+
 ValueType Expression::evaluate() throw (Error) {
+    return evaluate(false);
+}
+
+void Expression::evaluateBatch(Batch* batch, ValueType* results) throw (Error) {
     if (code == NULL)
-        return ast->evaluate(env);
-    return code->evaluate(env);
+        compile();
+    reoptimize();
+    code->evaluateBatch(env, batch, results);
 }
 
+void Expression::evaluateBatch(Batch* batch, Reduction* reduction) throw (Error) {
+    if (code == NULL)
+        compile();
+    reoptimize();
+    code->evaluateBatch(env, batch, reduction);
+}
+
+void Expression::evaluateGrid(Grid* grid, ValueType* results) throw (Error) {
+    if (code == NULL)
+        compile();
+    reoptimize();
+    grid->evaluate(ast, env, results);
+}
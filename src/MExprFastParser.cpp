@@ -0,0 +1,530 @@
+/*
+ * Mathematical Expressions - Fast Parser
+ * Hand-written recursive descent parser of the MExprParser.y grammar
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include <MExprAST.h>
+#include <MExprError.h>
+#include <MExprNumber.h>
+using namespace std;
+using namespace MExpr;
+
+/*
+ * The parser accepts exactly the language of MExprParser.y and builds the same trees (see the comments of each
+ * method for the corresponding grammar rules). The lexer is the one of MExprLexer.l: blanks and unknown characters
+ * are skipped, and the expression ends at the first zero character.
+ *
+ * Binary operators are parsed by precedence climbing, with the precedences declared in MExprParser.y:
+ * '||' < '&&' < '==' '!=' < '<' '<=' '>' '>=' < '+' < '-' < '*' < '/', all left associative (so "a+b-c" is "a+(b-c)"
+ * and "a-b+c" is "(a-b)+c").
+ */
+class FastParser {
+
+    enum Token {
+        tEND, tLPAR, tRPAR, tADD, tSUB, tMUL, tDIV, tPOW, tCOMMA, tVAL, tVAR, tFUNC,
+        tLT, tLE, tGT, tGE, tEQ, tNE, tAND, tOR
+    };
+
+    /* maximum nesting of atomic expressions, to throw a syntax error instead of exhausting the stack
+     * (bison throws a syntax error too, when its stack grows over 10000 symbols) */
+    static const unsigned int MAX_DEPTH = 10000;
+
+    /* nodes kept without allocating memory */
+    static const size_t SMALL_POOL = 64;
+
+    const char* p; //next character
+    const char* end;
+
+    /* current token */
+    Token tok;
+    ValueType val; //tVAL
+    char var; //tVAR
+    const char* funcName; //tFUNC, without the terminating zero
+    size_t funcNameLen;
+
+    unsigned int depth;
+
+    /* all the allocated nodes, deallocated if there is a syntax error: the first SMALL_POOL nodes are in smallPool */
+    ASTNode* smallPool[SMALL_POOL];
+    size_t smallPoolSize;
+    vector<ASTNode*> pool;
+
+public:
+    FastParser(const char* expr) {
+        p = expr;
+        end = expr + strlen(expr);
+        depth = 0;
+        smallPoolSize = 0;
+    }
+
+    ASTNode* parse() throw (Error) {
+        try {
+            next();
+            ASTNode* e = expr(1);
+            if (tok != tEND)
+                throw Error(Error::syntaxError);
+            return e;
+        } catch (Error& ex) {
+            for (size_t i = 0; i < smallPoolSize; i++)
+                delete smallPool[i]; //delete only the node, not the subtree
+            for (size_t i = 0; i < pool.size(); i++)
+                delete pool[i];
+            throw;
+        }
+    }
+
+private:
+
+    static inline bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    static inline bool isLower(char c) {
+        return c >= 'a' && c <= 'z';
+    }
+
+    static inline bool isLetter(char c) {
+        return isLower(c) || (c >= 'A' && c <= 'Z');
+    }
+
+    /* reads the next token (MExprLexer.l) */
+    void next() throw (Error) {
+        for (;;) {
+            if (p == end) {
+                tok = tEND;
+                return;
+            }
+            char c = *p;
+            switch (c) {
+            case '(':
+                p++;
+                tok = tLPAR;
+                return;
+            case ')':
+                p++;
+                tok = tRPAR;
+                return;
+            case '+':
+                p++;
+                tok = tADD;
+                return;
+            case '-':
+                p++;
+                tok = tSUB;
+                return;
+            case '*':
+                p++;
+                tok = tMUL;
+                return;
+            case '/':
+                p++;
+                tok = tDIV;
+                return;
+            case '^':
+                p++;
+                tok = tPOW;
+                return;
+            case ',':
+                p++;
+                tok = tCOMMA;
+                return;
+            case '<':
+                p++;
+                tok = next('=') ? tLE : tLT;
+                return;
+            case '>':
+                p++;
+                tok = next('=') ? tGE : tGT;
+                return;
+            case '=': // "=" alone is skipped
+                p++;
+                if (next('=')) {
+                    tok = tEQ;
+                    return;
+                }
+                continue;
+            case '!':
+                p++;
+                if (next('=')) {
+                    tok = tNE;
+                    return;
+                }
+                continue;
+            case '&':
+                p++;
+                if (next('&')) {
+                    tok = tAND;
+                    return;
+                }
+                continue;
+            case '|':
+                p++;
+                if (next('|')) {
+                    tok = tOR;
+                    return;
+                }
+                continue;
+            }
+
+            if (isDigit(c)) { // [0-9]+(\.[0-9]+)?
+                const char* s = p;
+                while (p != end && isDigit(*p))
+                    p++;
+                if (p + 1 < end && *p == '.' && isDigit(p[1])) {
+                    p++;
+                    while (p != end && isDigit(*p))
+                        p++;
+                }
+                if (!parseNumber(s, p, &val))
+                    throw Error(Error::lexError);
+                tok = tVAL;
+                return;
+            }
+
+            if (isLetter(c)) { // [a-zA-Z]
+                var = c;
+                p++;
+                tok = tVAR;
+                return;
+            }
+
+            if (c == '_' && p + 1 < end && isLower(p[1])) { // \_[a-z]([a-zA-Z0-9]*)
+                funcName = p;
+                p += 2;
+                while (p != end && (isLetter(*p) || isDigit(*p)))
+                    p++;
+                funcNameLen = p - funcName;
+                tok = tFUNC;
+                return;
+            }
+
+            p++; //blanks and unknown characters
+        }
+    }
+
+    /* skips the character c if it is the next one (the second character of the two characters operators) */
+    inline bool next(char c) {
+        if (p != end && *p == c) {
+            p++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(Token t) throw (Error) {
+        if (tok != t)
+            throw Error(Error::syntaxError);
+        next();
+    }
+
+    inline ASTNode* keep(ASTNode* n) {
+        if (smallPoolSize < SMALL_POOL)
+            smallPool[smallPoolSize++] = n;
+        else
+            pool.push_back(n);
+        return n;
+    }
+
+    inline ASTNode* op(ASTPrimitiveOp::Type type, ASTNode* left, ASTNode* right) {
+        ASTNode* n = keep(new ASTPrimitiveOp(type));
+        n->setChild(0, left);
+        n->setChild(1, right);
+        return n;
+    }
+
+    /* the multiplication by -1 of the unary minus */
+    inline ASTNode* neg(ASTNode* n) {
+        return op(ASTPrimitiveOp::MUL, keep(new ASTValue(-1)), n);
+    }
+
+    inline bool atomicStart() {
+        return tok == tLPAR || tok == tVAL || tok == tVAR || tok == tFUNC;
+    }
+
+    /*
+     * powNum: ( expr ) | - ( expr ) | VAL | VAR | - VAL | + VAL | - VAR | + VAR
+     */
+    ASTNode* powNum() throw (Error) {
+        ASTNode* n;
+        switch (tok) {
+        case tLPAR:
+            next();
+            n = expr(1);
+            expect(tRPAR);
+            return n;
+        case tVAL:
+            n = keep(new ASTValue(val));
+            next();
+            return n;
+        case tVAR:
+            n = keep(new ASTVariable(var));
+            next();
+            return n;
+        case tSUB:
+            next();
+            if (tok == tLPAR) {
+                next();
+                n = expr(1);
+                expect(tRPAR);
+                return neg(n);
+            }
+            if (tok == tVAL) {
+                n = keep(new ASTValue(-val));
+                next();
+                return n;
+            }
+            if (tok == tVAR) {
+                n = keep(new ASTVariable(var));
+                next();
+                return neg(n);
+            }
+            throw Error(Error::syntaxError);
+        case tADD:
+            next();
+            if (tok == tVAL) {
+                n = keep(new ASTValue(val));
+                next();
+                return n;
+            }
+            if (tok == tVAR) {
+                n = keep(new ASTVariable(var));
+                next();
+                return n;
+            }
+            throw Error(Error::syntaxError);
+        default:
+            throw Error(Error::syntaxError);
+        }
+    }
+
+    /*
+     * The optional power and implicit multiplication after a value, a variable or a parenthesized expression:
+     * base [^ powNum] [atomicExpr]. The implicit multiplication is right associative ("xyz" is "x(yz)").
+     */
+    ASTNode* atomicTail(ASTNode* base) throw (Error) {
+        if (tok == tPOW) {
+            next();
+            base = op(ASTPrimitiveOp::POW, base, powNum());
+        }
+        if (atomicStart())
+            return op(ASTPrimitiveOp::MUL, base, atomicExpr());
+        return base;
+    }
+
+    /*
+     * atomicExpr: ( expr ) [^ powNum] [atomicExpr] | VAL [^ powNum] [atomicExpr] | VAR [^ powNum] [atomicExpr]
+     *           | FUNC ( expr [, expr]* )
+     */
+    ASTNode* atomicExpr() throw (Error) {
+        if (++depth > MAX_DEPTH)
+            throw Error(Error::syntaxError);
+
+        ASTNode* n;
+        switch (tok) {
+        case tLPAR:
+            next();
+            n = expr(1);
+            expect(tRPAR);
+            n = atomicTail(n);
+            break;
+        case tVAL:
+            n = keep(new ASTValue(val));
+            next();
+            n = atomicTail(n);
+            break;
+        case tVAR:
+            n = keep(new ASTVariable(var));
+            next();
+            n = atomicTail(n);
+            break;
+        case tFUNC:
+            n = function();
+            break;
+        default:
+            throw Error(Error::syntaxError);
+        }
+
+        depth--;
+        return n;
+    }
+
+    /*
+     * FUNC ( expr [, expr]* ), the name of the function is mangled with the number of arguments ("_name_2").
+     * _if with three arguments is the select.
+     */
+    ASTNode* function() throw (Error) {
+        const char* name = funcName;
+        size_t nameLen = funcNameLen;
+        next();
+        expect(tLPAR);
+
+        ASTNode* firstArg = expr(1);
+        vector<ASTNode*> args; //only for the functions with more than one argument
+        while (tok == tCOMMA) {
+            next();
+            if (args.empty())
+                args.push_back(firstArg);
+            args.push_back(expr(1));
+        }
+        expect(tRPAR);
+
+        unsigned int numArgs = args.empty() ? 1 : args.size();
+        if (numArgs == 3 && nameLen == 3 && memcmp(name, "_if", 3) == 0) {
+            ASTNode* n = keep(new ASTPrimitiveOp(ASTPrimitiveOp::SEL));
+            for (unsigned int i = 0; i < numArgs; i++)
+                n->setChild(i, args[i]);
+            return n;
+        }
+
+        char digits[16];
+        int d = sizeof(digits);
+        unsigned int k = numArgs;
+        do {
+            digits[--d] = '0' + k % 10;
+            k /= 10;
+        } while (k > 0);
+
+        string mangled;
+        mangled.reserve(nameLen + 1 + sizeof(digits) - d);
+        mangled.append(name, nameLen);
+        mangled += '_';
+        mangled.append(digits + d, sizeof(digits) - d);
+
+        ASTNode* n = keep(new ASTFunction(mangled, numArgs));
+        if (args.empty()) {
+            n->setChild(0, firstArg);
+        } else {
+            for (unsigned int i = 0; i < numArgs; i++)
+                n->setChild(i, args[i]);
+        }
+        return n;
+    }
+
+    /* 0 if the token is not a binary operator */
+    static inline int precedence(Token t) {
+        switch (t) {
+        case tOR:
+            return 1;
+        case tAND:
+            return 2;
+        case tEQ:
+        case tNE:
+            return 3;
+        case tLT:
+        case tLE:
+        case tGT:
+        case tGE:
+            return 4;
+        case tADD:
+            return 5;
+        case tSUB:
+            return 6;
+        case tMUL:
+            return 7;
+        case tDIV:
+            return 8;
+        default:
+            return 0;
+        }
+    }
+
+    /*
+     * expr: expr + expr | expr - expr | expr * expr | expr / expr | expr < expr | expr <= expr | expr > expr
+     *     | expr >= expr | expr == expr | expr != expr | expr && expr | expr || expr
+     *     | + atomicExpr | - atomicExpr | atomicExpr
+     *
+     * The unary plus and minus apply only to the following atomic expression ("-x^2" is "-(x^2)", "-x*y" is "(-x)*y").
+     * It parses the operators with a precedence greater or equal than minPrec.
+     */
+    ASTNode* expr(int minPrec) throw (Error) {
+        ASTNode* left;
+        if (tok == tADD) {
+            next();
+            left = atomicExpr();
+        } else if (tok == tSUB) {
+            next();
+            left = neg(atomicExpr());
+        } else {
+            left = atomicExpr();
+        }
+
+        for (;;) {
+            int prec = precedence(tok);
+            if (prec < minPrec || prec == 0)
+                return left;
+            Token t = tok;
+            next();
+            ASTNode* right = expr(prec + 1);
+            switch (t) {
+            case tADD:
+                left = op(ASTPrimitiveOp::ADD, left, right);
+                break;
+            case tSUB:
+                left = op(ASTPrimitiveOp::SUB, left, right);
+                break;
+            case tMUL:
+                left = op(ASTPrimitiveOp::MUL, left, right);
+                break;
+            case tDIV:
+                left = op(ASTPrimitiveOp::DIV, left, right);
+                break;
+            case tLT:
+                left = op(ASTPrimitiveOp::LT, left, right);
+                break;
+            case tLE:
+                left = op(ASTPrimitiveOp::LE, left, right);
+                break;
+            case tGT:
+                left = op(ASTPrimitiveOp::GT, left, right);
+                break;
+            case tGE:
+                left = op(ASTPrimitiveOp::GE, left, right);
+                break;
+            case tEQ:
+                left = op(ASTPrimitiveOp::EQ, left, right);
+                break;
+            case tNE:
+                left = op(ASTPrimitiveOp::NE, left, right);
+                break;
+            case tAND:
+                left = op(ASTPrimitiveOp::AND, left, right);
+                break;
+            default:
+                left = op(ASTPrimitiveOp::OR, left, right);
+                break;
+            }
+        }
+    }
+
+};
+
+ASTNode* MExpr_ParseExpression(const string* expr) throw (Error) {
+    FastParser parser(expr->c_str());
+    return parser.parse();
+}
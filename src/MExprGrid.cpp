@@ -0,0 +1,216 @@
+/*
+ * Mathematical Expressions - Grid
+ * Implementation
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <map>
+#include <vector>
+#include <MExprGrid.h>
+#include <MExprCode.h>
+#include <MExprOptimizer.h>
+using namespace std;
+using namespace MExpr;
+
+Grid::Grid() {
+}
+
+void Grid::addAxis(char var, const ValueType* values, size_t size) throw (Error) {
+    //check if not is [a-zA-Z]
+    if (var < 'A' || var > 'z' || ('Z' < var && var < 'a'))
+        throw Error(Error::illegalVariableName);
+
+    for (size_t i = 0; i < vars.size(); i++) {
+        if (vars[i] == var) {
+            this->values[i] = values;
+            sizes[i] = size;
+            return;
+        }
+    }
+    vars.push_back(var);
+    this->values.push_back(values);
+    sizes.push_back(size);
+}
+
+void Grid::clear() {
+    vars.clear();
+    values.clear();
+    sizes.clear();
+}
+
+size_t Grid::getCells() {
+    size_t cells = 1;
+    for (size_t i = 0; i < sizes.size(); i++)
+        cells *= sizes[i];
+    return cells;
+}
+
+
+/*-- Single-axis subexpressions -------------*/
+
+/*
+ * Finds the subexpressions to compute for each value of an axis: the maximal subtrees that use the variables of only
+ * one axis, contain only operations, variables and pure calls, and cost at least Optimizer::CSE_MIN_COST.
+ */
+class AxisAnalysis {
+
+    Environment* env;
+    int axisOf[128]; /* axis of each variable, -1 if the variable is not an axis */
+    map<ASTNode*, unsigned long long> masks; /* axes used by each subtree (a bit for each axis) */
+    map<ASTNode*, bool> pure; /* the subtree contains only operations, variables and pure calls */
+
+public:
+    bool used[128]; /* variables used by the tree and variables of the axes */
+    vector<ASTNode*> subtrees; /* subtrees to compute for each value of their axis */
+    vector<unsigned int> axes; /* axis of each subtree */
+
+    AxisAnalysis(Grid* grid, Environment* env) {
+        this->env = env;
+        for (int i = 0; i < 128; i++) {
+            axisOf[i] = -1;
+            used[i] = false;
+        }
+        for (unsigned int a = 0; a < grid->getAxes(); a++) {
+            axisOf[grid->getAxisVariable(a) & 127] = a;
+            used[grid->getAxisVariable(a) & 127] = true;
+        }
+    }
+
+    void analyze(ASTNode* ast) {
+        scan(ast);
+        collect(ast);
+    }
+
+private:
+    unsigned long long scan(ASTNode* node) {
+        Instruction in = node->getMExprInstr();
+        unsigned int n = node->countChildren();
+        unsigned long long mask = 0;
+        bool p = true;
+
+        if (in.type == iVAR) {
+            used[in.arg.variable & 127] = true;
+            if (axisOf[in.arg.variable & 127] >= 0)
+                mask = 1ULL << axisOf[in.arg.variable & 127];
+        } else if (in.type == iFUN) {
+            FunctionType fn = env->getFunction(*in.arg.funName);
+            p = isFunctionDefined(fn) && (fn.attributes & fnPURE) && fn.numArgs == n;
+        }
+
+        for (unsigned int i = 0; i < n; i++) {
+            ASTNode* c = node->getChild(i);
+            mask |= scan(c);
+            p = p && pure[c];
+        }
+        masks[node] = mask;
+        pure[node] = p;
+        return mask;
+    }
+
+    void collect(ASTNode* node) {
+        unsigned long long mask = masks[node];
+        if (node->countChildren() == 0 || mask == 0)
+            return; //the subtrees without axes are computed once for each line by the batch evaluation
+        if (pure[node] && (mask & (mask - 1)) == 0
+                && Optimizer::getCost(node, env) >= (unsigned int) Optimizer::CSE_MIN_COST) {
+            unsigned int axis = 0;
+            while (mask >>= 1)
+                axis++;
+            subtrees.push_back(node);
+            axes.push_back(axis);
+            return;
+        }
+        for (unsigned int i = 0; i < node->countChildren(); i++)
+            collect(node->getChild(i));
+    }
+
+};
+
+void Grid::evaluate(ASTNode* ast, Environment* env, ValueType* results) throw (Error) {
+    size_t cells = getCells();
+    if (cells == 0)
+        return;
+
+    AxisAnalysis analysis(this, env);
+    analysis.analyze(ast);
+
+    /* each subtree is replaced by a free variable, bound to the values of the subtree for each value of its axis */
+    map<ASTNode*, char> letters;
+    vector<char> letterOf;
+    char letter = 'a';
+    for (size_t s = 0; s < analysis.subtrees.size(); s++) {
+        while (letter != 0 && analysis.used[letter & 127])
+            letter = (letter == 'z') ? 'A' : (letter == 'Z') ? 0 : letter + 1;
+        if (letter == 0)
+            break; //no more free variables, the rest of the subtrees are computed for each cell
+        letters[analysis.subtrees[s]] = letter;
+        letterOf.push_back(letter);
+        analysis.used[letter & 127] = true;
+    }
+
+    vector<vector<ValueType> > tables(letterOf.size());
+    for (size_t s = 0; s < letterOf.size(); s++) {
+        unsigned int a = analysis.axes[s];
+        Code code(analysis.subtrees[s], env);
+        Batch batch(sizes[a]);
+        batch.setColumn(vars[a], values[a]);
+        tables[s].resize(sizes[a]);
+        code.evaluateBatch(env, &batch, &tables[s][0]);
+    }
+
+    /* the cells are evaluated by lines: the last axis and its subtrees are columns, the others are scalars */
+    unsigned int axes = vars.size();
+    size_t lineSize = (axes > 0) ? sizes[axes - 1] : 1;
+    Batch batch(lineSize);
+    if (axes > 0)
+        batch.setColumn(vars[axes - 1], values[axes - 1]);
+    for (size_t s = 0; s < letterOf.size(); s++)
+        if (analysis.axes[s] == axes - 1)
+            batch.setColumn(letterOf[s], &tables[s][0]);
+
+    ASTNode* rewritten = Optimizer::replaceSubtrees(ast, letters);
+    Code* code = NULL;
+    try {
+        code = new Code(rewritten, env);
+        for (size_t line = 0; line < cells / lineSize; line++) {
+            size_t index = line;
+            for (int a = (int) axes - 2; a >= 0; a--) {
+                size_t i = index % sizes[a];
+                index /= sizes[a];
+                batch.setScalar(vars[a], values[a][i]);
+                for (size_t s = 0; s < letterOf.size(); s++)
+                    if (analysis.axes[s] == (unsigned int) a)
+                        batch.setScalar(letterOf[s], tables[s][i]);
+            }
+            code->evaluateBatch(env, &batch, results + line * lineSize);
+        }
+    } catch (Error& ex) {
+        delete code;
+        rewritten->deleteTree();
+        throw;
+    }
+    delete code;
+    rewritten->deleteTree();
+}
@@ -0,0 +1,128 @@
+/*
+ * Mathematical Expressions - Number parsing
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __MExprNumber_H__
+#define __MExprNumber_H__
+
+#include <stdlib.h>
+#include <string.h>
+#include <MExprDefinitions.h>
+
+namespace MExpr {
+
+    /* exact powers of ten of the fast path */
+    static const double numberPow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14,
+            1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    /**
+     * Parses the decimal number in [s, end), without copying it and without a terminating zero.
+     * It returns false if the characters are not entirely a number.
+     *
+     * When the mantissa fits in 53 bits and the exponent is in [-22, 22] the result is a single exact multiplication
+     * or division of two doubles (Clinger's fast path), so it is correctly rounded. The other numbers (very long or
+     * with large exponents, inf, nan, hexadecimal) are parsed by strtod.
+     */
+    inline bool parseNumber(const char* s, const char* end, ValueType* v) {
+        const char* p = s;
+        bool neg = false;
+        bool any = false; //at least a digit
+        bool truncated = false; //more than 19 significant digits
+        unsigned long long mant = 0;
+        int digits = 0; //significant digits in mant
+        int exp10 = 0;
+
+        if (p < end && (*p == '-' || *p == '+'))
+            neg = (*p++ == '-');
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            any = true;
+            if (digits < 19) {
+                mant = mant * 10 + (*p - '0');
+                if (mant != 0)
+                    digits++;
+            } else {
+                exp10++;
+                truncated |= (*p != '0');
+            }
+        }
+        if (p < end && *p == '.') {
+            for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+                any = true;
+                if (digits < 19) {
+                    mant = mant * 10 + (*p - '0');
+                    if (mant != 0)
+                        digits++;
+                    exp10--;
+                } else {
+                    truncated |= (*p != '0');
+                }
+            }
+        }
+        if (any && p < end && (*p == 'e' || *p == 'E')) {
+            const char* q = p + 1;
+            bool eneg = false;
+            int e = 0;
+            if (q < end && (*q == '-' || *q == '+'))
+                eneg = (*q++ == '-');
+            if (q < end && *q >= '0' && *q <= '9') {
+                for (; q < end && *q >= '0' && *q <= '9'; q++)
+                    if (e < 100000)
+                        e = e * 10 + (*q - '0');
+                exp10 += eneg ? -e : e;
+                p = q;
+            }
+        }
+
+        if (any && p == end && !truncated) {
+            if (mant == 0) {
+                *v = neg ? -0.0 : 0.0;
+                return true;
+            }
+            if (mant <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+                double d = (double) mant;
+                d = (exp10 < 0) ? d / numberPow10[-exp10] : d * numberPow10[exp10];
+                *v = neg ? -d : d;
+                return true;
+            }
+        }
+
+        /* slow path */
+        char buf[64];
+        size_t len = end - s;
+        char* str = (len < sizeof(buf)) ? buf : new char[len + 1];
+        memcpy(str, s, len);
+        str[len] = 0;
+        char* e;
+        *v = strtod(str, &e);
+        bool ok = (len > 0 && e == str + len);
+        if (str != buf)
+            delete[] str;
+        return ok;
+    }
+
+} //end of namespace MExpr
+
+#endif
@@ -0,0 +1,537 @@
+/*
+ * Mathematical Expressions - Optimizer
+ * Implementation
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <MExprOptimizer.h>
+using namespace std;
+using namespace MExpr;
+
+
+/*-- Constant folding -----------------------*/
+
+static ASTPrimitiveOp::Type getPrimitiveOpType(InstructionType type) {
+    switch (type) {
+    case iADD:
+        return ASTPrimitiveOp::ADD;
+    case iSUB:
+        return ASTPrimitiveOp::SUB;
+    case iMUL:
+        return ASTPrimitiveOp::MUL;
+    case iDIV:
+        return ASTPrimitiveOp::DIV;
+    case iLT:
+        return ASTPrimitiveOp::LT;
+    case iLE:
+        return ASTPrimitiveOp::LE;
+    case iGT:
+        return ASTPrimitiveOp::GT;
+    case iGE:
+        return ASTPrimitiveOp::GE;
+    case iEQ:
+        return ASTPrimitiveOp::EQ;
+    case iNE:
+        return ASTPrimitiveOp::NE;
+    case iAND:
+        return ASTPrimitiveOp::AND;
+    case iOR:
+        return ASTPrimitiveOp::OR;
+    case iSEL:
+        return ASTPrimitiveOp::SEL;
+    default:
+        return ASTPrimitiveOp::POW;
+    }
+}
+
+/* a new node like the given one, without the children */
+static ASTNode* copyNode(ASTNode* ast) {
+    Instruction in = ast->getMExprInstr();
+    ASTNode* node;
+
+    switch (in.type) {
+    case iVAL:
+        return new ASTValue(in.arg.value);
+    case iVAR:
+        return new ASTVariable(in.arg.variable);
+    case iFUN:
+        return new ASTFunction(*in.arg.funName, ast->countChildren());
+    case iPOLY:
+        return new ASTPolynomial(in.arg.polynomial.coefficients, in.arg.polynomial.degree);
+    default:
+        node = new ASTPrimitiveOp(getPrimitiveOpType(in.type));
+        if (in.type == iDIV) //before the folding of the node, a guarded division by zero is folded
+            static_cast<ASTPrimitiveOp*>(node)->setGuarded(in.arg.guarded);
+        return node;
+    }
+}
+
+ASTNode* Optimizer::foldConstants(ASTNode* ast, Environment* env) {
+    Instruction in = ast->getMExprInstr();
+    unsigned int n = ast->countChildren();
+    ASTNode* node = copyNode(ast);
+    if (n == 0)
+        return node;
+
+    bool constant = true;
+    for (unsigned int i = 0; i < n; i++) {
+        ASTNode* c = foldConstants(ast->getChild(i), env);
+        node->setChild(i, c);
+        constant = constant && c->getMExprInstr().type == iVAL;
+    }
+    if (!constant)
+        return node;
+
+    if (in.type == iFUN) {
+        FunctionType fn = env->getFunction(*in.arg.funName);
+        if (!isFunctionDefined(fn) || !(fn.attributes & fnCONST))
+            return node;
+    }
+
+    /* the node is evaluated as the expression would do, the errors are left to the evaluation */
+    ValueType v;
+    try {
+        v = node->evaluate(env);
+    } catch (Error& ex) {
+        return node;
+    }
+    node->deleteTree();
+    return new ASTValue(v);
+}
+
+
+ASTNode* Optimizer::replaceSubtrees(ASTNode* ast, const map<ASTNode*, char>& variables) {
+    map<ASTNode*, char>::const_iterator it = variables.find(ast);
+    if (it != variables.end())
+        return new ASTVariable(it->second);
+
+    ASTNode* node = copyNode(ast);
+    for (unsigned int i = 0; i < ast->countChildren(); i++)
+        node->setChild(i, replaceSubtrees(ast->getChild(i), variables));
+    return node;
+}
+
+
+/*-- Reassociation -------------------------*/
+
+/* term of a chain, the terms of the additions are subtracted if negated */
+typedef struct {
+    ASTNode* node;
+    bool negated;
+} ChainTerm;
+
+static void flattenChain(ASTNode* node, bool product, bool negated, vector<ChainTerm>* terms) {
+    InstructionType type = node->getMExprInstr().type;
+    if (product ? type == iMUL : (type == iADD || type == iSUB)) {
+        flattenChain(node->getChild(0), product, negated, terms);
+        flattenChain(node->getChild(1), product, (type == iSUB) ? !negated : negated, terms);
+        return;
+    }
+    ChainTerm term;
+    term.node = Optimizer::reassociate(node);
+    term.negated = negated;
+    terms->push_back(term);
+}
+
+static ASTNode* newOperation(ASTPrimitiveOp::Type type, ASTNode* left, ASTNode* right) {
+    ASTNode* node = new ASTPrimitiveOp(type);
+    node->setChild(0, left);
+    node->setChild(1, right);
+    return node;
+}
+
+/* balanced tree of the terms [first, last), a negated result is the opposite of its node */
+static ChainTerm balanceChain(const vector<ChainTerm>& terms, size_t first, size_t last, bool product) {
+    if (last - first == 1)
+        return terms[first];
+
+    size_t middle = first + (last - first) / 2;
+    ChainTerm left = balanceChain(terms, first, middle, product);
+    ChainTerm right = balanceChain(terms, middle, last, product);
+    ChainTerm ris;
+    if (product) {
+        ris.node = newOperation(ASTPrimitiveOp::MUL, left.node, right.node);
+        ris.negated = false;
+    } else if (left.negated == right.negated) { //-a - b = -(a + b)
+        ris.node = newOperation(ASTPrimitiveOp::ADD, left.node, right.node);
+        ris.negated = left.negated;
+    } else { //-a + b = -(a - b), the terms keep their order
+        ris.node = newOperation(ASTPrimitiveOp::SUB, left.node, right.node);
+        ris.negated = left.negated;
+    }
+    return ris;
+}
+
+ASTNode* Optimizer::reassociate(ASTNode* ast) {
+    InstructionType type = ast->getMExprInstr().type;
+    if (type != iADD && type != iSUB && type != iMUL) {
+        ASTNode* node = copyNode(ast);
+        for (unsigned int i = 0; i < ast->countChildren(); i++)
+            node->setChild(i, reassociate(ast->getChild(i)));
+        return node;
+    }
+
+    bool product = (type == iMUL);
+    vector<ChainTerm> terms;
+    flattenChain(ast, product, false, &terms);
+
+    /* the constants first (added, with their sign), then the other terms in their order */
+    vector<ChainTerm> constants, others;
+    for (size_t i = 0; i < terms.size(); i++) {
+        Instruction in = terms[i].node->getMExprInstr();
+        if (in.type != iVAL) {
+            others.push_back(terms[i]);
+            continue;
+        }
+        if (terms[i].negated) {
+            terms[i].node->deleteTree();
+            terms[i].node = new ASTValue(-in.arg.value);
+            terms[i].negated = false;
+        }
+        constants.push_back(terms[i]);
+    }
+
+    ChainTerm ris;
+    if (constants.empty() || others.empty()) {
+        ris = balanceChain(constants.empty() ? others : constants, 0, terms.size(), product);
+    } else {
+        vector<ChainTerm> parts(2);
+        parts[0] = balanceChain(constants, 0, constants.size(), product);
+        parts[1] = balanceChain(others, 0, others.size(), product);
+        ris = balanceChain(parts, 0, 2, product);
+    }
+    if (ris.negated)
+        return newOperation(ASTPrimitiveOp::MUL, new ASTValue(-1), ris.node); //like the parser does with -x
+    return ris.node;
+}
+
+
+/*-- Polynomials ----------------------------*/
+
+/* monomial c x^k, the variable is 0 for the constants */
+typedef struct {
+    char variable;
+    unsigned int degree;
+    ValueType coefficient;
+} Monomial;
+
+/* recognizes the products of constants, of a variable and of its constant integer powers */
+static bool getMonomial(ASTNode* node, Monomial* m) {
+    Instruction in = node->getMExprInstr();
+    Monomial a, b;
+
+    switch (in.type) {
+    case iVAL:
+        m->variable = 0;
+        m->degree = 0;
+        m->coefficient = in.arg.value;
+        return true;
+    case iVAR:
+        m->variable = in.arg.variable;
+        m->degree = 1;
+        m->coefficient = 1;
+        return true;
+    case iPOW: {
+        Instruction base = node->getChild(0)->getMExprInstr();
+        Instruction exponent = node->getChild(1)->getMExprInstr();
+        if (base.type != iVAR || exponent.type != iVAL || !(exponent.arg.value >= 0)
+                || exponent.arg.value > ASTPolynomial::MAX_DEGREE || exponent.arg.value != floor(exponent.arg.value))
+            return false;
+        m->degree = (unsigned int) exponent.arg.value;
+        m->variable = (m->degree > 0) ? base.arg.variable : 0;
+        m->coefficient = 1;
+        return true;
+    }
+    case iMUL:
+        if (!getMonomial(node->getChild(0), &a) || !getMonomial(node->getChild(1), &b))
+            return false;
+        if ((a.variable != 0 && b.variable != 0 && a.variable != b.variable)
+                || a.degree + b.degree > ASTPolynomial::MAX_DEGREE)
+            return false;
+        m->variable = (a.variable != 0) ? a.variable : b.variable;
+        m->degree = a.degree + b.degree;
+        m->coefficient = a.coefficient * b.coefficient;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* terms of a chain of additions and subtractions, the nodes are not copied */
+static void collectTerms(ASTNode* node, bool negated, vector<ChainTerm>* terms) {
+    InstructionType type = node->getMExprInstr().type;
+    if (type == iADD || type == iSUB) {
+        collectTerms(node->getChild(0), negated, terms);
+        collectTerms(node->getChild(1), (type == iSUB) ? !negated : negated, terms);
+        return;
+    }
+    ChainTerm term;
+    term.node = node;
+    term.negated = negated;
+    terms->push_back(term);
+}
+
+ASTNode* Optimizer::recognizePolynomials(ASTNode* ast) {
+    InstructionType type = ast->getMExprInstr().type;
+    vector<ChainTerm> terms;
+    if (type == iADD || type == iSUB || type == iMUL || type == iPOW)
+        collectTerms(ast, false, &terms);
+
+    /* the variables with a power or with more than one monomial are worth a polynomial */
+    vector<Monomial> monomials(terms.size());
+    vector<bool> isMonomial(terms.size());
+    map<char, unsigned int> degree, count;
+    for (size_t i = 0; i < terms.size(); i++) {
+        isMonomial[i] = getMonomial(terms[i].node, &monomials[i]);
+        if (!isMonomial[i] || monomials[i].variable == 0)
+            continue;
+        char v = monomials[i].variable;
+        count[v]++;
+        if (monomials[i].degree > degree[v])
+            degree[v] = monomials[i].degree;
+    }
+    char first = 0; //the polynomial that takes the constant terms
+    for (size_t i = 0; i < terms.size() && first == 0; i++) {
+        char v = monomials[i].variable;
+        if (isMonomial[i] && v != 0 && (count[v] > 1 || degree[v] > 1))
+            first = v;
+    }
+
+    if (first == 0) {
+        ASTNode* node = copyNode(ast);
+        for (unsigned int i = 0; i < ast->countChildren(); i++)
+            node->setChild(i, recognizePolynomials(ast->getChild(i)));
+        return node;
+    }
+
+    /* every polynomial takes the place of the first of its monomials, the other terms keep their order */
+    map<char, vector<ValueType> > coefficients;
+    map<char, size_t> position;
+    vector<ChainTerm> result;
+    for (size_t i = 0; i < terms.size(); i++) {
+        Monomial& m = monomials[i];
+        char v = (isMonomial[i] && m.variable == 0) ? first : m.variable;
+        if (!isMonomial[i] || (v != first && count[v] <= 1 && degree[v] <= 1)) {
+            ChainTerm term;
+            term.node = recognizePolynomials(terms[i].node);
+            term.negated = terms[i].negated;
+            result.push_back(term);
+            continue;
+        }
+        if (coefficients.find(v) == coefficients.end()) {
+            coefficients[v].resize(degree[v] + 1, 0);
+            position[v] = result.size();
+            ChainTerm term;
+            term.node = NULL;
+            term.negated = false;
+            result.push_back(term);
+        }
+        coefficients[v][m.degree] += terms[i].negated ? -m.coefficient : m.coefficient;
+    }
+    for (map<char, size_t>::iterator it = position.begin(); it != position.end(); it++) {
+        ASTNode* node = new ASTPolynomial(&coefficients[it->first][0], degree[it->first]);
+        node->setChild(0, new ASTVariable(it->first));
+        result[it->second].node = node;
+    }
+
+    ChainTerm ris = balanceChain(result, 0, result.size(), false);
+    if (ris.negated)
+        return newOperation(ASTPrimitiveOp::MUL, new ASTValue(-1), ris.node);
+    return ris.node;
+}
+
+
+/*-- Common subexpressions ------------------*/
+
+/*
+ * Value numbering of the subtrees: two subtrees have the same number if they have the same instructions, so they
+ * compute the same value when they contain only operations, variables and pure calls.
+ */
+class SubtreeNumbering {
+
+    Environment* env;
+    map<string, unsigned int> numbers; /* key of a subtree (instruction and numbers of the children) -> number */
+
+public:
+    map<ASTNode*, unsigned int> nodes; /* number of each node */
+    vector<unsigned int> cost; /* cost of each number */
+    vector<bool> pure; /* the subtree contains only operations, variables and pure calls */
+
+    SubtreeNumbering(Environment* env) {
+        this->env = env;
+    }
+
+    unsigned int number(ASTNode* node) {
+        Instruction in = node->getMExprInstr();
+        unsigned int n = node->countChildren();
+        string key;
+        unsigned int c = 0;
+        bool p = true;
+
+        key += (char) in.type;
+        switch (in.type) {
+        case iVAL:
+            key.append((const char*) &in.arg.value, sizeof(ValueType));
+            break;
+        case iVAR:
+            key += in.arg.variable;
+            c = 1;
+            break;
+        case iFUN: {
+            key += *in.arg.funName;
+            key += '\0';
+            FunctionType fn = env->getFunction(*in.arg.funName);
+            p = isFunctionDefined(fn) && (fn.attributes & fnPURE) && fn.numArgs == n;
+            c = (fn.cost > 0) ? fn.cost : (unsigned int) Optimizer::DEFAULT_FUNCTION_COST;
+            break;
+        }
+        case iDIV:
+            key += (char) in.arg.guarded;
+            c = 4;
+            break;
+        case iPOW:
+            c = 20;
+            break;
+        case iPOLY:
+            key.append((const char*) &in.arg.polynomial.degree, sizeof(unsigned int));
+            key.append((const char*) in.arg.polynomial.coefficients, (in.arg.polynomial.degree + 1) * sizeof(ValueType));
+            c = 2 * in.arg.polynomial.degree;
+            break;
+        default:
+            c = 1;
+            break;
+        }
+
+        for (unsigned int i = 0; i < n; i++) {
+            unsigned int k = number(node->getChild(i));
+            key.append((const char*) &k, sizeof(k));
+            c += cost[k];
+            p = p && pure[k];
+        }
+
+        unsigned int k;
+        map<string, unsigned int>::iterator it = numbers.find(key);
+        if (it != numbers.end()) {
+            k = it->second;
+        } else {
+            k = cost.size();
+            numbers[key] = k;
+            cost.push_back(c);
+            pure.push_back(p);
+        }
+        nodes[node] = k;
+        return k;
+    }
+
+};
+
+/* marks the repeated subtrees, in the order of the evaluation: the subtrees of a repeated subtree are not visited, so
+ * they are repeated only if they appear somewhere else */
+static void markRepeated(ASTNode* node, SubtreeNumbering* numbering, vector<char>* seen, vector<unsigned int>* order) {
+    unsigned int k = numbering->nodes[node];
+    bool eligible = node->countChildren() > 0 && numbering->pure[k]
+            && numbering->cost[k] >= (unsigned int) Optimizer::CSE_MIN_COST;
+
+    if (eligible && (*seen)[k] != 0) {
+        if ((*seen)[k] == 1)
+            order->push_back(k);
+        (*seen)[k] = 2;
+        return;
+    }
+    for (unsigned int i = 0; i < node->countChildren(); i++)
+        markRepeated(node->getChild(i), numbering, seen, order);
+    if (eligible)
+        (*seen)[k] = 1;
+}
+
+unsigned int Optimizer::findCommonSubexpressions(ASTNode* ast, Environment* env, map<ASTNode*, unsigned int>* slots) {
+    SubtreeNumbering numbering(env);
+    numbering.number(ast);
+
+    vector<char> seen(numbering.cost.size(), 0); //0 not seen, 1 seen once, 2 repeated
+    vector<unsigned int> order;
+    markRepeated(ast, &numbering, &seen, &order);
+
+    vector<int> slotOf(numbering.cost.size(), -1);
+    for (size_t i = 0; i < order.size(); i++)
+        slotOf[order[i]] = i;
+    for (map<ASTNode*, unsigned int>::iterator it = numbering.nodes.begin(); it != numbering.nodes.end(); it++)
+        if (slotOf[it->second] >= 0)
+            (*slots)[it->first] = slotOf[it->second];
+    return order.size();
+}
+
+
+/*-- Evaluation order -----------------------*/
+
+/* stack elements needed by a subtree, *impure is set if the subtree calls functions that are not fnPURE */
+static unsigned int orderSubtree(ASTNode* node, Environment* env, set<ASTNode*>* reversed, bool* impure) {
+    Instruction in = node->getMExprInstr();
+    unsigned int n = node->countChildren();
+    bool childImpure;
+
+    *impure = false;
+    if (in.type == iFUN) {
+        FunctionType fn = env->getFunction(*in.arg.funName);
+        *impure = !isFunctionDefined(fn) || !(fn.attributes & fnPURE);
+    }
+
+    if (n == 2 && in.type != iFUN) {
+        bool leftImpure, rightImpure;
+        unsigned int left = orderSubtree(node->getChild(0), env, reversed, &leftImpure);
+        unsigned int right = orderSubtree(node->getChild(1), env, reversed, &rightImpure);
+        *impure = leftImpure || rightImpure;
+        if (right > left && !(leftImpure && rightImpure)) {
+            reversed->insert(node);
+            return right;
+        }
+        return (left > right) ? left : right + 1;
+    }
+
+    /* the operands in order: the j-th operand is evaluated over the results of the previous ones */
+    unsigned int need = 1;
+    for (unsigned int j = 0; j < n; j++) {
+        unsigned int c = orderSubtree(node->getChild(j), env, reversed, &childImpure) + j;
+        if (c > need)
+            need = c;
+        *impure = *impure || childImpure;
+    }
+    return need;
+}
+
+unsigned int Optimizer::findEvaluationOrder(ASTNode* ast, Environment* env, set<ASTNode*>* reversed) {
+    bool impure;
+    return orderSubtree(ast, env, reversed, &impure);
+}
+
+unsigned int Optimizer::getCost(ASTNode* ast, Environment* env) {
+    SubtreeNumbering numbering(env);
+    return numbering.cost[numbering.number(ast)];
+}
@@ -38,7 +38,8 @@
 
     int MExpr_error(const char *msg) {return 0;}
 
-    ASTNode* MExpr_ParseExpression(const string* expr) throw(Error) {
+    /* reference parser, MExpr_ParseExpression (MExprFastParser.cpp) parses the same grammar faster */
+    ASTNode* MExpr_ParseExpressionBison(const string* expr) throw(Error) {
         const char* cexpr;
         MExpr_ParserParam p;
         YY_BUFFER_STATE state;
@@ -61,10 +62,9 @@
         ret = MExpr_parse(&p);
         if (ret || p.errors) { // error parsing
             /* Error Recovering to avoid memory leaks */
-            for (list<ASTNode*>::iterator it = p.errRecPointerPool->begin(); it != p.errRecPointerPool->end(); it++) {
+            for (list<ASTNode*>::iterator it = p.errRecPointerPool->begin(); it != p.errRecPointerPool->end(); it++)
                 delete *it; //delete the ASTNode
-                p.errRecPointerPool->erase(it);//delete the list element, it not call the ASTNode deconstructor
-            }
+            p.errRecPointerPool->clear(); //delete the list elements, it not call the ASTNode deconstructor
             MExpr__delete_buffer(state, p.scanner);
             MExpr_lex_destroy(p.scanner);
             p.funcArgsAccumulator->clear();
@@ -93,6 +93,10 @@
 %type <exprNode> atomicExpr
 %type <exprNode> expr
 
+%left tOR
+%left tAND
+%left tEQ tNE
+%left tLT tLE tGT tGE
 %left tADD
 %left tSUB
 %left tPREADD
@@ -230,10 +234,14 @@ atomicExpr:
     }
     
     | tFUNC tLPAR funcArgs tRPAR {
-        ostringstream ss;
-        ss << *$1 << "_" << $3;
+        if (*$1 == "_if" && $3 == 3) { // select
+            $$ = new MExpr::ASTPrimitiveOp(MExpr::ASTPrimitiveOp::SEL);
+        } else {
+            ostringstream ss;
+            ss << *$1 << "_" << $3;
+            $$ = new MExpr::ASTFunction(ss.str(), $3);
+        }
         delete $1;
-        $$ = new MExpr::ASTFunction(ss.str(), $3);
         for (int i=0; i<$3; i++) {
             $$->setChild(i, ((MExpr_ParserParam*)data)->funcArgsAccumulator->back());
             ((MExpr_ParserParam*)data)->funcArgsAccumulator->pop_back();
@@ -299,6 +307,62 @@ expr:
         ((MExpr_ParserParam*)data)->errRecPointerPool->push_back($$);
     }
     
+    | expr tLT expr {
+        $$ = new MExpr::ASTPrimitiveOp(MExpr::ASTPrimitiveOp::LT);
+        $$->setChild(0, $1);
+        $$->setChild(1, $3);
+        ((MExpr_ParserParam*)data)->errRecPointerPool->push_back($$);
+    }
+    
+    | expr tLE expr {
+        $$ = new MExpr::ASTPrimitiveOp(MExpr::ASTPrimitiveOp::LE);
+        $$->setChild(0, $1);
+        $$->setChild(1, $3);
+        ((MExpr_ParserParam*)data)->errRecPointerPool->push_back($$);
+    }
+    
+    | expr tGT expr {
+        $$ = new MExpr::ASTPrimitiveOp(MExpr::ASTPrimitiveOp::GT);
+        $$->setChild(0, $1);
+        $$->setChild(1, $3);
+        ((MExpr_ParserParam*)data)->errRecPointerPool->push_back($$);
+    }
+    
+    | expr tGE expr {
+        $$ = new MExpr::ASTPrimitiveOp(MExpr::ASTPrimitiveOp::GE);
+        $$->setChild(0, $1);
+        $$->setChild(1, $3);
+        ((MExpr_ParserParam*)data)->errRecPointerPool->push_back($$);
+    }
+    
+    | expr tEQ expr {
+        $$ = new MExpr::ASTPrimitiveOp(MExpr::ASTPrimitiveOp::EQ);
+        $$->setChild(0, $1);
+        $$->setChild(1, $3);
+        ((MExpr_ParserParam*)data)->errRecPointerPool->push_back($$);
+    }
+    
+    | expr tNE expr {
+        $$ = new MExpr::ASTPrimitiveOp(MExpr::ASTPrimitiveOp::NE);
+        $$->setChild(0, $1);
+        $$->setChild(1, $3);
+        ((MExpr_ParserParam*)data)->errRecPointerPool->push_back($$);
+    }
+    
+    | expr tAND expr {
+        $$ = new MExpr::ASTPrimitiveOp(MExpr::ASTPrimitiveOp::AND);
+        $$->setChild(0, $1);
+        $$->setChild(1, $3);
+        ((MExpr_ParserParam*)data)->errRecPointerPool->push_back($$);
+    }
+    
+    | expr tOR expr {
+        $$ = new MExpr::ASTPrimitiveOp(MExpr::ASTPrimitiveOp::OR);
+        $$->setChild(0, $1);
+        $$->setChild(1, $3);
+        ((MExpr_ParserParam*)data)->errRecPointerPool->push_back($$);
+    }
+    
     | tADD atomicExpr %prec tPREADD {
         $$ = $2;
     }
@@ -0,0 +1,246 @@
+/*
+ * Mathematical Expressions - Registry
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <MExprRegistry.h>
+#include <MExprStdFunc.h>
+using namespace std;
+using namespace MExpr;
+
+
+/*-- Reader ---------------------------------*/
+
+Registry::Reader::Reader(Registry* registry) {
+    this->registry = registry;
+    pthread_mutex_lock(&registry->mutex);
+    slot = registry->slots;
+    while (slot != NULL && slot->used)
+        slot = slot->next;
+    if (slot == NULL) { //the slots are reused by the next readers, they are deleted with the registry
+        slot = new ReaderSlot;
+        slot->next = registry->slots;
+        registry->slots = slot;
+    }
+    slot->used = true;
+    slot->epoch = 0;
+    pthread_mutex_unlock(&registry->mutex);
+}
+
+Registry::Reader::~Reader() {
+    for (map<string, Cached>::iterator it = cache.begin(); it != cache.end(); it++)
+        delete it->second.expression;
+    pthread_mutex_lock(&registry->mutex);
+    slot->used = false;
+    pthread_mutex_unlock(&registry->mutex);
+}
+
+Expression* Registry::Reader::get(const string& name) {
+    map<string, Cached>::iterator it = cache.find(name);
+    if (it == cache.end()) { //also a name not yet published, the next gets only compare its version
+        Cached c;
+        c.entry = registry->getEntry(name);
+        c.version = 0;
+        c.expression = NULL;
+        it = cache.insert(make_pair(name, c)).first;
+    }
+
+    Cached& c = it->second;
+    unsigned long long v = __atomic_load_n(&c.entry->version, __ATOMIC_ACQUIRE);
+    if (v == c.version)
+        return c.expression;
+
+    /* a new version: it is cloned inside the current epoch, so the writers don't delete it meanwhile */
+    delete c.expression;
+    c.expression = NULL;
+    __atomic_store_n(&slot->epoch, __atomic_load_n(&registry->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    Version* current = __atomic_load_n(&c.entry->current, __ATOMIC_SEQ_CST);
+    if (current != NULL) {
+        c.expression = current->expression->clone();
+        c.version = current->number;
+    } else {
+        c.version = v;
+    }
+    __atomic_store_n(&slot->epoch, 0ULL, __ATOMIC_RELEASE);
+    return c.expression;
+}
+
+/*-------------------------------------------*/
+
+/*-- Registry -------------------------------*/
+
+Registry::Registry() {
+    slots = NULL;
+    epoch = 1;
+    versions = 0;
+    astOptimization = true;
+    env = new Environment();
+    StdFunc::initializeEnv(env);
+    pthread_mutex_init(&mutex, NULL);
+}
+
+Registry::~Registry() {
+    for (map<string, Entry*>::iterator it = entries.begin(); it != entries.end(); it++) {
+        if (it->second->current != NULL) {
+            delete it->second->current->expression;
+            delete it->second->current;
+        }
+        delete it->second;
+    }
+    for (size_t i = 0; i < retired.size(); i++) {
+        delete retired[i].version->expression;
+        delete retired[i].version;
+    }
+    while (slots != NULL) {
+        ReaderSlot* next = slots->next;
+        delete slots;
+        slots = next;
+    }
+    delete env;
+    pthread_mutex_destroy(&mutex);
+}
+
+Environment* Registry::getEnvironment() {
+    return env;
+}
+
+void Registry::setOptimization(bool astOptimization) {
+    this->astOptimization = astOptimization;
+}
+
+unsigned long long Registry::publish(const string& name, const string& expr) throw (Error) {
+    /* parsed and compiled before taking the mutex, the other writers don't wait for it */
+    Version* version = new Version;
+    try {
+        version->expression = new Expression(expr, new Environment(*env)); //the expression owns the copy
+    } catch (Error& ex) {
+        delete version;
+        throw;
+    }
+    try {
+        version->expression->compile(astOptimization);
+    } catch (Error& ex) {
+        delete version->expression;
+        delete version;
+        throw;
+    }
+
+    pthread_mutex_lock(&mutex);
+    Entry* entry = createEntry(name);
+    version->number = ++versions;
+    replace(entry, version);
+    pthread_mutex_unlock(&mutex);
+    return version->number;
+}
+
+bool Registry::remove(const string& name) {
+    pthread_mutex_lock(&mutex);
+    map<string, Entry*>::iterator it = entries.find(name);
+    bool removed = it != entries.end() && it->second->current != NULL;
+    if (removed)
+        replace(it->second, NULL);
+    pthread_mutex_unlock(&mutex);
+    return removed;
+}
+
+unsigned long long Registry::getVersion(const string& name) {
+    pthread_mutex_lock(&mutex);
+    map<string, Entry*>::iterator it = entries.find(name);
+    unsigned long long v = (it != entries.end() && it->second->current != NULL) ? it->second->current->number : 0;
+    pthread_mutex_unlock(&mutex);
+    return v;
+}
+
+void Registry::reclaim() {
+    pthread_mutex_lock(&mutex);
+    reclaimRetired();
+    pthread_mutex_unlock(&mutex);
+}
+
+size_t Registry::getRetiredCount() {
+    pthread_mutex_lock(&mutex);
+    size_t n = retired.size();
+    pthread_mutex_unlock(&mutex);
+    return n;
+}
+
+Registry::Entry* Registry::getEntry(const string& name) {
+    pthread_mutex_lock(&mutex);
+    Entry* entry = createEntry(name);
+    pthread_mutex_unlock(&mutex);
+    return entry;
+}
+
+Registry::Entry* Registry::createEntry(const string& name) {
+    map<string, Entry*>::iterator it = entries.find(name);
+    if (it != entries.end())
+        return it->second;
+    Entry* entry = new Entry;
+    entry->current = NULL;
+    entry->version = 0;
+    entries[name] = entry;
+    return entry;
+}
+
+void Registry::replace(Entry* entry, Version* version) {
+    Version* old = entry->current;
+    __atomic_store_n(&entry->current, version, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&entry->version, (version != NULL) ? version->number : ++versions, __ATOMIC_RELEASE);
+
+    /* the readers that entered an epoch up to this one could be cloning the old version */
+    if (old != NULL) {
+        Retired r;
+        r.version = old;
+        r.epoch = __atomic_fetch_add(&epoch, 1ULL, __ATOMIC_SEQ_CST);
+        retired.push_back(r);
+    }
+    reclaimRetired();
+}
+
+void Registry::reclaimRetired() {
+    unsigned long long oldest = ~0ULL; //oldest epoch of the readers inside an epoch
+    for (ReaderSlot* s = slots; s != NULL; s = s->next) {
+        unsigned long long e = __atomic_load_n(&s->epoch, __ATOMIC_SEQ_CST);
+        if (e != 0 && e < oldest)
+            oldest = e;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); i++) {
+        if (retired[i].epoch < oldest) {
+            delete retired[i].version->expression;
+            delete retired[i].version;
+        } else {
+            retired[kept++] = retired[i];
+        }
+    }
+    retired.resize(kept);
+}
+
+/*-------------------------------------------*/
@@ -26,222 +26,145 @@
  */
 
 #include <MExprStdFunc.h>
+#include <MExprVecMath.h>
 #include <math.h>
+#include <string>
 
 using namespace MExpr;
 
-void std_acos(StackType* s) { //double acos(double);
-    s->stack[s->stp - 1] = acos(s->stack[s->stp - 1]);
+/* the functions of math.h are registered directly, the ones with a different signature are wrapped */
+
+static ValueType std_jn(ValueType n, ValueType x) { //double jn(int, double);
+    return jn((int) n, x);
+}
+
+static ValueType std_yn(ValueType n, ValueType x) { //double yn(int, double);
+    return yn((int) n, x);
+}
+
+static ValueType std_isnan(ValueType x) { //int    isnan(double);
+    return isnan(x);
+}
+
+static ValueType std_ilogb(ValueType x) { //int    ilogb(double);
+    return ilogb(x);
+}
+
+/* the standard functions: name, typed pointer (unary or binary), approximate cost in nanoseconds.
+ * They are all fnPURE, fnCONST and fnVECTORIZABLE */
+static const struct {
+    const char* name;
+    UnaryFunctionPntrType fn1;
+    BinaryFunctionPntrType fn2;
+    unsigned int cost;
+} stdFunctions[] = {
+    { "_acos", &acos, NULL, 20 }, //double acos(double);
+    { "_asin", &asin, NULL, 20 }, //double asin(double);
+    { "_atan", &atan, NULL, 20 }, //double atan(double);
+    { "_atan2", NULL, &atan2, 30 }, //double atan2(double, double);
+    { "_ceil", &ceil, NULL, 1 }, //double ceil(double);
+    { "_cos", &cos, NULL, 20 }, //double cos(double);
+    { "_cosh", &cosh, NULL, 25 }, //double cosh(double);
+    { "_exp", &exp, NULL, 15 }, //double exp(double);
+    { "_fabs", &fabs, NULL, 1 }, //double fabs(double);
+    { "_floor", &floor, NULL, 1 }, //double floor(double);
+    { "_fmod", NULL, &fmod, 10 }, //double fmod(double, double);
+    { "_log", &log, NULL, 15 }, //double log(double);
+    { "_log10", &log10, NULL, 20 }, //double log10(double);
+    { "_sin", &sin, NULL, 20 }, //double sin(double);
+    { "_sinh", &sinh, NULL, 25 }, //double sinh(double);
+    { "_sqrt", &sqrt, NULL, 5 }, //double sqrt(double);
+    { "_tan", &tan, NULL, 25 }, //double tan(double);
+    { "_tanh", &tanh, NULL, 25 }, //double tanh(double);
+    { "_erf", &erf, NULL, 20 }, //double erf(double);
+    { "_erfc", &erfc, NULL, 20 }, //double erfc(double);
+    { "_hypot", NULL, &hypot, 10 }, //double hypot(double, double);
+    { "_j0", &j0, NULL, 60 }, //double j0(double);
+    { "_j1", &j1, NULL, 60 }, //double j1(double);
+    { "_jn", NULL, &std_jn, 150 }, //double jn(int, double);
+    { "_lgamma", &lgamma, NULL, 50 }, //double lgamma(double);
+    { "_y0", &y0, NULL, 60 }, //double y0(double);
+    { "_y1", &y1, NULL, 60 }, //double y1(double);
+    { "_yn", NULL, &std_yn, 150 }, //double yn(int, double);
+    { "_isnan", &std_isnan, NULL, 1 }, //int    isnan(double);
+    { "_acosh", &acosh, NULL, 25 }, //double acosh(double);
+    { "_asinh", &asinh, NULL, 25 }, //double asinh(double);
+    { "_atanh", &atanh, NULL, 25 }, //double atanh(double);
+    { "_cbrt", &cbrt, NULL, 20 }, //double cbrt(double);
+    { "_expm1", &expm1, NULL, 20 }, //double expm1(double);
+    { "_ilogb", &std_ilogb, NULL, 2 }, //int    ilogb(double);
+    { "_log1p", &log1p, NULL, 20 }, //double log1p(double);
+    { "_logb", &logb, NULL, 2 }, //double logb(double);
+    { "_nextafter", NULL, &nextafter, 3 }, //double nextafter(double, double);
+    { "_remainder", NULL, &remainder, 10 }, //double remainder(double, double);
+    { "_rint", &rint, NULL, 1 }, //double rint(double);
+    { "_scalb", NULL, &scalb, 5 } //double scalb(double, double);
+};
+
+static const int stdFunctionsNum = sizeof(stdFunctions) / sizeof(stdFunctions[0]);
+
+/* open addressing hash table (linear probing) of the standard functions, indexed by the mangled names.
+ * There is a version of the functions for each MathAccuracy, with the batch functions of VecMath */
+class StdFunctionTable {
+public:
+    enum {
+        SIZE = 128 // power of two, at least twice the number of functions
+    };
+
+    enum {
+        ACCURACIES = mathFAST + 1
+    };
+
+    std::string names[SIZE]; /* mangled names, empty for the free slots */
+    FunctionType functions[ACCURACIES][SIZE];
+
+    StdFunctionTable() {
+        for (int i = 0; i < stdFunctionsNum; i++) {
+            std::string name = Environment::getMangledName(stdFunctions[i].name, (stdFunctions[i].fn1 != NULL) ? 1 : 2);
+            unsigned int h = hash(name);
+            while (!names[h].empty())
+                h = (h + 1) & (SIZE - 1);
+            names[h] = name;
+            for (int a = 0; a < ACCURACIES; a++) {
+                FunctionType* fn = &functions[a][h];
+                fn->fnPntr = NULL;
+                fn->fn1 = stdFunctions[i].fn1;
+                fn->fn2 = stdFunctions[i].fn2;
+                fn->fnN = NULL;
+                fn->fnBatch = VecMath::getBatchFunction(stdFunctions[i].name, (MathAccuracy) a);
+                fn->numArgs = (stdFunctions[i].fn1 != NULL) ? 1 : 2;
+                fn->attributes = fnPURE | fnCONST | fnVECTORIZABLE;
+                fn->cost = stdFunctions[i].cost;
+            }
+        }
+    }
+
+    /* FNV-1a */
+    static inline unsigned int hash(const std::string& s) {
+        unsigned int h = 2166136261U;
+        for (size_t i = 0; i < s.size(); i++)
+            h = (h ^ (unsigned char) s[i]) * 16777619U;
+        return h & (SIZE - 1);
+    }
+
+    const FunctionType* find(const std::string& name, MathAccuracy accuracy) const {
+        for (unsigned int h = hash(name); !names[h].empty(); h = (h + 1) & (SIZE - 1))
+            if (names[h] == name)
+                return &functions[accuracy][h];
+        return NULL;
+    }
+};
+
+/* the table is built at the first use (g++ initializes the local statics once, also with many threads) */
+static const StdFunctionTable& getStdFunctionTable() {
+    static const StdFunctionTable table;
+    return table;
 }
 
-void std_asin(StackType* s) { //double asin(double);
-    s->stack[s->stp - 1] = asin(s->stack[s->stp - 1]);
-}
-
-void std_atan(StackType* s) { //double atan(double);
-    s->stack[s->stp - 1] = atan(s->stack[s->stp - 1]);
-}
-
-void std_atan2(StackType* s) { //double atan2(double, double);
-    s->stack[s->stp - 2] = atan2(s->stack[s->stp - 2], s->stack[s->stp - 1]);
-    s->stp--;
-}
-
-void std_ceil(StackType* s) { //double ceil(double);
-    s->stack[s->stp - 1] = ceil(s->stack[s->stp - 1]);
-}
-
-void std_cos(StackType* s) { //double cos(double);
-    s->stack[s->stp - 1] = cos(s->stack[s->stp - 1]);
-}
-
-void std_cosh(StackType* s) { //double cosh(double);
-    s->stack[s->stp - 1] = cosh(s->stack[s->stp - 1]);
-}
-
-void std_exp(StackType* s) { //double exp(double);
-    s->stack[s->stp - 1] = exp(s->stack[s->stp - 1]);
-}
-
-void std_fabs(StackType* s) { //double fabs(double);
-    s->stack[s->stp - 1] = fabs(s->stack[s->stp - 1]);
-}
-
-void std_floor(StackType* s) { //double floor(double);
-    s->stack[s->stp - 1] = floor(s->stack[s->stp - 1]);
-}
-
-void std_fmod(StackType* s) { //double fmod(double, double);
-    s->stack[s->stp - 2] = fmod(s->stack[s->stp - 2], s->stack[s->stp - 1]);
-    s->stp--;
-}
-
-void std_log(StackType* s) { //double log(double);
-    s->stack[s->stp - 1] = log(s->stack[s->stp - 1]);
-}
-
-void std_log10(StackType* s) { //double log10(double);
-    s->stack[s->stp - 1] = log10(s->stack[s->stp - 1]);
-}
-
-void std_sin(StackType* s) { //double sin(double);
-    s->stack[s->stp - 1] = sin(s->stack[s->stp - 1]);
-}
-
-void std_sinh(StackType* s) { //double sinh(double);
-    s->stack[s->stp - 1] = sinh(s->stack[s->stp - 1]);
-}
-
-void std_sqrt(StackType* s) { //double sqrt(double);
-    s->stack[s->stp - 1] = sqrt(s->stack[s->stp - 1]);
-}
-
-void std_tan(StackType* s) { //double tan(double);
-    s->stack[s->stp - 1] = tan(s->stack[s->stp - 1]);
-}
-
-void std_tanh(StackType* s) { //double tanh(double);
-    s->stack[s->stp - 1] = tanh(s->stack[s->stp - 1]);
-}
-
-void std_erf(StackType* s) { //double erf(double);
-    s->stack[s->stp - 1] = erf(s->stack[s->stp - 1]);
-}
-
-void std_erfc(StackType* s) { //double erfc(double);
-    s->stack[s->stp - 1] = erfc(s->stack[s->stp - 1]);
-}
-
-void std_hypot(StackType* s) { //double hypot(double, double);
-    s->stack[s->stp - 2] = hypot(s->stack[s->stp - 2], s->stack[s->stp - 1]);
-    s->stp--;
-}
-
-void std_j0(StackType* s) { //double j0(double);
-    s->stack[s->stp - 1] = j0(s->stack[s->stp - 1]);
-}
-
-void std_j1(StackType* s) { //double j1(double);
-    s->stack[s->stp - 1] = j1(s->stack[s->stp - 1]);
-}
-
-void std_jn(StackType* s) { //double jn(int, double);
-    s->stack[s->stp - 2] = jn((int) s->stack[s->stp - 2], s->stack[s->stp - 1]);
-    s->stp--;
-}
-
-void std_lgamma(StackType* s) { //double lgamma(double);
-    s->stack[s->stp - 1] = lgamma(s->stack[s->stp - 1]);
-}
-
-void std_y0(StackType* s) { //double y0(double);
-    s->stack[s->stp - 1] = y0(s->stack[s->stp - 1]);
-}
-
-void std_y1(StackType* s) { //double y1(double);
-    s->stack[s->stp - 1] = y1(s->stack[s->stp - 1]);
-}
-
-void std_yn(StackType* s) { //double yn(int, double);
-    s->stack[s->stp - 2] = yn((int) s->stack[s->stp - 2], s->stack[s->stp - 1]);
-    s->stp--;
-}
-
-void std_isnan(StackType* s) { //int    isnan(double);
-    s->stack[s->stp - 1] = isnan(s->stack[s->stp - 1]);
-}
-
-void std_acosh(StackType* s) { //double acosh(double);
-    s->stack[s->stp - 1] = acosh(s->stack[s->stp - 1]);
-}
-
-void std_asinh(StackType* s) { //double asinh(double);
-    s->stack[s->stp - 1] = asinh(s->stack[s->stp - 1]);
-}
-
-void std_atanh(StackType* s) { //double atanh(double);
-    s->stack[s->stp - 1] = atanh(s->stack[s->stp - 1]);
-}
-
-void std_cbrt(StackType* s) { //double cbrt(double);
-    s->stack[s->stp - 1] = cbrt(s->stack[s->stp - 1]);
-}
-
-void std_expm1(StackType* s) { //double expm1(double);
-    s->stack[s->stp - 1] = expm1(s->stack[s->stp - 1]);
-}
-
-void std_ilogb(StackType* s) { //int    ilogb(double);
-    s->stack[s->stp - 1] = ilogb(s->stack[s->stp - 1]);
-}
-
-void std_log1p(StackType* s) { //double log1p(double);
-    s->stack[s->stp - 1] = log1p(s->stack[s->stp - 1]);
-}
-
-void std_logb(StackType* s) { //double logb(double);
-    s->stack[s->stp - 1] = logb(s->stack[s->stp - 1]);
-}
-
-void std_nextafter(StackType* s) { //double nextafter(double, double);
-    s->stack[s->stp - 2] = nextafter(s->stack[s->stp - 2], s->stack[s->stp - 1]);
-    s->stp--;
-}
-
-void std_remainder(StackType* s) { //double remainder(double, double);
-    s->stack[s->stp - 2] = remainder(s->stack[s->stp - 2], s->stack[s->stp - 1]);
-    s->stp--;
-}
-
-void std_rint(StackType* s) { //double rint(double);
-    s->stack[s->stp - 1] = rint(s->stack[s->stp - 1]);
-}
-
-void std_scalb(StackType* s) { //double scalb(double, double);
-    s->stack[s->stp - 2] = scalb(s->stack[s->stp - 2], s->stack[s->stp - 1]);
-    s->stp--;
+void StdFunc::initializeEnv(Environment* env) {
+    env->setStdFunctions(true);
 }
 
-void StdFunc::initializeEnv(Environment* env) {
-    env->setFunction("_acos", &std_acos, 1); //double acos(double);
-    env->setFunction("_asin", &std_asin, 1); //double asin(double);
-    env->setFunction("_atan", &std_atan, 1); //double atan(double);
-    env->setFunction("_atan2", &std_atan2, 2); //double atan2(double, double);
-    env->setFunction("_ceil", &std_ceil, 1); //double ceil(double);
-    env->setFunction("_cos", &std_cos, 1); //double cos(double);
-    env->setFunction("_cosh", &std_cosh, 1); //double cosh(double);
-    env->setFunction("_exp", &std_exp, 1); //double exp(double);
-    env->setFunction("_fabs", &std_fabs, 1); //double fabs(double);
-    env->setFunction("_floor", &std_floor, 1); //double floor(double);
-    env->setFunction("_fmod", &std_fmod, 2); //double fmod(double, double);
-    env->setFunction("_log", &std_log, 1); //double log(double);
-    env->setFunction("_log10", &std_log10, 1); //double log10(double);
-    env->setFunction("_sin", &std_sin, 1); //double sin(double);
-    env->setFunction("_sinh", &std_sinh, 1); //double sinh(double);
-    env->setFunction("_sqrt", &std_sqrt, 1); //double sqrt(double);
-    env->setFunction("_tan", &std_tan, 1); //double tan(double);
-    env->setFunction("_tanh", &std_tanh, 1); //double tanh(double);
-    env->setFunction("_erf", &std_erf, 1); //double erf(double);
-    env->setFunction("_erfc", &std_erfc, 1); //double erfc(double);
-    env->setFunction("_hypot", &std_hypot, 2); //double hypot(double, double);
-    env->setFunction("_j0", &std_j0, 1); //double j0(double);
-    env->setFunction("_j1", &std_j1, 1); //double j1(double);
-    env->setFunction("_jn", &std_jn, 2); //double jn(int, double);
-    env->setFunction("_lgamma", &std_lgamma, 1); //double lgamma(double);
-    env->setFunction("_y0", &std_y0, 1); //double y0(double);
-    env->setFunction("_y1", &std_y1, 1); //double y1(double);
-    env->setFunction("_yn", &std_yn, 2); //double yn(int, double);
-    env->setFunction("_isnan", &std_isnan, 1); //int    isnan(double);
-    env->setFunction("_acosh", &std_acosh, 1); //double acosh(double);
-    env->setFunction("_asinh", &std_asinh, 1); //double asinh(double);
-    env->setFunction("_atanh", &std_atanh, 1); //double atanh(double);
-    env->setFunction("_cbrt", &std_cbrt, 1); //double cbrt(double);
-    env->setFunction("_expm1", &std_expm1, 1); //double expm1(double);
-    env->setFunction("_ilogb", &std_ilogb, 1); //int    ilogb(double);
-    env->setFunction("_log1p", &std_log1p, 1); //double log1p(double);
-    env->setFunction("_logb", &std_logb, 1); //double logb(double);
-    env->setFunction("_nextafter", &std_nextafter, 2); //double nextafter(double, double);
-    env->setFunction("_remainder", &std_remainder, 2); //double remainder(double, double);
-    env->setFunction("_rint", &std_rint, 1); //double rint(double);
-    env->setFunction("_scalb", &std_scalb, 2); //double scalb(double, double);
+const FunctionType* StdFunc::getFunction(const std::string& funcName, MathAccuracy accuracy) {
+    return getStdFunctionTable().find(funcName, accuracy);
 }
@@ -30,6 +30,7 @@
 
 #include <cstddef>
 #include <stdexcept>
+#include <string>
 #include <MExprDefinitions.h>
 #include <MExprEnvironment.h>
 
@@ -37,7 +38,17 @@ namespace MExpr {
 
 class StdFunc {
 public:
+    /**
+     * Makes the standard functions visible in the environment (see Environment::setStdFunctions)
+     */
     static void initializeEnv(Environment* env);
+
+    /**
+     * Returns the standard function with the given mangled name (e.g. "_sin_1"), or NULL if it doesn't exist.
+     * The functions are in a hash table built once per process and never modified, shared by all the environments.
+     * With mathULP1 and mathFAST the functions that have a vector implementation (see VecMath) have a batch version.
+     */
+    static const FunctionType* getFunction(const std::string& funcName, MathAccuracy accuracy = mathACCURATE);
 };
 
 } //end of namespace MExpr
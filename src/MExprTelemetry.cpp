@@ -0,0 +1,298 @@
+/*
+ * Mathematical Expressions - Telemetry
+ * Implementation
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include <time.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <MExprTelemetry.h>
+#ifdef MEXPR_TELEMETRY
+#include <pthread.h>
+#endif
+using namespace std;
+using namespace MExpr;
+
+
+/*-- Histogram ------------------------------*/
+
+Histogram::Histogram() {
+    reset();
+}
+
+void Histogram::reset() {
+    memset(counts, 0, sizeof(counts));
+    count = 0;
+    sum = 0;
+    min = ~0ULL;
+    max = 0;
+}
+
+void Histogram::merge(const Histogram& h) {
+    /* the count is read first, so the buckets contain at least count values (see record) */
+    count += __atomic_load_n(&h.count, __ATOMIC_ACQUIRE);
+    for (unsigned int i = 0; i < BUCKETS; i++)
+        counts[i] += __atomic_load_n(&h.counts[i], __ATOMIC_RELAXED);
+    sum += __atomic_load_n(&h.sum, __ATOMIC_RELAXED);
+    unsigned long long v = __atomic_load_n(&h.min, __ATOMIC_RELAXED);
+    if (v < min)
+        min = v;
+    v = __atomic_load_n(&h.max, __ATOMIC_RELAXED);
+    if (v > max)
+        max = v;
+}
+
+unsigned long long Histogram::getCount() const {
+    return __atomic_load_n(&count, __ATOMIC_ACQUIRE);
+}
+
+unsigned long long Histogram::getSum() const {
+    return __atomic_load_n(&sum, __ATOMIC_RELAXED);
+}
+
+unsigned long long Histogram::getMin() const {
+    unsigned long long v = __atomic_load_n(&min, __ATOMIC_RELAXED);
+    return (v == ~0ULL) ? 0 : v;
+}
+
+unsigned long long Histogram::getMax() const {
+    return __atomic_load_n(&max, __ATOMIC_RELAXED);
+}
+
+double Histogram::getMean() const {
+    unsigned long long c = getCount();
+    return (c > 0) ? (double) getSum() / c : 0;
+}
+
+unsigned long long Histogram::getPercentile(double p) const {
+    unsigned long long c = getCount();
+    if (c == 0)
+        return 0;
+
+    /* rank of the wanted value, from 1 to count */
+    unsigned long long rank = (unsigned long long) (p / 100.0 * c + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > c)
+        rank = c;
+
+    unsigned long long seen = 0;
+    for (unsigned int b = 0; b < BUCKETS; b++) {
+        seen += __atomic_load_n(&counts[b], __ATOMIC_RELAXED);
+        if (seen >= rank) {
+            /* the greatest value of the bucket, but never outside the recorded range */
+            unsigned long long v = bucketHigh(b);
+            if (v > getMax())
+                v = getMax();
+            if (v < getMin())
+                v = getMin();
+            return v;
+        }
+    }
+    return getMax();
+}
+
+unsigned long long Histogram::bucketLow(unsigned int b) {
+    if (b < SUB_BUCKETS)
+        return b;
+    unsigned int e = b / SUB_BUCKETS + 2;
+    return (unsigned long long) (SUB_BUCKETS + b % SUB_BUCKETS) << (e - 3);
+}
+
+unsigned long long Histogram::bucketHigh(unsigned int b) {
+    if (b < SUB_BUCKETS)
+        return b;
+    unsigned int e = b / SUB_BUCKETS + 2;
+    return bucketLow(b) + (1ULL << (e - 3)) - 1;
+}
+
+
+/*-- Snapshot -------------------------------*/
+
+Histogram& TelemetrySnapshot::getLatency(size_t entry, unsigned int stage) {
+    return latency[entry * Telemetry::STAGES + stage];
+}
+
+double TelemetrySnapshot::toNs(unsigned long long cycles) {
+    return cycles / cyclesPerNs;
+}
+
+
+/*-- Telemetry ------------------------------*/
+
+static bool telemetryEnabled = true;
+static double cyclesPerNs = 0;
+
+#ifdef MEXPR_TELEMETRY
+
+static pthread_mutex_t telemetryLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* aggregate histograms of every thread (Telemetry::STAGES for each thread), never deallocated */
+static vector<Histogram*> threadLatencies;
+
+/* histograms of the alive expressions */
+static map<Histogram*, const string*> exprLatencies;
+
+/* aggregate histograms of the current thread */
+static __thread Histogram* threadLatency = NULL;
+
+static Histogram* newThreadLatency() {
+    Histogram* h = new Histogram[Telemetry::STAGES];
+    pthread_mutex_lock(&telemetryLock);
+    threadLatencies.push_back(h);
+    pthread_mutex_unlock(&telemetryLock);
+    return h;
+}
+
+#endif
+
+bool Telemetry::isCompiled() {
+#ifdef MEXPR_TELEMETRY
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Telemetry::setEnabled(bool enabled) {
+    __atomic_store_n(&telemetryEnabled, enabled, __ATOMIC_RELAXED);
+}
+
+bool Telemetry::isEnabled() {
+    return __atomic_load_n(&telemetryEnabled, __ATOMIC_RELAXED);
+}
+
+const char* Telemetry::getStageName(unsigned int stage) {
+    switch (stage) {
+    case PARSE:
+        return "parse";
+    case COMPILE:
+        return "compile";
+    case EVALUATE:
+        return "evaluate";
+    default:
+        return "unknown";
+    }
+}
+
+void Telemetry::record(Stage stage, unsigned long long cycles, Histogram* exprLatency) {
+#ifdef MEXPR_TELEMETRY
+    if (threadLatency == NULL)
+        threadLatency = newThreadLatency();
+    threadLatency[stage].record(cycles);
+    if (exprLatency != NULL)
+        exprLatency[stage].record(cycles);
+#endif
+}
+
+void Telemetry::registerExpression(const string* expr, Histogram* latency) {
+#ifdef MEXPR_TELEMETRY
+    pthread_mutex_lock(&telemetryLock);
+    exprLatencies[latency] = expr;
+    pthread_mutex_unlock(&telemetryLock);
+#endif
+}
+
+void Telemetry::unregisterExpression(Histogram* latency) {
+#ifdef MEXPR_TELEMETRY
+    pthread_mutex_lock(&telemetryLock);
+    exprLatencies.erase(latency);
+    pthread_mutex_unlock(&telemetryLock);
+#endif
+}
+
+TelemetrySnapshot* Telemetry::snapshot() {
+    TelemetrySnapshot* s = new TelemetrySnapshot;
+    s->cyclesPerNs = getCyclesPerNs();
+    s->exprs.push_back("");
+    s->latency.resize(STAGES);
+
+#ifdef MEXPR_TELEMETRY
+    pthread_mutex_lock(&telemetryLock);
+    for (size_t i = 0; i < threadLatencies.size(); i++)
+        for (unsigned int st = 0; st < STAGES; st++)
+            s->latency[st].merge(threadLatencies[i][st]);
+    for (map<Histogram*, const string*>::iterator it = exprLatencies.begin(); it != exprLatencies.end(); it++) {
+        s->exprs.push_back(*it->second);
+        for (unsigned int st = 0; st < STAGES; st++) {
+            s->latency.push_back(Histogram());
+            s->latency.back().merge(it->first[st]);
+        }
+    }
+    pthread_mutex_unlock(&telemetryLock);
+#endif
+
+    return s;
+}
+
+void Telemetry::exportTo(TelemetryExportFnType fn, void* data) {
+    TelemetrySnapshot* s = snapshot();
+    for (size_t e = 0; e < s->exprs.size(); e++)
+        for (unsigned int st = 0; st < STAGES; st++)
+            fn((e == 0) ? NULL : &s->exprs[e], st, s->getLatency(e, st), s->cyclesPerNs, data);
+    delete s;
+}
+
+void Telemetry::reset() {
+#ifdef MEXPR_TELEMETRY
+    /* the owner threads could record while the histograms are cleared: some values could be lost */
+    pthread_mutex_lock(&telemetryLock);
+    for (size_t i = 0; i < threadLatencies.size(); i++)
+        for (unsigned int st = 0; st < STAGES; st++)
+            threadLatencies[i][st].reset();
+    pthread_mutex_unlock(&telemetryLock);
+#endif
+}
+
+static unsigned long long nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+double Telemetry::getCyclesPerNs() {
+    double v;
+    __atomic_load(&cyclesPerNs, &v, __ATOMIC_RELAXED);
+    if (v > 0)
+        return v;
+
+    /* the cycle counter is compared with the monotonic clock for ~10ms */
+    unsigned long long t0 = nowNs();
+    unsigned long long c0 = readCycleCounter();
+    unsigned long long t1;
+    do {
+        t1 = nowNs();
+    } while (t1 - t0 < 10000000ULL);
+    unsigned long long c1 = readCycleCounter();
+
+    v = (double) (c1 - c0) / (t1 - t0);
+    if (v <= 0)
+        v = 1;
+    __atomic_store(&cyclesPerNs, &v, __ATOMIC_RELAXED);
+    return v;
+}
@@ -44,4 +44,7 @@ typedef union MExpr_UnionTypeParser {
 /** define the type for flex and bison */
 #define YYSTYPE MExpr_TypeParser
 
+/** the union contains only pointers and numbers: bison can grow its stack (up to YYMAXDEPTH) also in C++ */
+#define YYSTYPE_IS_TRIVIAL 1
+
 #endif
@@ -0,0 +1,419 @@
+/*
+ * Mathematical Expressions - Vector Math
+ * Implementation
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <MExprVecMath.h>
+using namespace std;
+using namespace MExpr;
+
+/*
+ * The kernels are branch free functions of one element, the loops of apply() call them for a chunk of elements and
+ * then recompute with math.h the elements out of the range of the kernel (rarely, so the second loop is skipped).
+ * The kernels always get an argument in their range: clamp() replaces the others with a value in the range, and
+ * x - clamp(x) is not zero only for them (or NaN). The file is compiled with -O3 -fno-trapping-math, so the loops
+ * are vectorized with the selects (?:).
+ * The integer parts of the range reductions are computed without conversions: adding SHIFT (1.5 * 2^52) to a double
+ * rounds it to an integer, that is in the low bits of the result.
+ * The coefficients of the polynomials are minimax approximations, lowest order first.
+ */
+
+static const size_t CHUNK = 256;
+
+static const double SHIFT = 6755399441055744.0; //1.5 * 2^52
+
+static const uint64_t SIGN_MASK = 0x8000000000000000ULL;
+
+static inline double asDouble(uint64_t u) {
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+static inline uint64_t asBits(double d) {
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    return u;
+}
+
+/* out = f(x), F is a struct with kernel (the vector version), clamp and scalar (the version of math.h) */
+template<class F>
+static void apply(const ValueType* x, ValueType* out, size_t n) {
+    ValueType buf[CHUNK];
+
+    for (size_t i = 0; i < n; i += CHUNK) {
+        size_t m = (n - i < CHUNK) ? n - i : CHUNK;
+        const ValueType* xi = x + i;
+
+        uint64_t outOfRange = 0;
+        for (size_t j = 0; j < m; j++) {
+            ValueType c = F::clamp(xi[j]);
+            buf[j] = F::kernel(c);
+            outOfRange |= asBits(xi[j] - c);
+        }
+        if (outOfRange) {
+            for (size_t j = 0; j < m; j++)
+                if (!(F::clamp(xi[j]) == xi[j]))
+                    buf[j] = F::scalar(xi[j]);
+        }
+
+        memcpy(out + i, buf, m * sizeof(ValueType));
+    }
+}
+
+/* a + b = s + err, exactly */
+static inline double twoSumErr(double a, double b, double s) {
+    double bb = s - a;
+    return (a - (s - bb)) + (b - bb);
+}
+
+/* a * b = p + err, exactly (Dekker, without fma) */
+static inline double twoProductErr(double a, double b) {
+    double p = a * b;
+    double c = 134217729.0 * a; //2^27 + 1
+    double ah = c - (c - a);
+    double al = a - ah;
+    c = 134217729.0 * b;
+    double bh = c - (c - b);
+    double bl = b - bh;
+    return ((ah * bh - p) + ah * bl + al * bh) + al * bl;
+}
+
+
+/*-- exp ------------------------------------*/
+
+static const double INV_LN2 = 1.4426950408889634;
+static const double LN2_HI = 0.69314718060195446; //29 bits, k * LN2_HI is exact
+static const double LN2_LO = -4.2009150726810846e-11;
+
+/* e^r - 1 for |r| <= ln(2) / 2 */
+template<bool FAST>
+static inline double expm1Poly(double r) {
+    double q;
+    if (FAST) {
+        q = 0.50000000000000011 + r * (0.16666666666666669 + r * (0.041666666666624129
+                + r * (0.0083333333333300615 + r * (0.0013888888917213717 + r * (0.00019841269863053618
+                + r * (2.4801521295954376e-05 + r * (2.7557268459997064e-06 + r * (2.7620088445409746e-07
+                + r * 2.510038549551032e-08))))))));
+    } else {
+        q = 0.5 + r * (0.16666666666666671 + r * (0.041666666666666671 + r * (0.0083333333333261358
+                + r * (0.0013888888888883748 + r * (0.00019841269874820627 + r * (2.4801587325547743e-05
+                + r * (2.7557255400206422e-06 + r * (2.7557273643110297e-07 + r * (2.5105217004720745e-08
+                + r * 2.0914686968086876e-09)))))))));
+    }
+    return r + r * r * q;
+}
+
+/* x = k ln(2) + r, returns 2^k and e^r - 1 in pm1 */
+template<bool FAST>
+static inline double expReduce(double x, double* pm1) {
+    double t = x * INV_LN2 + SHIFT;
+    double k = t - SHIFT;
+    uint64_t ki = asBits(t) - asBits(SHIFT);
+    double r = (x - k * LN2_HI) - k * LN2_LO;
+    *pm1 = expm1Poly<FAST>(r);
+    return asDouble((ki + 1023) << 52);
+}
+
+template<bool FAST>
+struct Exp {
+    static inline double kernel(double x) {
+        double pm1;
+        double scale = expReduce<FAST>(x, &pm1);
+        return (1.0 + pm1) * scale;
+    }
+    /* the result and 2^k are normal numbers */
+    static inline double clamp(double x) {
+        return (fabs(x) <= 708.0) ? x : 0.0;
+    }
+    static double scalar(double x) {
+        return exp(x);
+    }
+};
+
+
+/*-- log ------------------------------------*/
+
+template<bool FAST>
+struct Log {
+    /* x = 2^k (1 + f) with sqrt(2)/2 <= 1 + f < sqrt(2), log(1 + f) = 2s + s R(s^2) with s = f / (2 + f) */
+    static inline double kernel(double x) {
+        uint64_t u = asBits(x);
+        u += 0x3ff0000000000000ULL - 0x3fe6a09e00000000ULL;
+        double k = asDouble(0x4330000000000000ULL | (u >> 52)) - (4503599627370496.0 + 1023.0);
+        double f = asDouble((u & 0x000fffffffffffffULL) + 0x3fe6a09e00000000ULL) - 1.0;
+
+        double s = f / (2.0 + f);
+        double z = s * s;
+        double R;
+        if (FAST) {
+            R = z * (0.66666666666666696 + z * (0.39999999999898506 + z * (0.28571428626371725
+                    + z * (0.22222211077331602 + z * (0.18182892891597505 + z * (0.15331607832490832
+                    + z * 0.14617738307246372))))));
+        } else {
+            R = z * (0.66666666666666663 + z * (0.40000000000000879 + z * (0.28571428570802848
+                    + z * (0.22222222391887064 + z * (0.18181795621632782 + z * (0.15386240708969665
+                    + z * (0.13268746195596595 + z * 0.1308690788796503)))))));
+        }
+        double hfsq = 0.5 * f * f;
+        return k * LN2_HI - ((hfsq - (s * (hfsq + R) + k * LN2_LO)) - f);
+    }
+    /* normal positive numbers */
+    static inline double clamp(double x) {
+        return ((x >= DBL_MIN) & (x <= DBL_MAX)) ? x : 1.0;
+    }
+    static double scalar(double x) {
+        return log(x);
+    }
+};
+
+
+/*-- sin and cos ----------------------------*/
+
+static const double TWO_OVER_PI = 0.63661977236758138;
+/* pi/2 = PIO2_1 + PIO2_2 + PIO2_3 + PIO2_3T, the first three have 33 bits, so k * PIO2_i is exact for |k| < 2^20 */
+static const double PIO2_1 = 1.5707963267341256;
+static const double PIO2_2 = 6.077100506303966e-11;
+static const double PIO2_3 = 2.0222662487111665e-21;
+static const double PIO2_3T = 8.4784276603688996e-32;
+
+/*
+ * x = k pi/2 + r, with |r| <= pi/4. The remainder is kept in two doubles (r + rLo), so it is accurate even when x is
+ * close to a multiple of pi/2. Then sin(x) = +-sin(r) or +-cos(r), depending on k mod 4 (+ 1 for the cosine).
+ */
+template<bool FAST, unsigned int OFFSET>
+static inline double sinCosKernel(double x) {
+    double t = x * TWO_OVER_PI + SHIFT;
+    double k = t - SHIFT;
+    uint64_t q = asBits(t) + OFFSET;
+
+    double a = x - k * PIO2_1; //exact
+    double w = -k * PIO2_2;
+    double b = a + w;
+    double e1 = twoSumErr(a, w, b);
+    w = -k * PIO2_3;
+    double r = b + w;
+    double e2 = twoSumErr(b, w, r);
+    double rLo = (e1 + e2) - k * PIO2_3T;
+
+    double z = r * r;
+    double ps, pc;
+    if (FAST) {
+        ps = -0.16666666666666666 + z * (0.0083333333333309462 + z * (-0.00019841269836754971
+                + z * (2.7557316100683029e-06 + z * (-2.5051131455427946e-08 + z * 1.591810123027412e-10))));
+    } else {
+        ps = -0.16666666666666666 + z * (0.0083333333333333315 + z * (-0.0001984126984126506
+                + z * (2.7557319219335453e-06 + z * (-2.5052106231157904e-08 + z * (1.6058531414589011e-10
+                + z * -7.5866850700912671e-13)))));
+    }
+    pc = 0.041666666666666664 + z * (-0.0013888888888887395 + z * (2.4801587298763433e-05
+            + z * (-2.7557317270560326e-07 + z * (2.0876146024689747e-09 + z * -1.1382614868556325e-11))));
+
+    /* sin(r + rLo) = sin(r) + rLo cos(r), cos(r + rLo) = cos(r) - rLo sin(r) */
+    double hz = 0.5 * z;
+    double s = r + (r * z * ps + rLo * (1.0 - hz));
+    double v = 1.0 - hz;
+    double c = v + (((1.0 - v) - hz) + (z * z * pc - r * rLo));
+
+    uint64_t swap = 0 - (q & 1);
+    uint64_t bits = (asBits(s) & ~swap) | (asBits(c) & swap);
+    bits ^= (q & 2) << 62;
+    return (OFFSET == 0 && x == 0) ? x : asDouble(bits); //sin(-0) = -0
+}
+
+/* |k| < 2^16 */
+static inline double sinCosClamp(double x) {
+    return (fabs(x) <= 1e5) ? x : 0.0;
+}
+
+template<bool FAST>
+struct Sin {
+    static inline double kernel(double x) {
+        return sinCosKernel<FAST, 0>(x);
+    }
+    static inline double clamp(double x) {
+        return sinCosClamp(x);
+    }
+    static double scalar(double x) {
+        return sin(x);
+    }
+};
+
+template<bool FAST>
+struct Cos {
+    static inline double kernel(double x) {
+        return sinCosKernel<FAST, 1>(x);
+    }
+    static inline double clamp(double x) {
+        return sinCosClamp(x);
+    }
+    static double scalar(double x) {
+        return cos(x);
+    }
+};
+
+
+/*-- tanh -----------------------------------*/
+
+template<bool FAST>
+struct Tanh {
+    /*
+     * |x| < 0.55: tanh(x) = x + x t P(t), with t = x^2
+     * otherwise: tanh(|x|) = 1 - 2 / (e^2|x| + 1), with e^2|x| + 1 = (2^k + 1) + 2^k (e^r - 1) rounded once
+     * (with mathULP1 the division and the subtraction are computed with two doubles, the errors are < 2 ULP otherwise)
+     */
+    static inline double kernel(double x) {
+        double ax = fabs(x);
+        double t = x * x;
+        double p;
+        if (FAST) {
+            p = -0.33333333333333309 + t * (0.13333333333315631 + t * (-0.053968253948884735
+                    + t * (0.021869487711831882 + t * (-0.0088632176535171116 + t * (0.0035919043131903854
+                    + t * (-0.0014541174440767055 + t * (0.00058177035458149612 + t * (-0.00021453832051829001
+                    + t * 5.3903391609067855e-05))))))));
+        } else {
+            p = -0.33333333333333331 + t * (0.13333333333332714 + t * (-0.053968253967433329
+                    + t * (0.021869488493635535 + t * (-0.0088632343970899297 + t * (0.0035921103691369332
+                    + t * (-0.0014556617537393561 + t * (0.00058893567556668892 + t * (-0.00023463362327531061
+                    + t * (8.5111304500651709e-05 + t * -2.060149214083168e-05)))))))));
+        }
+        double small = x + x * (t * p);
+
+        double pm1;
+        double scale = expReduce<FAST>(2.0 * ((ax < 20.0) ? ax : 20.0), &pm1);
+        double d = (scale + 1.0) + scale * pm1;
+        double large;
+        if (FAST) {
+            large = 1.0 - 2.0 / d;
+        } else {
+            /* 1 - 2 / (d + dLo) with the error of the division and of the subtraction */
+            double sp = scale * pm1;
+            double dLo = twoSumErr(scale + 1.0, sp, d);
+            double q = 2.0 / d;
+            double qLo = (((2.0 - q * d) - twoProductErr(q, d)) - q * dLo) * (0.5 * q); //1 / d ~ q / 2
+            large = 1.0 - q;
+            large = large + (twoSumErr(1.0, -q, large) - qLo);
+        }
+        large = asDouble(asBits(large) | (asBits(x) & SIGN_MASK));
+
+        return (ax < 0.55) ? ((x == 0) ? x : small) : large;
+    }
+    /* not a NaN */
+    static inline double clamp(double x) {
+        return (x == x) ? x : 0.0;
+    }
+    static double scalar(double x) {
+        return tanh(x);
+    }
+};
+
+
+/*-- VecMath --------------------------------*/
+
+void VecMath::vexp(const ValueType* x, ValueType* out, size_t n, MathAccuracy accuracy) {
+    if (accuracy == mathFAST)
+        apply<Exp<true> >(x, out, n);
+    else if (accuracy == mathULP1)
+        apply<Exp<false> >(x, out, n);
+    else
+        for (size_t i = 0; i < n; i++)
+            out[i] = exp(x[i]);
+}
+
+void VecMath::vlog(const ValueType* x, ValueType* out, size_t n, MathAccuracy accuracy) {
+    if (accuracy == mathFAST)
+        apply<Log<true> >(x, out, n);
+    else if (accuracy == mathULP1)
+        apply<Log<false> >(x, out, n);
+    else
+        for (size_t i = 0; i < n; i++)
+            out[i] = log(x[i]);
+}
+
+void VecMath::vsin(const ValueType* x, ValueType* out, size_t n, MathAccuracy accuracy) {
+    if (accuracy == mathFAST)
+        apply<Sin<true> >(x, out, n);
+    else if (accuracy == mathULP1)
+        apply<Sin<false> >(x, out, n);
+    else
+        for (size_t i = 0; i < n; i++)
+            out[i] = sin(x[i]);
+}
+
+void VecMath::vcos(const ValueType* x, ValueType* out, size_t n, MathAccuracy accuracy) {
+    if (accuracy == mathFAST)
+        apply<Cos<true> >(x, out, n);
+    else if (accuracy == mathULP1)
+        apply<Cos<false> >(x, out, n);
+    else
+        for (size_t i = 0; i < n; i++)
+            out[i] = cos(x[i]);
+}
+
+void VecMath::vtanh(const ValueType* x, ValueType* out, size_t n, MathAccuracy accuracy) {
+    if (accuracy == mathFAST)
+        apply<Tanh<true> >(x, out, n);
+    else if (accuracy == mathULP1)
+        apply<Tanh<false> >(x, out, n);
+    else
+        for (size_t i = 0; i < n; i++)
+            out[i] = tanh(x[i]);
+}
+
+/* batch functions (BatchFunctionPntrType) */
+
+template<class F>
+static void batch(const ValueType* const * args, ValueType* out, size_t n) {
+    apply<F>(args[0], out, n);
+}
+
+typedef struct {
+    const char* name;
+    BatchFunctionPntrType ulp1;
+    BatchFunctionPntrType fast;
+} VecMathFunction;
+
+static const VecMathFunction vecMathFunctions[] = {
+    {"_exp", &batch<Exp<false> >, &batch<Exp<true> >},
+    {"_log", &batch<Log<false> >, &batch<Log<true> >},
+    {"_sin", &batch<Sin<false> >, &batch<Sin<true> >},
+    {"_cos", &batch<Cos<false> >, &batch<Cos<true> >},
+    {"_tanh", &batch<Tanh<false> >, &batch<Tanh<true> >}
+};
+
+BatchFunctionPntrType VecMath::getBatchFunction(const string& funcName, MathAccuracy accuracy) {
+    if (accuracy == mathACCURATE)
+        return NULL;
+    for (size_t i = 0; i < sizeof(vecMathFunctions) / sizeof(VecMathFunction); i++)
+        if (funcName == vecMathFunctions[i].name)
+            return (accuracy == mathFAST) ? vecMathFunctions[i].fast : vecMathFunctions[i].ulp1;
+    return NULL;
+}
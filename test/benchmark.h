@@ -0,0 +1,255 @@
+/*
+ * MExpr C++ Benchmark Harness
+ * Wall-clock timing, repetition statistics and JSON report
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __MExprBenchmark_H__
+#define __MExprBenchmark_H__
+
+#include <cstddef>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace Bench {
+
+    /** monotonic wall clock in nanoseconds */
+    inline double nowNs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+    }
+
+    /** values written here can't be optimized away by the compiler */
+    static volatile double sink;
+
+    /**
+     * A piece of code to measure. run(n) must execute the measured operation n times.
+     * setUp/tearDown are called outside of the timed region, before and after each sample.
+     */
+    class Case {
+    public:
+        virtual ~Case() {
+        }
+        virtual void setUp() {
+        }
+        virtual void run(unsigned long iterations) = 0;
+        virtual void tearDown() {
+        }
+    };
+
+    /** statistics of a measured case, all the times are per single operation */
+    typedef struct {
+        std::string group;
+        std::string name;
+        std::string expression;
+        unsigned long iterations; /* operations per sample */
+        unsigned int samples;
+        double medianNs;
+        double p99Ns;
+        double meanNs;
+        double minNs;
+        double maxNs;
+    } Result;
+
+    /**
+     * Runs the cases with a warm-up phase, calibrates the number of operations per sample
+     * so that each sample lasts at least sampleMs milliseconds, then collects the samples.
+     */
+    class Runner {
+
+    public:
+        unsigned int samples;
+        double sampleMs;
+        double warmupMs;
+        std::string filter;
+        std::vector<Result> results;
+
+        Runner() {
+            samples = 51;
+            sampleMs = 2;
+            warmupMs = 50;
+        }
+
+        bool selected(const std::string& group, const std::string& name) {
+            if (filter.empty())
+                return true;
+            return (group + "/" + name).find(filter) != std::string::npos;
+        }
+
+        /** measures the case, returns NULL if it was filtered out (the result is moved by the next measure) */
+        Result* measure(const std::string& group, const std::string& name, const std::string& expression, Case* c) {
+            if (!selected(group, name))
+                return NULL;
+
+            /* warm-up and calibration: double the iterations until a sample is long enough */
+            unsigned long iterations = 1;
+            double start = nowNs();
+            for (;;) {
+                c->setUp();
+                double t0 = nowNs();
+                c->run(iterations);
+                double t1 = nowNs();
+                c->tearDown();
+                if ((t1 - t0) >= sampleMs * 1e6 && (t1 - start) >= warmupMs * 1e6)
+                    break;
+                if ((t1 - t0) < sampleMs * 1e6)
+                    iterations *= 2;
+            }
+
+            std::vector<double> times;
+            for (unsigned int s = 0; s < samples; s++) {
+                c->setUp();
+                double t0 = nowNs();
+                c->run(iterations);
+                double t1 = nowNs();
+                c->tearDown();
+                times.push_back((t1 - t0) / iterations);
+            }
+
+            Result r;
+            r.group = group;
+            r.name = name;
+            r.expression = expression;
+            r.iterations = iterations;
+            r.samples = samples;
+            summarize(times, &r);
+            results.push_back(r);
+
+            printf("%-12s %-34s %12.2f ns %12.2f ns  (%lu x %u)\n", group.c_str(), name.c_str(), r.medianNs, r.p99Ns,
+                    iterations, samples);
+            fflush(stdout);
+            return &results.back();
+        }
+
+        /** adds a result computed outside of the runner (e.g. a difference of two measures) */
+        void add(const Result& r) {
+            results.push_back(r);
+            printf("%-12s %-34s %12.2f ns %12.2f ns\n", r.group.c_str(), r.name.c_str(), r.medianNs, r.p99Ns);
+        }
+
+        static double percentile(const std::vector<double>& sorted, double q) {
+            if (sorted.empty())
+                return 0;
+            size_t i = (size_t) (q * (sorted.size() - 1) + 0.5);
+            if (i >= sorted.size())
+                i = sorted.size() - 1;
+            return sorted[i];
+        }
+
+        static void summarize(std::vector<double> times, Result* r) {
+            std::sort(times.begin(), times.end());
+            double sum = 0;
+            for (size_t i = 0; i < times.size(); i++)
+                sum += times[i];
+            r->medianNs = percentile(times, 0.5);
+            r->p99Ns = percentile(times, 0.99);
+            r->meanNs = times.empty() ? 0 : sum / times.size();
+            r->minNs = times.empty() ? 0 : times.front();
+            r->maxNs = times.empty() ? 0 : times.back();
+        }
+
+        static std::string jsonString(const std::string& s) {
+            std::string ris("\"");
+            for (size_t i = 0; i < s.length(); i++) {
+                char c = s[i];
+                if (c == '"' || c == '\\') {
+                    ris += '\\';
+                    ris += c;
+                } else if ((unsigned char) c < 0x20) {
+                    char buf[8];
+                    sprintf(buf, "\\u%04x", (unsigned char) c);
+                    ris += buf;
+                } else {
+                    ris += c;
+                }
+            }
+            return ris + "\"";
+        }
+
+        /** writes all the results as a JSON document, returns false if the file can't be written */
+        bool writeJSON(const char* path, const char* suite) {
+            FILE* f = fopen(path, "w");
+            if (f == NULL)
+                return false;
+
+            fprintf(f, "{\n  \"suite\": %s,\n  \"timestamp\": %ld,\n", jsonString(suite).c_str(), (long) time(NULL));
+            fprintf(f, "  \"config\": { \"samples\": %u, \"sample_ms\": %g, \"warmup_ms\": %g },\n", samples, sampleMs,
+                    warmupMs);
+            fprintf(f, "  \"benchmarks\": [\n");
+            for (size_t i = 0; i < results.size(); i++) {
+                const Result& r = results[i];
+                fprintf(f, "    { \"group\": %s, \"name\": %s, \"expression\": %s, ", jsonString(r.group).c_str(),
+                        jsonString(r.name).c_str(), jsonString(r.expression).c_str());
+                fprintf(f, "\"iterations\": %lu, \"samples\": %u, ", r.iterations, r.samples);
+                fprintf(f, "\"median_ns\": %.3f, \"p99_ns\": %.3f, \"mean_ns\": %.3f, \"min_ns\": %.3f, \"max_ns\": %.3f }%s\n",
+                        r.medianNs, r.p99Ns, r.meanNs, r.minNs, r.maxNs, (i + 1 < results.size()) ? "," : "");
+            }
+            fprintf(f, "  ]\n}\n");
+            fclose(f);
+            return true;
+        }
+
+        /**
+         * Parses the common command line options:
+         *   -o file    JSON output file
+         *   -r n       samples per benchmark
+         *   -t ms      minimum duration of a sample
+         *   -f text    runs only the benchmarks whose "group/name" contains text
+         * Returns false on unknown options.
+         */
+        bool parseArgs(int argc, char** argv, const char** jsonPath) {
+            for (int i = 1; i < argc; i++) {
+                if (i + 1 >= argc)
+                    return false;
+                if (strcmp(argv[i], "-o") == 0)
+                    *jsonPath = argv[++i];
+                else if (strcmp(argv[i], "-r") == 0)
+                    samples = (unsigned int) atoi(argv[++i]);
+                else if (strcmp(argv[i], "-t") == 0)
+                    sampleMs = atof(argv[++i]);
+                else if (strcmp(argv[i], "-f") == 0)
+                    filter = argv[++i];
+                else
+                    return false;
+            }
+            if (samples == 0)
+                samples = 1;
+            return true;
+        }
+
+        void printHeader() {
+            printf("%-12s %-34s %15s %15s\n", "group", "benchmark", "median", "p99");
+        }
+    };
+
+} //end of namespace Bench
+
+#endif
@@ -0,0 +1,350 @@
+/*
+ * MExpr C++ Benchmarks
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <cstddef>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <MExpr.h>
+#include "benchmark.h"
+using namespace std;
+using namespace MExpr;
+
+/* expressions used by the parse, compile and evaluation benchmarks */
+static const char* exprNames[] = {
+    "arith",
+    "nested-func",
+    "implicit-mul",
+    "poly",
+    "trig-exp"
+};
+
+static const char* exprs[] = {
+    "+2+3*5+2-2*3+(7^-3-8+5)-4+(3/3)+2*5-6-(9-(3^4)+6)-6+8/7-8",
+    "_sqrt(2_sqrt(2))",
+    "-3(4xy^2x-2x)(8x^-(3x)+2y^-2)",
+    "3x^4+2x^3-x^2+5x+1",
+    "_sin(x)*_exp(-y^2)+_cos(x)*_log(z)"
+};
+
+static const int exprsNum = sizeof(exprs) / sizeof(exprs[0]);
+
+static void setVariables(Expression* e) {
+    e->setVariable('x', 4);
+    e->setVariable('y', -5);
+    e->setVariable('z', 0.9);
+}
+
+/*-- Parse --------------------------------------*/
+typedef ASTNode* (*ParseFnType)(const string* expr);
+
+/* parser only: string -> abstract syntax tree. The trees are deallocated outside of the timed region */
+class ParseCase: public Bench::Case {
+    string expr;
+    ParseFnType parse;
+    vector<ASTNode*> trees;
+public:
+    ParseCase(const string& expr, ParseFnType parse) :
+            expr(expr), parse(parse) {
+    }
+    void run(unsigned long iterations) {
+        for (unsigned long i = 0; i < iterations; i++)
+            trees.push_back(parse(&expr));
+    }
+    void tearDown() {
+        for (size_t i = 0; i < trees.size(); i++)
+            trees[i]->deleteTree();
+        trees.clear();
+    }
+};
+
+/*-- Expression construction --------------------*/
+/* what a user pays for 'new Expression': environment creation and parsing */
+class ExpressionCase: public Bench::Case {
+    string expr;
+    vector<Expression*> exps;
+public:
+    ExpressionCase(const string& expr) :
+            expr(expr) {
+    }
+    void run(unsigned long iterations) {
+        for (unsigned long i = 0; i < iterations; i++)
+            exps.push_back(new Expression(expr));
+    }
+    void tearDown() {
+        for (size_t i = 0; i < exps.size(); i++)
+            delete exps[i];
+        exps.clear();
+    }
+};
+
+/*-- Code construction --------------------------*/
+class CompileCase: public Bench::Case {
+    string expr;
+    ASTNode* ast;
+    vector<Code*> codes;
+public:
+    CompileCase(const string& expr) :
+            expr(expr) {
+        ast = MExpr_ParseExpression(&this->expr);
+    }
+    ~CompileCase() {
+        ast->deleteTree();
+    }
+    void run(unsigned long iterations) {
+        for (unsigned long i = 0; i < iterations; i++)
+            codes.push_back(new Code(ast));
+    }
+    void tearDown() {
+        for (size_t i = 0; i < codes.size(); i++)
+            delete codes[i];
+        codes.clear();
+    }
+};
+
+/*-- Evaluation ---------------------------------*/
+class EvaluateCase: public Bench::Case {
+    Expression* e;
+    bool tree;
+public:
+    EvaluateCase(const string& expr, bool tree) {
+        e = new Expression(expr);
+        setVariables(e);
+        this->tree = tree;
+        if (!tree)
+            e->compile();
+    }
+    ~EvaluateCase() {
+        delete e;
+    }
+    void run(unsigned long iterations) {
+        ValueType acc = 0;
+        for (unsigned long i = 0; i < iterations; i++)
+            acc += e->evaluate(tree);
+        Bench::sink = acc;
+    }
+};
+
+/*-- Batch evaluation ---------------------------*/
+/* cost of a row: 'x' is a column, 'y' and 'z' are the same for all the rows (their subexpressions are hoisted) */
+class BatchCase: public Bench::Case {
+    Expression* e;
+    vector<ValueType> xs;
+    vector<ValueType> results;
+    Batch* batch;
+public:
+    BatchCase(const string& expr, size_t rows) :
+            xs(rows), results(rows) {
+        e = new Expression(expr);
+        setVariables(e);
+        for (size_t i = 0; i < rows; i++)
+            xs[i] = 1 + i * 0.001;
+        batch = new Batch(rows);
+        batch->setColumn('x', &xs[0]);
+        e->compile();
+    }
+    ~BatchCase() {
+        delete batch;
+        delete e;
+    }
+    void run(unsigned long iterations) {
+        ValueType acc = 0;
+        for (unsigned long i = 0; i < iterations; i += xs.size()) {
+            e->evaluateBatch(batch, &results[0]);
+            acc += results[0];
+        }
+        Bench::sink = acc;
+    }
+};
+
+/*-- Evaluation after a change of 'x' -----------*/
+/* the other variables don't change: the incremental evaluation computes only the paths from 'x' to the root */
+class ChangeXCase: public Bench::Case {
+    Expression* e;
+public:
+    ChangeXCase(const string& expr, bool incremental) {
+        e = new Expression(expr);
+        setVariables(e);
+        e->compile();
+        e->setIncrementalEvaluation(incremental);
+    }
+    ~ChangeXCase() {
+        delete e;
+    }
+    void run(unsigned long iterations) {
+        ValueType acc = 0;
+        for (unsigned long i = 0; i < iterations; i++) {
+            e->setVariable('x', (i & 1) ? 4 : 3);
+            acc += e->evaluate();
+        }
+        Bench::sink = acc;
+    }
+};
+
+/*-- Opcodes ------------------------------------*/
+
+/* a chain of 'n' binary operations: x op y op y ... */
+static string opChain(const char* op, char var, int n) {
+    string s("x");
+    for (int i = 0; i < n; i++) {
+        s += op;
+        s += var;
+    }
+    return s;
+}
+
+/* n nested power operations: ((x^z)^z)^z ... */
+static string powChain(int n) {
+    string s("x^z");
+    for (int i = 1; i < n; i++)
+        s = "(" + s + ")^z";
+    return s;
+}
+
+/* n nested function calls: _f(_f(... _f(x args) ...)) */
+static string funChain(const char* fn, const char* args, int n) {
+    string s("x");
+    for (int i = 0; i < n; i++)
+        s = string(fn) + "(" + s + args + ")";
+    return s;
+}
+
+static const int shortChain = 16;
+static const int longChain = 80;
+
+/**
+ * Per-opcode cost: the difference between a long and a short chain of the same operation, divided by
+ * the number of extra operations. This removes the fixed cost of the evaluation (stack setup and return).
+ */
+static void opcodeBenchmark(Bench::Runner* runner, const char* name, const string& shortExpr, const string& longExpr) {
+    if (!runner->selected("opcode", name))
+        return;
+
+    EvaluateCase s(shortExpr, false);
+    EvaluateCase l(longExpr, false);
+
+    Bench::Runner tmp;
+    tmp.samples = runner->samples;
+    tmp.sampleMs = runner->sampleMs;
+    tmp.warmupMs = runner->warmupMs;
+    printf("  (measuring %d and %d operations)\n", shortChain, longChain);
+    //copied, measure returns a pointer into the results of tmp that the next measure can move
+    Bench::Result rs = *tmp.measure("opcode", string(name) + "@short", shortExpr, &s);
+    Bench::Result rl = *tmp.measure("opcode", string(name) + "@long", longExpr, &l);
+
+    double k = longChain - shortChain;
+    Bench::Result r = rl;
+    r.name = name;
+    r.medianNs = (rl.medianNs - rs.medianNs) / k;
+    r.p99Ns = (rl.p99Ns - rs.p99Ns) / k;
+    r.meanNs = (rl.meanNs - rs.meanNs) / k;
+    r.minNs = (rl.minNs - rs.minNs) / k;
+    r.maxNs = (rl.maxNs - rs.maxNs) / k;
+    runner->add(r);
+}
+
+int main(int argc, char** argv) {
+    Bench::Runner runner;
+    const char* jsonPath = NULL;
+
+    if (!runner.parseArgs(argc, argv, &jsonPath)) {
+        fprintf(stderr, "usage: %s [-o file.json] [-r samples] [-t sample_ms] [-f filter]\n", argv[0]);
+        return 1;
+    }
+
+    try {
+        runner.printHeader();
+
+        for (int i = 0; i < exprsNum; i++) {
+            ParseCase c(exprs[i], MExpr_ParseExpression);
+            runner.measure("parse", exprNames[i], exprs[i], &c);
+        }
+
+        for (int i = 0; i < exprsNum; i++) {
+            ParseCase c(exprs[i], MExpr_ParseExpressionBison);
+            runner.measure("parse-bison", exprNames[i], exprs[i], &c);
+        }
+
+        for (int i = 0; i < exprsNum; i++) {
+            ExpressionCase c(exprs[i]);
+            runner.measure("expression", exprNames[i], exprs[i], &c);
+        }
+
+        for (int i = 0; i < exprsNum; i++) {
+            CompileCase c(exprs[i]);
+            runner.measure("compile", exprNames[i], exprs[i], &c);
+        }
+
+        for (int i = 0; i < exprsNum; i++) {
+            EvaluateCase c(exprs[i], true);
+            runner.measure("eval-tree", exprNames[i], exprs[i], &c);
+        }
+
+        for (int i = 0; i < exprsNum; i++) {
+            EvaluateCase c(exprs[i], false);
+            runner.measure("eval-code", exprNames[i], exprs[i], &c);
+        }
+
+        for (int i = 0; i < exprsNum; i++) {
+            BatchCase c(exprs[i], 1024);
+            runner.measure("eval-batch-row", exprNames[i], exprs[i], &c);
+        }
+
+        for (int i = 0; i < exprsNum; i++) {
+            ChangeXCase c(exprs[i], false);
+            runner.measure("change-x-code", exprNames[i], exprs[i], &c);
+        }
+
+        for (int i = 0; i < exprsNum; i++) {
+            ChangeXCase c(exprs[i], true);
+            runner.measure("change-x-incremental", exprNames[i], exprs[i], &c);
+        }
+
+        opcodeBenchmark(&runner, "ADD", opChain("+", 'y', shortChain), opChain("+", 'y', longChain));
+        opcodeBenchmark(&runner, "ADD-VAL", opChain("+", '2', shortChain), opChain("+", '2', longChain));
+        opcodeBenchmark(&runner, "SUB", opChain("-", 'y', shortChain), opChain("-", 'y', longChain));
+        opcodeBenchmark(&runner, "MUL", opChain("*", 'y', shortChain), opChain("*", 'y', longChain));
+        opcodeBenchmark(&runner, "DIV", opChain("/", 'y', shortChain), opChain("/", 'y', longChain));
+        opcodeBenchmark(&runner, "POW", powChain(shortChain), powChain(longChain));
+        opcodeBenchmark(&runner, "FUN-sin", funChain("_sin", "", shortChain), funChain("_sin", "", longChain));
+        opcodeBenchmark(&runner, "FUN-hypot", funChain("_hypot", ",y", shortChain), funChain("_hypot", ",y", longChain));
+
+    } catch (Error& ex) {
+        fprintf(stderr, "Err: %s\n", ex.what());
+        return 1;
+    }
+
+    if (jsonPath != NULL) {
+        if (!runner.writeJSON(jsonPath, "mexpr-benchmarks")) {
+            fprintf(stderr, "can't write %s\n", jsonPath);
+            return 1;
+        }
+        printf("results written in %s\n", jsonPath);
+    }
+
+    return 0;
+}
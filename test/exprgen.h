@@ -0,0 +1,283 @@
+/*
+ * MExpr C++ Synthetic Expressions Generator
+ * Seeded random generator of grammar-valid expressions with a controllable shape
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __MExprExprGen_H__
+#define __MExprExprGen_H__
+
+#include <stdio.h>
+#include <string>
+
+namespace Bench {
+
+    /** the variables used by the generator, in order of use */
+    static const char genVariables[] = "xyzabcdfghijklmnopqrstuvwABCDEFGHIJKLMNOPQRSTUVWXYZe";
+
+    /**
+     * Shape parameters of the generated expressions.
+     *
+     * nodes:         approximate number of nodes of the abstract syntax tree
+     * maxDepth:      maximum nesting depth, deeper subexpressions are replaced by leaves
+     * skew:          fraction of the nodes given to the smaller operand of an operation.
+     *                0.5 builds balanced trees, values near 0 build long chains (deep trees)
+     * functionRatio: probability that an operation is a function call
+     * powerRatio:    probability that an operation is a power
+     * implicitRatio: probability that an operation is an implicit multiplication (e.g. "3x(y+1)")
+     * unaryRatio:    probability that an operation is an unary minus
+     * conditionRatio: probability that an operation is a comparison, a logical operator or a select (_if)
+     * variables:     number of distinct variables (from 1 to 52)
+     */
+    class Shape {
+    public:
+        unsigned int nodes;
+        unsigned int maxDepth;
+        double skew;
+        double functionRatio;
+        double powerRatio;
+        double implicitRatio;
+        double unaryRatio;
+        double conditionRatio;
+        unsigned int variables;
+
+        Shape() {
+            nodes = 64;
+            maxDepth = 1000000;
+            skew = 0.5;
+            functionRatio = 0.1;
+            powerRatio = 0.1;
+            implicitRatio = 0.2;
+            unaryRatio = 0.05;
+            conditionRatio = 0;
+            variables = 3;
+        }
+    };
+
+    /**
+     * Generates expressions accepted by the MExpr grammar.
+     * The same seed always generates the same sequence of expressions, on every platform.
+     *
+     * Divisions have always a constant non-zero divisor, so the generated expressions
+     * can't throw division by zero errors during the evaluation.
+     */
+    class ExprGenerator {
+
+        /* the kind of a generated piece, it says where the piece can be placed */
+        enum Kind {
+            kLEAF, // single value or variable: it can be the left side of an implicit multiplication
+            kPAREN, // parenthesized expression: as kLEAF
+            kPOWER, // power: as kLEAF
+            kATOMIC, // function call or implicit multiplication: it can be the right side of an implicit multiplication
+            kEXPR // binary operation or unary minus: it must be parenthesized to be an operand of a power or implicit multiplication
+        };
+
+        unsigned long long state;
+        Shape shape;
+
+    public:
+        ExprGenerator(unsigned long long seed) {
+            state = seed * 2685821657736338717ULL + 0x9E3779B97F4A7C15ULL;
+            if (state == 0)
+                state = 1;
+        }
+
+        std::string generate(const Shape& shape) {
+            this->shape = shape;
+            if (this->shape.variables < 1)
+                this->shape.variables = 1;
+            if (this->shape.variables > sizeof(genVariables) - 1)
+                this->shape.variables = sizeof(genVariables) - 1;
+            Kind k;
+            return gen(shape.nodes, 0, &k);
+        }
+
+        /** xorshift64* */
+        unsigned long long next() {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return state * 2685821657736338717ULL;
+        }
+
+        /** uniform in [0, 1) */
+        double uniform() {
+            return (next() >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        /** uniform in [0, n) */
+        unsigned int below(unsigned int n) {
+            return (unsigned int) (uniform() * n);
+        }
+
+    private:
+
+        std::string value() {
+            char buf[16];
+            if (uniform() < 0.7)
+                sprintf(buf, "%u", 1 + below(9));
+            else
+                sprintf(buf, "%u.%u", below(10), 1 + below(9));
+            return buf;
+        }
+
+        std::string variable() {
+            return std::string(1, genVariables[below(shape.variables)]);
+        }
+
+        std::string leaf(Kind* k) {
+            *k = kLEAF;
+            return (uniform() < 0.5) ? value() : variable();
+        }
+
+        /* splits the budget of the operands */
+        void split(unsigned int budget, unsigned int* a, unsigned int* b) {
+            double f = (uniform() < 0.5) ? shape.skew : 1 - shape.skew;
+            *a = (unsigned int) (budget * f + 0.5);
+            if (*a < 1)
+                *a = 1;
+            if (*a >= budget)
+                *a = budget - 1;
+            *b = budget - *a;
+        }
+
+        std::string paren(const std::string& s) {
+            return "(" + s + ")";
+        }
+
+        /* something that can stay at the left side of an implicit multiplication */
+        std::string left(unsigned int budget, unsigned int depth) {
+            Kind k;
+            std::string s = gen(budget, depth, &k);
+            if (k == kLEAF || k == kPAREN || k == kPOWER)
+                return s;
+            return paren(s);
+        }
+
+        /* something that can stay at the right side of an implicit multiplication */
+        std::string atomic(unsigned int budget, unsigned int depth) {
+            Kind k;
+            std::string s = gen(budget, depth, &k);
+            if (k == kEXPR)
+                return paren(s);
+            return s;
+        }
+
+        /* concatenation that avoids to merge two numbers in a single token */
+        static std::string concat(const std::string& a, const std::string& b) {
+            char l = a[a.length() - 1];
+            char r = b[0];
+            if (l >= '0' && l <= '9' && r >= '0' && r <= '9')
+                return a + " " + b;
+            return a + b;
+        }
+
+        std::string function(unsigned int budget, unsigned int depth) {
+            static const char* unary[] = { "_sin", "_cos", "_atan", "_fabs", "_tanh", "_sqrt" };
+            static const char* binary[] = { "_hypot", "_atan2" };
+
+            if (budget < 3 || uniform() < 0.7) {
+                std::string s(unary[below(sizeof(unary) / sizeof(unary[0]))]);
+                Kind k;
+                return s + "(" + gen(budget - 1, depth + 1, &k) + ")";
+            }
+            unsigned int a, b;
+            split(budget - 1, &a, &b);
+            std::string s(binary[below(sizeof(binary) / sizeof(binary[0]))]);
+            Kind k;
+            std::string ris = s + "(" + gen(a, depth + 1, &k);
+            return ris + "," + gen(b, depth + 1, &k) + ")";
+        }
+
+        std::string power(unsigned int budget, unsigned int depth) {
+            static const char* exponents[] = { "2", "3", "-1", "0.5", "-(2)" };
+            std::string base;
+            if (budget <= 3) {
+                Kind k;
+                base = leaf(&k);
+            } else {
+                Kind k;
+                base = paren(gen(budget - 2, depth + 1, &k));
+            }
+            std::string exp = (uniform() < 0.8) ? exponents[below(sizeof(exponents) / sizeof(exponents[0]))] : variable();
+            return base + "^" + exp;
+        }
+
+        std::string gen(unsigned int budget, unsigned int depth, Kind* k) {
+            if (budget <= 1 || depth >= shape.maxDepth)
+                return leaf(k);
+
+            double r = uniform();
+
+            if ((r -= shape.functionRatio) < 0) {
+                *k = kATOMIC;
+                return function(budget, depth);
+            }
+
+            if ((r -= shape.powerRatio) < 0) {
+                *k = kPOWER;
+                return power(budget, depth);
+            }
+
+            unsigned int a, b;
+            split(budget - 1, &a, &b);
+
+            if ((r -= shape.implicitRatio) < 0) {
+                *k = kATOMIC;
+                return concat(left(a, depth + 1), atomic(b, depth + 1));
+            }
+
+            if ((r -= shape.unaryRatio) < 0) {
+                *k = kEXPR;
+                return "-" + atomic(budget - 2, depth + 1);
+            }
+
+            if ((r -= shape.conditionRatio) < 0) {
+                static const char* conds[] = { "<", "<=", ">", ">=", "==", "!=", "&&", "||" };
+                std::string cond(conds[below(sizeof(conds) / sizeof(conds[0]))]);
+                Kind lk, rk, ck;
+                std::string l = gen(a, depth + 1, &lk);
+                if (uniform() < 0.5) {
+                    *k = kEXPR;
+                    return l + cond + gen(b, depth + 1, &rk);
+                }
+                *k = kATOMIC;
+                return "_if(" + l + cond + leaf(&ck) + "," + gen(b, depth + 1, &rk) + "," + leaf(&ck) + ")";
+            }
+
+            static const char ops[] = { '+', '-', '*', '/' };
+            char op = ops[below(4)];
+            Kind lk, rk;
+            *k = kEXPR;
+            if (op == '/') /* constant non-zero divisor */
+                return gen(budget - 2, depth + 1, &lk) + "/" + value();
+            std::string l = gen(a, depth + 1, &lk);
+            return l + op + gen(b, depth + 1, &rk);
+        }
+    };
+
+} //end of namespace Bench
+
+#endif
@@ -0,0 +1,285 @@
+/*
+ * MExpr C++ Scaling Benchmarks
+ * Sweeps the shape of synthetic expressions and measures how parsing, compilation,
+ * stack size and evaluation grow
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <cstddef>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <MExpr.h>
+#include "benchmark.h"
+#include "exprgen.h"
+using namespace std;
+using namespace MExpr;
+
+/* expressions generated for every point of a sweep (with different seeds) */
+#define EXPRS_PER_POINT 4
+
+/*-- Cases on a set of expressions ------------------*/
+/* each case runs all the expressions of a point, the times are divided by the number of expressions */
+
+class ParseSetCase: public Bench::Case {
+    vector<string>* exprs;
+    vector<ASTNode*> trees;
+public:
+    ParseSetCase(vector<string>* exprs) {
+        this->exprs = exprs;
+    }
+    void run(unsigned long iterations) {
+        for (unsigned long i = 0; i < iterations; i++)
+            trees.push_back(MExpr_ParseExpression(&(*exprs)[i % exprs->size()]));
+    }
+    void tearDown() {
+        for (size_t i = 0; i < trees.size(); i++)
+            trees[i]->deleteTree();
+        trees.clear();
+    }
+};
+
+class CompileSetCase: public Bench::Case {
+    vector<ASTNode*>* trees;
+    vector<Code*> codes;
+public:
+    CompileSetCase(vector<ASTNode*>* trees) {
+        this->trees = trees;
+    }
+    void run(unsigned long iterations) {
+        for (unsigned long i = 0; i < iterations; i++)
+            codes.push_back(new Code((*trees)[i % trees->size()]));
+    }
+    void tearDown() {
+        for (size_t i = 0; i < codes.size(); i++)
+            delete codes[i];
+        codes.clear();
+    }
+};
+
+class EvaluateSetCase: public Bench::Case {
+    vector<Expression*>* exps;
+    bool tree;
+public:
+    EvaluateSetCase(vector<Expression*>* exps, bool tree) {
+        this->exps = exps;
+        this->tree = tree;
+    }
+    void run(unsigned long iterations) {
+        ValueType acc = 0;
+        for (unsigned long i = 0; i < iterations; i++)
+            acc += (*exps)[i % exps->size()]->evaluate(tree);
+        Bench::sink = acc;
+    }
+};
+
+/*-- Scaling point ----------------------------------*/
+
+typedef struct {
+    string sweep;
+    string param;
+    double value;
+    double nodes; /* mean nodes of the abstract syntax trees */
+    double depth; /* mean depth of the abstract syntax trees */
+    double stack; /* mean stack size of the compiled code */
+    double parseNs;
+    double compileNs;
+    double treeNs;
+    double codeNs;
+} Point;
+
+static unsigned int treeDepth(ASTNode* n) {
+    unsigned int d = 0;
+    for (unsigned int i = 0; i < n->countChildren(); i++) {
+        unsigned int c = treeDepth(n->getChild(i));
+        if (c > d)
+            d = c;
+    }
+    return d + 1;
+}
+
+/* median of a measure, 0 if it was filtered out */
+static double median(Bench::Result* r) {
+    return (r != NULL) ? r->medianNs : 0;
+}
+
+static Point measurePoint(Bench::Runner* runner, const string& sweep, const string& param, double value,
+        const Bench::Shape& shape) {
+    vector<string> exprs;
+    vector<ASTNode*> trees;
+    vector<Expression*> treeExps;
+    vector<Expression*> codeExps;
+    Point p;
+
+    p.sweep = sweep;
+    p.param = param;
+    p.value = value;
+    p.nodes = p.depth = p.stack = 0;
+
+    for (unsigned int i = 0; i < EXPRS_PER_POINT; i++) {
+        Bench::ExprGenerator gen(1000 * (unsigned long long) value + i + 1);
+        exprs.push_back(gen.generate(shape));
+        trees.push_back(MExpr_ParseExpression(&exprs.back()));
+
+        Code c(trees.back());
+        p.nodes += trees.back()->countNodes();
+        p.depth += treeDepth(trees.back());
+        p.stack += c.getStackSize();
+
+        Expression* te = new Expression(exprs.back());
+        Expression* ce = new Expression(exprs.back());
+        for (unsigned int v = 0; v < shape.variables && v < sizeof(Bench::genVariables) - 1; v++) {
+            te->setVariable(Bench::genVariables[v], 0.5 + v * 0.01);
+            ce->setVariable(Bench::genVariables[v], 0.5 + v * 0.01);
+        }
+        ce->compile();
+        treeExps.push_back(te);
+        codeExps.push_back(ce);
+    }
+    p.nodes /= EXPRS_PER_POINT;
+    p.depth /= EXPRS_PER_POINT;
+    p.stack /= EXPRS_PER_POINT;
+
+    char name[64];
+    sprintf(name, "%s=%g", param.c_str(), value);
+    string desc = exprs[0].length() > 60 ? exprs[0].substr(0, 57) + "..." : exprs[0];
+
+    ParseSetCase pc(&exprs);
+    CompileSetCase cc(&trees);
+    EvaluateSetCase tc(&treeExps, true);
+    EvaluateSetCase ec(&codeExps, false);
+
+    p.parseNs = median(runner->measure(sweep + "/parse", name, desc, &pc));
+    p.compileNs = median(runner->measure(sweep + "/compile", name, desc, &cc));
+    p.treeNs = median(runner->measure(sweep + "/eval-tree", name, desc, &tc));
+    p.codeNs = median(runner->measure(sweep + "/eval-code", name, desc, &ec));
+
+    for (unsigned int i = 0; i < EXPRS_PER_POINT; i++) {
+        trees[i]->deleteTree();
+        delete treeExps[i];
+        delete codeExps[i];
+    }
+    return p;
+}
+
+static bool writeCurves(const char* path, const vector<Point>& points) {
+    FILE* f = fopen(path, "w");
+    if (f == NULL)
+        return false;
+    fprintf(f, "sweep,param,value,nodes,depth,stack,parse_ns,compile_ns,eval_tree_ns,eval_code_ns\n");
+    for (size_t i = 0; i < points.size(); i++) {
+        const Point& p = points[i];
+        fprintf(f, "%s,%s,%g,%.1f,%.1f,%.1f,%.2f,%.2f,%.2f,%.2f\n", p.sweep.c_str(), p.param.c_str(), p.value, p.nodes,
+                p.depth, p.stack, p.parseNs, p.compileNs, p.treeNs, p.codeNs);
+    }
+    fclose(f);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Bench::Runner runner;
+    const char* jsonPath = NULL;
+    const char* csvPath = NULL;
+    vector<Point> points;
+
+    runner.samples = 11;
+    runner.warmupMs = 10;
+
+    /* -c file.csv is specific to this driver, the other options are the common ones */
+    vector<char*> args;
+    args.push_back(argv[0]);
+    for (int i = 1; i < argc; i++) {
+        if (string(argv[i]) == "-c" && i + 1 < argc)
+            csvPath = argv[++i];
+        else
+            args.push_back(argv[i]);
+    }
+    if (!runner.parseArgs((int) args.size(), &args[0], &jsonPath)) {
+        fprintf(stderr, "usage: %s [-o file.json] [-c curves.csv] [-r samples] [-t sample_ms] [-f filter]\n", argv[0]);
+        return 1;
+    }
+
+    try {
+        runner.printHeader();
+
+        /* size: balanced trees with more and more nodes */
+        unsigned int sizes[] = { 16, 64, 256, 1024, 4096, 16384 };
+        for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            Bench::Shape s;
+            s.nodes = sizes[i];
+            points.push_back(measurePoint(&runner, "size", "nodes", sizes[i], s));
+        }
+
+        /* depth: same size, from balanced trees to long chains */
+        double skews[] = { 0.5, 0.3, 0.1, 0.03, 0 };
+        for (unsigned int i = 0; i < sizeof(skews) / sizeof(skews[0]); i++) {
+            Bench::Shape s;
+            s.nodes = 1024;
+            s.skew = skews[i];
+            points.push_back(measurePoint(&runner, "depth", "skew", skews[i], s));
+        }
+
+        /* function calls: same size, more and more calls */
+        double functions[] = { 0, 0.1, 0.25, 0.5 };
+        for (unsigned int i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+            Bench::Shape s;
+            s.nodes = 1024;
+            s.functionRatio = functions[i];
+            points.push_back(measurePoint(&runner, "functions", "ratio", functions[i], s));
+        }
+
+        /* variables: same size, more and more distinct variables */
+        unsigned int vars[] = { 1, 4, 16, 52 };
+        for (unsigned int i = 0; i < sizeof(vars) / sizeof(vars[0]); i++) {
+            Bench::Shape s;
+            s.nodes = 1024;
+            s.variables = vars[i];
+            points.push_back(measurePoint(&runner, "variables", "count", vars[i], s));
+        }
+
+    } catch (Error& ex) {
+        fprintf(stderr, "Err: %s\n", ex.what());
+        return 1;
+    }
+
+    printf("\n%-10s %-12s %9s %7s %7s %12s %12s %12s %12s\n", "sweep", "value", "nodes", "depth", "stack", "parse",
+            "compile", "eval-tree", "eval-code");
+    for (size_t i = 0; i < points.size(); i++) {
+        const Point& p = points[i];
+        printf("%-10s %-12g %9.0f %7.0f %7.0f %9.0f ns %9.0f ns %9.0f ns %9.0f ns\n", p.sweep.c_str(), p.value, p.nodes,
+                p.depth, p.stack, p.parseNs, p.compileNs, p.treeNs, p.codeNs);
+    }
+
+    if (csvPath != NULL && !writeCurves(csvPath, points)) {
+        fprintf(stderr, "can't write %s\n", csvPath);
+        return 1;
+    }
+    if (jsonPath != NULL && !runner.writeJSON(jsonPath, "mexpr-scaling")) {
+        fprintf(stderr, "can't write %s\n", jsonPath);
+        return 1;
+    }
+
+    return 0;
+}
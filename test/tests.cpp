@@ -25,8 +25,13 @@
  *
  */
 
+#include <unistd.h>
+#include <pthread.h>
 #include <gtest/gtest.h>
 #include <MExpr.h>
+#include <MExprVecMath.h>
+#include <MExprOptimizer.h>
+#include "exprgen.h"
 
 using namespace std;
 using namespace MExpr;
@@ -129,6 +134,88 @@ TEST(TestUnaryOp, TestUnaryOp) {
     ASSERT_ANY_THROW(valueOfExpr("--4"));
 }
 
+TEST(TestConditions, TestComparisons) {
+    EXPECT_EQ(1, valueOfExpr("1 < 2"));
+    EXPECT_EQ(0, valueOfExpr("2 <= 1"));
+    EXPECT_EQ(1, valueOfExpr("2 > -1"));
+    EXPECT_EQ(1, valueOfExpr("2 >= 2"));
+    EXPECT_EQ(1, valueOfExpr("1 + 1 == 2")); /* lower precedence than the arithmetic */
+    EXPECT_EQ(0, valueOfExpr("2 != 2"));
+    EXPECT_EQ(1, valueOfExpr("1 < 2 == 2 < 3"));
+    EXPECT_EQ(0, valueOfExpr("0 || 2 && 0")); /* && before || */
+    EXPECT_EQ(1, valueOfExpr("-0.5 || 0"));
+    EXPECT_EQ(0, valueOfExpr("(0 - 1)^0.5 == (0 - 1)^0.5")); /* NaN */
+
+    Expression* e = new Expression("x >= 0 && x <= 1");
+    e->setVariable('x', 0.5);
+    EXPECT_EQ(1, e->evaluate());
+    e->setVariable('x', 2);
+    EXPECT_EQ(0, e->evaluate());
+    e->compile();
+    EXPECT_EQ(0, e->evaluate());
+    delete e;
+}
+
+TEST(TestConditions, TestSelect) {
+    Expression* e = new Expression("_if(x != 0, 1/x, 0) + _if(x < 0, -x, x)");
+    e->setVariable('x', 0);
+    EXPECT_EQ(0, e->evaluate()); /* the division by zero is discarded by the select */
+    e->setVariable('x', -2);
+    EXPECT_EQ(1.5, e->evaluate());
+    e->setIncrementalEvaluation(true);
+    EXPECT_EQ(1.5, e->evaluate());
+    e->setVariable('x', 0);
+    EXPECT_EQ(0, e->evaluate());
+    e->setIncrementalEvaluation(false);
+    e->compile(true);
+    EXPECT_EQ(0, e->evaluate());
+    string* s = e->getExprCodeString();
+    EXPECT_NE(string::npos, s->find("DIV: guarded"));
+    EXPECT_NE(string::npos, s->find("SEL"));
+    delete s;
+    delete e;
+
+    e = new Expression("_if(1/x, 1, 2)"); /* the condition is not guarded */
+    e->setVariable('x', 0);
+    EXPECT_THROW(e->evaluate(), Error);
+    e->compile();
+    EXPECT_THROW(e->evaluate(), Error);
+    delete e;
+
+    e = new Expression("_if(x < 1, 2, 3)");
+    s = e->getExprTreeString();
+    EXPECT_EQ("[ if ]─[ < ]─[ x ]\n  │      └───[ 1 ]\n  ├────[ 2 ]\n  └────[ 3 ]\n", *s);
+    delete s;
+    delete e;
+
+    EXPECT_THROW(valueOfExpr("_if(1, 2)"), Error); /* only the _if with three arguments is the select */
+}
+
+TEST(TestConditions, TestBatch) {
+    Expression* e = new Expression("_if(x < 50 || x > 250, _sqrt(x), x/(x - 100)) + (x > 900)");
+    const size_t rows = 1000;
+    vector<ValueType> xs(rows), res(rows);
+    for (size_t i = 0; i < rows; i++)
+        xs[i] = i;
+
+    Batch b(rows);
+    b.setColumn('x', &xs[0]);
+    e->evaluateBatch(&b, &res[0]);
+    for (size_t i = 0; i < rows; i++) {
+        e->setVariable('x', xs[i]);
+        EXPECT_EQ(e->evaluate(true), res[i]);
+    }
+    EXPECT_EQ(sqrt(7.0), res[7]);
+    EXPECT_EQ(3, res[150]);
+    EXPECT_EQ(sqrt(901.0) + 1, res[901]);
+    EXPECT_TRUE(isinf(res[100])); /* the result of the division by zero is selected */
+
+    b.setScalar('x', 100); /* invariant division by zero */
+    e->evaluateBatch(&b, &res[0]);
+    EXPECT_TRUE(isinf(res[0]));
+    delete e;
+}
+
 TEST(TestImplicitMultiplications, TestVariables) {
     Expression* e = new Expression("xy");
     e->setVariable('x', 3);
@@ -209,6 +296,67 @@ TEST(TestFunctions, TestFunctionsOverload) {
     EXPECT_EQ(15, e->evaluate());
 }
 
+TEST(TestFunctions, TestStdFunctionsOverlay) {
+    /* the user functions hide the standard ones only in their environment */
+    Expression* e1 = new Expression("_sqrt(16)");
+    Expression* e2 = new Expression("_sqrt(16)");
+    e1->setFunction("_sqrt", &myfunc, 1);
+    EXPECT_EQ(48, e1->evaluate());
+    EXPECT_EQ(4, e2->evaluate());
+    delete e1;
+    delete e2;
+
+    Environment* env = new Environment();
+    EXPECT_FALSE(env->isSetFunction("_sin_1"));
+    env->setStdFunctions(true);
+    EXPECT_TRUE(env->isSetFunction("_sin_1"));
+    EXPECT_TRUE(env->isSetFunction(Environment::getMangledName("_atan2", 2)));
+    EXPECT_FALSE(env->isSetFunction("_sin_2"));
+    EXPECT_FALSE(env->isSetFunction("_unknown_1"));
+    unsigned long long version = env->getVersion();
+    env->setStdFunctions(false);
+    EXPECT_EQ(Environment::FUNCTIONS_BIT, env->getChangedMask(version));
+    EXPECT_FALSE(env->isSetFunction("_sin_1"));
+    delete env;
+}
+
+ValueType typedSquare(ValueType x) {
+    return x * x;
+}
+
+ValueType typedSum(const ValueType* args, unsigned int numArgs) {
+    ValueType sum = 0;
+    for (unsigned int i = 0; i < numArgs; i++)
+        sum += args[i];
+    return sum;
+}
+
+TEST(TestFunctions, TestTypedFunctions) {
+    Expression* e = new Expression("_sq(x) + _pow2(x, 3) - _sum(x, 1, 2, 3) + _sqrt(x)");
+    e->setFunction("_sq", &typedSquare);
+    e->setFunction("_pow2", &pow, fnCONST); /* a function of math.h */
+    e->setFunction("_sum", &typedSum, 4);
+    e->setVariable('x', 4);
+    ValueType expected = 16 + 64 - 10 + 2;
+    EXPECT_EQ(expected, e->evaluate());
+    e->compile();
+    EXPECT_EQ(expected, e->evaluate());
+
+    const size_t rows = 300;
+    vector<ValueType> xs(rows), res(rows);
+    for (size_t i = 0; i < rows; i++)
+        xs[i] = i;
+    Batch b(rows);
+    b.setColumn('x', &xs[0]);
+    e->evaluateBatch(&b, &res[0]);
+    for (size_t i = 0; i < rows; i++)
+        EXPECT_DOUBLE_EQ(1.0 * i * i + i * i * i - i - 6 + sqrt((double) i), res[i]);
+
+    e->setFunction("_sq", &myfunc, 1); /* the stack functions are still supported */
+    EXPECT_EQ(12 + 64 - 10 + 2, e->evaluate());
+    delete e;
+}
+
 TEST(GenericTest, Test1) {
     Expression* e = new Expression("-3(4xy^2x-2x)(8x^-(3x)+2y^-2)");
     e->setVariable('x', 4);
@@ -220,6 +368,1290 @@ TEST(GenericTest, Test2) {
     EXPECT_NEAR(64.1457, valueOfExpr("+2+3*5+2-2*3+(7^-3-8+5)-4+(3/3)+2*5-6-(9-(3^4)+6)-6+8/7-8"), 0.0001);
 }
 
+static size_t countOccurrences(const string& s, const string& sub) {
+    size_t n = 0;
+    for (size_t p = s.find(sub); p != string::npos; p = s.find(sub, p + 1))
+        n++;
+    return n;
+}
+
+TEST(TestCode, TestPools) {
+    string expr("_sin(x)*2 + _sin(y)*2 - 2/_cos(x) + 3x^2");
+    ASTNode* ast = MExpr_ParseExpression(&expr);
+    Environment env;
+    env.setStdFunctions(true);
+    env.setVar('x', 0.5);
+    env.setVar('y', -1.25);
+    ValueType expected = ast->evaluate(&env);
+    Code* code = new Code(ast);
+    string* s = code->getCodeString();
+    EXPECT_EQ(4u, countOccurrences(*s, "VAL: 2\n"));
+    EXPECT_EQ(2u, countOccurrences(*s, "FUN: _sin_1\n"));
+    delete s;
+    EXPECT_LE(code->getCodeBytes(), code->getCodeSize() * sizeof(Instruction)); /* 2 pooled constants and 2 names */
+
+    ast->deleteTree(); /* the code doesn't refer to the tree */
+    EXPECT_EQ(expected, code->evaluate(&env));
+    Code* clone = code->clone();
+    delete code;
+    EXPECT_EQ(expected, clone->evaluate(&env));
+    delete clone;
+
+    /* the constants are shared by the instructions */
+    expr = "2x^2y + 2x*y^2 - 2y + 2x - 2";
+    ast = MExpr_ParseExpression(&expr);
+    code = new Code(ast);
+    EXPECT_LE(code->getCodeBytes() * 2, code->getCodeSize() * sizeof(Instruction));
+    delete code;
+    ast->deleteTree();
+}
+
+TEST(TestProfile, TestCounters) {
+    Expression* e = new Expression("_sqrt(x) + 2x");
+    e->setVariable('x', 4);
+    e->compile();
+    for (int i = 0; i < 10; i++)
+        EXPECT_EQ(10, e->evaluate());
+
+    ProfileType* p = e->getExprProfile();
+    if (p == NULL)
+        return; // library compiled without MEXPR_PROFILE
+
+    EXPECT_EQ(10, p->evaluations);
+    ASSERT_EQ(6, p->entries.size());
+    int functions = 0; //found by type, the order of the operands depends on the optimizations
+    for (size_t i = 0; i < p->entries.size(); i++) {
+        EXPECT_EQ(10, p->entries[i].counter.count);
+        EXPECT_LE(p->entries[i].counter.callCycles, p->entries[i].counter.cycles);
+        if (p->entries[i].instruction.type == iFUN)
+            functions++;
+    }
+    EXPECT_EQ(1, functions);
+    delete p;
+
+    string* s = e->getExprProfileString();
+    EXPECT_NE(string::npos, s->find("FUN: _sqrt_1"));
+    delete s;
+}
+
+TEST(TestTelemetry, TestHistogram) {
+    Histogram h;
+    EXPECT_EQ(0, h.getPercentile(50));
+    for (unsigned long long v = 1; v <= 1000; v++)
+        h.record(v);
+    EXPECT_EQ(1000, h.getCount());
+    EXPECT_EQ(1, h.getMin());
+    EXPECT_EQ(1000, h.getMax());
+    EXPECT_NEAR(500.5, h.getMean(), 0.001);
+    /* the relative error of the log-linear buckets is at most 1/8 */
+    EXPECT_NEAR(500, h.getPercentile(50), 500 / 8.0);
+    EXPECT_NEAR(990, h.getPercentile(99), 990 / 8.0);
+    EXPECT_EQ(1000, h.getPercentile(100));
+
+    Histogram m;
+    m.record(123456789);
+    m.merge(h);
+    EXPECT_EQ(1001, m.getCount());
+    EXPECT_EQ(123456789, m.getMax());
+    for (unsigned int b = 0; b < Histogram::BUCKETS; b++) {
+        EXPECT_EQ(b, Histogram::bucketIndex(Histogram::bucketLow(b)));
+        EXPECT_EQ(b, Histogram::bucketIndex(Histogram::bucketHigh(b)));
+    }
+}
+
+TEST(TestTelemetry, TestExpression) {
+    Expression* e = new Expression("x^2 + 1");
+    Histogram* h = e->getExprLatency(Telemetry::EVALUATE);
+    if (h == NULL) {
+        ASSERT_FALSE(Telemetry::isCompiled());
+        delete e;
+        return;
+    }
+    delete h;
+
+    e->setVariable('x', 3);
+    e->compile();
+    for (int i = 0; i < 100; i++)
+        EXPECT_EQ(10, e->evaluate());
+
+    h = e->getExprLatency(Telemetry::EVALUATE);
+    EXPECT_EQ(100, h->getCount());
+    EXPECT_LE(h->getPercentile(50), h->getPercentile(99.9));
+    delete h;
+    h = e->getExprLatency(Telemetry::PARSE);
+    EXPECT_EQ(1, h->getCount());
+    delete h;
+
+    TelemetrySnapshot* s = Telemetry::snapshot();
+    EXPECT_GT(s->cyclesPerNs, 0);
+    EXPECT_GE(s->getLatency(0, Telemetry::EVALUATE).getCount(), 100);
+    bool found = false;
+    for (size_t i = 1; i < s->exprs.size(); i++) {
+        if (s->exprs[i] == "x^2 + 1") {
+            found = true;
+            EXPECT_EQ(1, s->getLatency(i, Telemetry::COMPILE).getCount());
+        }
+    }
+    EXPECT_TRUE(found);
+    delete s;
+    delete e;
+}
+
+static int countedCalls = 0;
+
+void countedSqrt(StackType* s) {
+    countedCalls++;
+    s->stack[s->stp - 1] = sqrt(s->stack[s->stp - 1]);
+}
+
+TEST(TestBatch, TestColumns) {
+    Expression* e = new Expression("x*y + _sqrt(x) - c/2 + _hypot(x, 3)");
+    const size_t rows = 1000; /* more than one block */
+    vector<ValueType> xs(rows), ys(rows), res(rows);
+    for (size_t i = 0; i < rows; i++) {
+        xs[i] = i * 0.5;
+        ys[i] = 3.0 - i;
+    }
+    e->setVariable('c', 7);
+
+    Batch b(rows);
+    b.setColumn('x', &xs[0]);
+    b.setColumn('y', &ys[0]);
+    e->evaluateBatch(&b, &res[0]);
+
+    for (size_t i = 0; i < rows; i++) {
+        e->setVariable('x', xs[i]);
+        e->setVariable('y', ys[i]);
+        EXPECT_EQ(e->evaluate(), res[i]);
+    }
+
+    b.setColumn('y', NULL); /* y from the environment */
+    e->setVariable('y', 2);
+    e->evaluateBatch(&b, &res[0]);
+    EXPECT_EQ(xs[10] * 2 + sqrt(xs[10]) - 3.5 + hypot(xs[10], 3), res[10]);
+    delete e;
+
+    e = new Expression("1/x");
+    EXPECT_THROW(e->evaluateBatch(&b, &res[0]), Error); /* x = 0 in the first row */
+    delete e;
+}
+
+struct TestRow {
+    ValueType price;
+    int id;
+    ValueType qty;
+};
+
+TEST(TestBatch, TestStridedColumns) {
+    Expression* e = new Expression("x*y + c");
+    const size_t rows = 600;
+    vector<TestRow> data(rows);
+    vector<ValueType> res(rows);
+    for (size_t i = 0; i < rows; i++) {
+        data[i].price = i * 0.25;
+        data[i].id = i;
+        data[i].qty = 10.0 - i;
+    }
+    ValueType c = 2;
+    e->bindVariable('c', &c);
+
+    Batch b(rows);
+    b.setColumn('x', &data[0].price, sizeof(TestRow));
+    b.setColumn('y', &data[0].qty, sizeof(TestRow));
+    e->evaluateBatch(&b, &res[0]);
+    for (size_t i = 0; i < rows; i++)
+        EXPECT_EQ(data[i].price * data[i].qty + 2, res[i]);
+
+    c = 3; /* read again by the next batch */
+    e->evaluateBatch(&b, &res[0]);
+    EXPECT_EQ(data[7].price * data[7].qty + 3, res[7]);
+    delete e;
+}
+
+TEST(TestBatch, TestInvariants) {
+    Expression* e = new Expression("_exp(r*t) * x + y/_csqrt(r) - 2^3");
+    e->setFunction("_csqrt", &countedSqrt, 1);
+    e->setVariable('y', 3);
+    e->setVariable('r', 100); /* the scalar of the batch wins */
+    const size_t rows = 300;
+    vector<ValueType> xs(rows), res(rows);
+    for (size_t i = 0; i < rows; i++)
+        xs[i] = i;
+
+    Batch b(rows);
+    b.setColumn('x', &xs[0]);
+    b.setScalar('r', 0.25);
+    b.setScalar('t', 2);
+    countedCalls = 0;
+    e->evaluateBatch(&b, &res[0]);
+    EXPECT_EQ(rows, countedCalls); /* not a standard function: called for every row */
+    for (size_t i = 0; i < rows; i++)
+        EXPECT_DOUBLE_EQ(exp(0.5) * i + 3 / sqrt(0.25) - 8, res[i]);
+
+    b.setScalar('x', 1); /* everything is invariant */
+    e->evaluateBatch(&b, &res[0]);
+    EXPECT_DOUBLE_EQ(exp(0.5) + 6 - 8, res[rows - 1]);
+
+    b.unbind('t');
+    EXPECT_THROW(e->evaluateBatch(&b, &res[0]), Error);
+    delete e;
+}
+
+static int batchCalls = 0;
+
+void batchSqrt(const ValueType* const* args, ValueType* out, size_t n) {
+    batchCalls++;
+    for (size_t i = 0; i < n; i++)
+        out[i] = sqrt(args[0][i]);
+}
+
+void batchHypot(const ValueType* const* args, ValueType* out, size_t n) {
+    batchCalls++;
+    for (size_t i = 0; i < n; i++)
+        out[i] = hypot(args[0][i], args[1][i]);
+}
+
+TEST(TestBatch, TestBatchFunctions) {
+    Expression* e = new Expression("_csqrt(x) + _hypot(x, y) * 2");
+    e->setFunction("_csqrt", &countedSqrt, 1); /* not vectorizable, but the batch version is */
+    EXPECT_THROW(e->setBatchFunction("_csqrt", 2, &batchSqrt), Error);
+    e->setBatchFunction("_csqrt", 1, &batchSqrt);
+    e->setBatchFunction("_hypot", 2, &batchHypot); /* a standard function */
+    e->setVariable('y', 3);
+    const size_t rows = 600;
+    vector<ValueType> xs(rows), res(rows);
+    for (size_t i = 0; i < rows; i++)
+        xs[i] = i;
+
+    Batch b(rows);
+    b.setColumn('x', &xs[0]);
+    countedCalls = 0;
+    batchCalls = 0;
+    e->evaluateBatch(&b, &res[0]);
+    EXPECT_EQ(0, countedCalls);
+    EXPECT_EQ(6, batchCalls); /* two calls for each block */
+    for (size_t i = 0; i < rows; i++)
+        EXPECT_DOUBLE_EQ(sqrt((double) i) + hypot((double) i, 3) * 2, res[i]);
+
+    e->setVariable('x', 4); /* the other evaluations use the scalar version */
+    EXPECT_EQ(12, e->evaluate());
+    EXPECT_EQ(1, countedCalls);
+
+    e->setFunction("_csqrt", &countedSqrt, 1); /* the batch version is removed */
+    countedCalls = 0;
+    e->evaluateBatch(&b, &res[0]);
+    EXPECT_EQ(rows, countedCalls);
+    delete e;
+}
+
+TEST(TestBatch, TestReduction) {
+    Expression* e = new Expression("x*0.1 - 3");
+    const size_t rows = 100003; /* not a multiple of the blocks */
+    vector<ValueType> xs(rows), res(rows);
+    long double exact = 0;
+    for (size_t i = 0; i < rows; i++) {
+        xs[i] = (i * 7919) % rows;
+        exact += xs[i] * 0.1 - 3;
+    }
+
+    Batch b(rows);
+    b.setColumn('x', &xs[0]);
+    Reduction r(Reduction::ALL, 30);
+    e->evaluateBatch(&b, &r);
+    EXPECT_EQ(rows, r.getRows());
+    EXPECT_NEAR((double) exact, r.getSum(), fabs((double) exact) * 1e-15);
+    EXPECT_DOUBLE_EQ((double) (exact / rows), r.getMean());
+    EXPECT_DOUBLE_EQ(-3, r.getMin());
+    EXPECT_DOUBLE_EQ((rows - 1) * 0.1 - 3, r.getMax());
+    EXPECT_EQ(rows - 331, r.getCountAbove()); /* results greater than 30: x > 330 */
+
+    /* the same sum bit by bit, however the rows are added */
+    e->evaluateBatch(&b, &res[0]);
+    Reduction rowByRow(Reduction::SUM);
+    for (size_t i = 0; i < rows; i++)
+        rowByRow.add(&res[i], 1);
+    EXPECT_EQ(r.getSum(), rowByRow.getSum());
+    EXPECT_TRUE(isnan(rowByRow.getMin())); /* not computed */
+
+    delete e;
+    e = new Expression("_csqrt(x*x) * 0.1 - 3"); /* not vectorizable: evaluated row by row */
+    e->setFunction("_csqrt", &countedSqrt, 1);
+    Reduction notVectorized(Reduction::SUM | Reduction::MAX);
+    e->evaluateBatch(&b, &notVectorized);
+    EXPECT_EQ(r.getSum(), notVectorized.getSum());
+    EXPECT_EQ(r.getMax(), notVectorized.getMax());
+
+    /* the rows of two batches are added together */
+    b.setRows(rows / 2);
+    notVectorized.reset();
+    e->evaluateBatch(&b, &notVectorized);
+    EXPECT_EQ(rows / 2, notVectorized.getRows());
+    e->evaluateBatch(&b, &notVectorized);
+    EXPECT_EQ(rows / 2 * 2, notVectorized.getRows());
+    delete e;
+}
+
+TEST(TestGrid, TestSeparable) {
+    Expression* e = new Expression("_csqrt(x)*_csqrt(y+1) + xy - _sin(x)*_exp(-y^2)");
+    e->setFunction("_csqrt", &countedSqrt, 1, fnPURE);
+    const size_t nx = 70, ny = 300;
+    vector<ValueType> xs(nx), ys(ny), res(nx * ny);
+    for (size_t i = 0; i < nx; i++)
+        xs[i] = i * 0.5;
+    for (size_t j = 0; j < ny; j++)
+        ys[j] = j * 0.01 - 1;
+
+    Grid g;
+    g.addAxis('x', &xs[0], nx);
+    g.addAxis('y', &ys[0], ny);
+    EXPECT_EQ(nx * ny, g.getCells());
+    countedCalls = 0;
+    e->evaluateGrid(&g, &res[0]);
+    EXPECT_EQ((int) (nx + ny), countedCalls); /* once for each value of the axes, not for each cell */
+
+    for (size_t i = 0; i < nx; i += 7) {
+        for (size_t j = 0; j < ny; j += 13) {
+            e->setVariable('x', xs[i]);
+            e->setVariable('y', ys[j]);
+            EXPECT_DOUBLE_EQ(e->evaluate(), res[i * ny + j]);
+        }
+    }
+
+    e->setFunction("_csqrt", &countedSqrt, 1); /* not pure: called for each cell */
+    countedCalls = 0;
+    e->evaluateGrid(&g, &res[0]);
+    EXPECT_EQ((int) (2 * nx * ny), countedCalls);
+    e->setVariable('x', xs[3]);
+    e->setVariable('y', ys[5]);
+    EXPECT_DOUBLE_EQ(e->evaluate(), res[3 * ny + 5]);
+    delete e;
+}
+
+TEST(TestGrid, TestAxes) {
+    Expression* e = new Expression("_csqrt(x+a) + _csqrt(y)*z - _csqrt(z+1)/(x+y+z)");
+    e->setFunction("_csqrt", &countedSqrt, 1, fnPURE);
+    e->setVariable('a', 2); /* not an axis: the value of the environment */
+    ValueType xs[] = { 1, 2, 3 }, ys[] = { 4, 5 }, zs[] = { 6, 7, 8, 9 }, res[24];
+
+    Grid g;
+    g.addAxis('x', xs, 3);
+    g.addAxis('y', zs, 4);
+    g.addAxis('z', zs, 4);
+    g.addAxis('y', ys, 2); /* replaces the axis, that stays the second */
+    EXPECT_EQ(3u, g.getAxes());
+    EXPECT_EQ('y', g.getAxisVariable(1));
+    EXPECT_EQ(24u, g.getCells());
+    countedCalls = 0;
+    e->evaluateGrid(&g, res);
+    EXPECT_EQ(3 + 2 + 4, countedCalls);
+
+    for (size_t i = 0; i < 3; i++) {
+        for (size_t j = 0; j < 2; j++) {
+            for (size_t k = 0; k < 4; k++) {
+                e->setVariable('x', xs[i]);
+                e->setVariable('y', ys[j]);
+                e->setVariable('z', zs[k]);
+                EXPECT_DOUBLE_EQ(e->evaluate(), res[(i * 2 + j) * 4 + k]);
+            }
+        }
+    }
+
+    EXPECT_THROW(g.addAxis('1', xs, 3), Error);
+    g.addAxis('y', ys, 0); /* no cells */
+    EXPECT_EQ(0u, g.getCells());
+    e->evaluateGrid(&g, res);
+    g.clear();
+    e->evaluateGrid(&g, res); /* a single cell */
+    EXPECT_DOUBLE_EQ(e->evaluate(), res[0]);
+    delete e;
+}
+
+/* error of a result in units in the last place of the exact value */
+static double ulpError(double result, long double exact) {
+    if (result == (double) exact)
+        return 0;
+    int e;
+    frexpl(exact, &e);
+    return (double) (fabsl(result - exact) / ldexpl(1, e - 53));
+}
+
+TEST(TestVecMath, TestAccuracy) {
+    typedef void (*VecFunction)(const ValueType*, ValueType*, size_t, MathAccuracy);
+    VecFunction vf[] = { &VecMath::vexp, &VecMath::vlog, &VecMath::vsin, &VecMath::vcos, &VecMath::vtanh };
+    long double (*exact[])(long double) = { &expl, &logl, &sinl, &cosl, &tanhl };
+    double (*scalar[])(double) = { &exp, &log, &sin, &cos, &tanh };
+    const double range[] = { 750, 1e10, 1e5, 1e5, 25 };
+    const double special[] = { 0.0, -0.0, 1e-310, -1.0, 709.9, -800, 1e6, 1e300, INFINITY, -INFINITY, NAN };
+    const size_t n = 100000;
+    vector<ValueType> x(n), y(n);
+
+    for (int f = 0; f < 5; f++) {
+        srand(f);
+        for (size_t i = 0; i < n; i++) {
+            double r = (i % 2) ? range[f] : 2; //also small arguments
+            x[i] = (f == 1) ? r * rand() / RAND_MAX : r * (2.0 * rand() / RAND_MAX - 1);
+        }
+        for (int a = mathULP1; a <= mathFAST; a++) {
+            vf[f](&x[0], &y[0], n, (MathAccuracy) a);
+            double maxError = 0;
+            for (size_t i = 0; i < n; i++)
+                maxError = max(maxError, ulpError(y[i], exact[f](x[i])));
+            EXPECT_LE(maxError, (a == mathULP1) ? 1 : 4) << "function " << f << ", accuracy " << a;
+
+            /* out of the range of the kernels: the results of math.h */
+            vf[f](special, &y[0], sizeof(special) / sizeof(double), (MathAccuracy) a);
+            for (size_t i = 0; i < sizeof(special) / sizeof(double); i++) {
+                double s = scalar[f](special[i]);
+                if (isnan(s))
+                    EXPECT_TRUE(isnan(y[i]));
+                else
+                    EXPECT_LE(ulpError(y[i], s), 1) << "function " << f << ", x = " << special[i];
+                if (s == 0)
+                    EXPECT_EQ(signbit(s), signbit(y[i]));
+            }
+        }
+    }
+}
+
+TEST(TestVecMath, TestBatch) {
+    Environment* env = new Environment(); //deleted by the expression
+    env->setStdFunctions(true);
+    Expression* e = new Expression("_exp(x/10) + _sin(x) * _log(x) - _tanh(_cos(x))", env);
+    e->compile();
+    const size_t rows = 600;
+    vector<ValueType> xs(rows), res(rows);
+    for (size_t i = 0; i < rows; i++)
+        xs[i] = 0.5 + i;
+    Batch b(rows);
+    b.setColumn('x', &xs[0]);
+
+    EXPECT_EQ(mathACCURATE, env->getMathAccuracy());
+    e->evaluateBatch(&b, &res[0]);
+    for (size_t i = 0; i < rows; i++) { //the same results of evaluate
+        e->setVariable('x', xs[i]);
+        EXPECT_EQ(e->evaluate(), res[i]);
+    }
+
+    for (int a = mathULP1; a <= mathFAST; a++) {
+        e->setMathAccuracy((MathAccuracy) a); //the compiled expression uses the new functions
+        EXPECT_EQ(a, env->getMathAccuracy());
+        e->evaluateBatch(&b, &res[0]);
+        for (size_t i = 0; i < rows; i++) {
+            e->setVariable('x', xs[i]);
+            EXPECT_NEAR(e->evaluate(), res[i], 1e-12 * fabs(res[i]));
+        }
+    }
+    delete e;
+}
+
+TEST(TestCsv, TestEvaluate) {
+    const char* data = "x,name,y\n"
+            "1,\"a, b\",2\n"
+            "\n"
+            "-0.5, c ,1e3\r\n"
+            " 3 ,\"d\",0.1";
+    Expression* e = new Expression("x + 2y");
+    CsvEvaluator csv(e);
+    csv.setAppend(true);
+    csv.setPrecision(6);
+
+    FILE* f = tmpfile();
+    EXPECT_EQ(3, csv.evaluate(data, strlen(data), f));
+    rewind(f);
+    char buf[256];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = 0;
+    fclose(f);
+    EXPECT_STREQ("x,name,y,result\n1,\"a, b\",2,5\n-0.5, c ,1e3,1999.5\n 3 ,\"d\",0.1,3.2\n", buf);
+
+    /* columns by index and illegal numbers */
+    CsvEvaluator byIndex(e);
+    byIndex.setHeader(false);
+    byIndex.bindColumn('x', (size_t) 1);
+    byIndex.bindColumn('y', (size_t) 0);
+    const char* data2 = "1,2\n3,4\n5,x\n";
+    f = tmpfile();
+    EXPECT_THROW(byIndex.evaluate(data2, strlen(data2), f), Error);
+    EXPECT_EQ(3, byIndex.getLine());
+    EXPECT_EQ(2, byIndex.evaluate(data2, 8, f));
+    fclose(f);
+
+    CsvEvaluator missing(e);
+    missing.bindColumn('y', string("z"));
+    f = tmpfile();
+    EXPECT_THROW(missing.evaluate(data, strlen(data), f), Error);
+    fclose(f);
+    delete e;
+
+    /* the digits are limited to the ones of a double */
+    Expression* x = new Expression("x");
+    CsvEvaluator precise(x);
+    precise.setHeader(false);
+    precise.bindColumn('x', (size_t) 0);
+    precise.setPrecision(40);
+    const char* data3 = "-3e300\n";
+    f = tmpfile();
+    EXPECT_EQ(1, precise.evaluate(data3, strlen(data3), f));
+    rewind(f);
+    n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = 0;
+    fclose(f);
+    EXPECT_EQ(strlen(buf), n); //no zeros after the number
+    EXPECT_EQ(0, strncmp("-3.00000000000000", buf, 17));
+    EXPECT_STREQ("e+300\n", buf + n - 6);
+    delete x;
+}
+
+TEST(TestBulkLoader, TestLoad) {
+    BulkLoader loader(4);
+    loader.getEnvironment()->setFunction("_f", &myfunc, 1, fnPURE | fnCONST);
+    loader.getEnvironment()->setVar('y', 2);
+    Bench::ExprGenerator generator(7);
+    Bench::Shape shape;
+    shape.nodes = 40;
+    vector<string> exprs;
+    for (int i = 0; i < 1000; i++) {
+        if (i % 100 == 99)
+            exprs.push_back("3x + (2"); /* syntax errors */
+        else if (i % 100 == 50)
+            exprs.push_back("_f(y) * x + _f(4)");
+        else
+            exprs.push_back(generator.generate(shape));
+        EXPECT_EQ((size_t) i, loader.add(exprs[i]));
+    }
+    EXPECT_EQ(10u, loader.load());
+    EXPECT_EQ(1000u, loader.size());
+
+    for (size_t i = 0; i < exprs.size(); i++) {
+        Expression* e = loader.getExpression(i);
+        if (i % 100 == 99) {
+            EXPECT_TRUE(loader.hasError(i));
+            EXPECT_EQ(Error::syntaxError, loader.getError(i));
+            EXPECT_TRUE(e == NULL);
+            continue;
+        }
+        ASSERT_TRUE(e != NULL);
+        EXPECT_FALSE(loader.hasError(i));
+        EXPECT_EQ(exprs[i], loader.getString(i));
+        string* s = e->getExprCodeString();
+        EXPECT_TRUE(s != NULL); /* compiled */
+        delete s;
+        if (i % 100 == 50)
+            continue;
+
+        Expression expected(exprs[i]);
+        expected.setFunction("_f", &myfunc, 1);
+        for (char v = 'a'; v <= 'z'; v++) {
+            e->setVariable(v, 0.25 * (v - 'a') + 0.5);
+            expected.setVariable(v, 0.25 * (v - 'a') + 0.5);
+        }
+        ValueType r = expected.evaluate();
+        if (!isnan(r))
+            EXPECT_DOUBLE_EQ(r, e->evaluate());
+    }
+
+    /* the environment of the loader is copied, the loaded expressions don't share it */
+    Expression* e = loader.release(50);
+    EXPECT_TRUE(loader.getExpression(50) == NULL);
+    e->setVariable('x', 1);
+    loader.getExpression(150)->setVariable('x', 2);
+    EXPECT_EQ(18, e->evaluate());
+    EXPECT_EQ(24, loader.getExpression(150)->evaluate());
+    delete e;
+
+    /* the expressions added later are loaded by the next load, from a file */
+    char path[] = "/tmp/mexprXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    const char* file = "x+1\r\n\n2x\n_g(x)\n";
+    EXPECT_EQ((ssize_t) strlen(file), write(fd, file, strlen(file)));
+    close(fd);
+    EXPECT_EQ(3u, loader.addFile(path));
+    remove(path);
+    EXPECT_EQ(0u, loader.load()); /* an undefined function is not an error until the evaluation */
+    EXPECT_EQ(1003u, loader.size());
+    EXPECT_EQ("x+1", loader.getString(1000));
+    loader.getExpression(1001)->setVariable('x', 4);
+    EXPECT_EQ(8, loader.getExpression(1001)->evaluate());
+    EXPECT_THROW(loader.addFile("/nonexistent/expressions.txt"), Error);
+}
+
+struct CloneWork {
+    Expression* e;
+    ValueType x;
+    ValueType sum;
+};
+
+static void* evaluateClone(void* arg) {
+    CloneWork* w = (CloneWork*) arg;
+    w->sum = 0;
+    for (int i = 0; i < 20000; i++) {
+        w->e->setVariable('x', w->x + i);
+        w->sum += w->e->evaluate();
+    }
+    return NULL;
+}
+
+TEST(TestClone, TestSharedCode) {
+    Expression* e = new Expression("_csqrt(x + y) * 2 + _sin(_csqrt(x + y)) / (x*y - 1)");
+    e->setFunction("_csqrt", &countedSqrt, 1, fnPURE);
+    e->setVariable('y', 3);
+    e->compile();
+
+    Expression* c = e->clone();
+    string* s1 = e->getExprCodeString();
+    string* s2 = c->getExprCodeString();
+    EXPECT_EQ(*s1, *s2);
+    delete s1;
+    delete s2;
+
+    /* own variables */
+    e->setVariable('x', 1);
+    c->setVariable('x', 6);
+    EXPECT_DOUBLE_EQ(2 * 2 + sin(2.0) / 2, e->evaluate());
+    EXPECT_DOUBLE_EQ(3 * 2 + sin(3.0) / 17, c->evaluate());
+    c->setFunction("_csqrt", &myfunc, 1); /* own functions: the clone is optimized again */
+    EXPECT_DOUBLE_EQ(27 * 2 + sin(27.0) / 17, c->evaluate());
+    EXPECT_DOUBLE_EQ(2 * 2 + sin(2.0) / 2, e->evaluate());
+    delete c;
+
+    /* the tree and the code live until the last clone is deleted */
+    c = e->clone();
+    delete e;
+    c->setVariable('x', 6);
+    EXPECT_DOUBLE_EQ(3 * 2 + sin(3.0) / 17, c->evaluate());
+
+    /* the clones are evaluated by several threads at the same time */
+    c->setFunction("_csqrt", &sqrt, fnPURE | fnVECTORIZABLE);
+    CloneWork work[4];
+    pthread_t threads[4];
+    for (int t = 0; t < 4; t++) {
+        work[t].e = c->clone();
+        work[t].x = t * 0.5;
+        ASSERT_EQ(0, pthread_create(&threads[t], NULL, &evaluateClone, &work[t]));
+    }
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+        CloneWork single = work[t];
+        single.e = c;
+        evaluateClone(&single);
+        EXPECT_EQ(single.sum, work[t].sum);
+        delete work[t].e;
+    }
+    delete c;
+}
+
+TEST(TestClone, TestIncremental) {
+    Expression* e = new Expression("_csqrt(x) + y");
+    e->setFunction("_csqrt", &countedSqrt, 1, fnPURE);
+    e->setVariable('x', 16);
+    e->setVariable('y', 1);
+    e->setIncrementalEvaluation(true);
+    EXPECT_EQ(5, e->evaluate());
+
+    Expression* c = e->clone(); /* an own tree, with its own results */
+    EXPECT_TRUE(c->isIncrementalEvaluation());
+    c->setVariable('x', 9);
+    countedCalls = 0;
+    EXPECT_EQ(4, c->evaluate());
+    EXPECT_EQ(5, e->evaluate());
+    EXPECT_EQ(1, countedCalls);
+    delete e;
+    c->setVariable('y', 2);
+    EXPECT_EQ(5, c->evaluate());
+    EXPECT_EQ(1, countedCalls);
+    delete c;
+
+    /* the shared code is kept when the clone copies the tree */
+    e = new Expression("_csqrt(x) + y");
+    e->setFunction("_csqrt", &countedSqrt, 1, fnPURE);
+    e->setVariable('x', 16);
+    e->setVariable('y', 1);
+    e->compile();
+    c = e->clone();
+    c->setIncrementalEvaluation(true);
+    c->setIncrementalEvaluation(false);
+    string* s1 = e->getExprCodeString();
+    string* s2 = c->getExprCodeString();
+    ASSERT_TRUE(s2 != NULL);
+    EXPECT_EQ(*s1, *s2);
+    delete s1;
+    delete s2;
+    delete e;
+    EXPECT_EQ(5, c->evaluate());
+    delete c;
+}
+
+TEST(TestRegistry, TestPublish) {
+    Registry registry;
+    registry.getEnvironment()->setVar('k', 10);
+    EXPECT_EQ(1u, registry.publish("price", "x*2 + k"));
+
+    Registry::Reader reader(&registry);
+    EXPECT_TRUE(reader.get("volume") == NULL);
+    Expression* e = reader.get("price");
+    ASSERT_TRUE(e != NULL);
+    e->setVariable('x', 3);
+    EXPECT_EQ(16, e->evaluate());
+    EXPECT_EQ(e, reader.get("price")); /* the same version */
+
+    EXPECT_THROW(registry.publish("price", "x*(2 + k"), Error);
+    EXPECT_EQ(1u, registry.getVersion("price"));
+    EXPECT_EQ(2u, registry.publish("price", "x*3 + k"));
+    EXPECT_EQ(0u, registry.getRetiredCount()); /* no reader was cloning the old version */
+    e = reader.get("price");
+    e->setVariable('x', 3);
+    EXPECT_EQ(19, e->evaluate());
+
+    EXPECT_TRUE(registry.remove("price"));
+    EXPECT_FALSE(registry.remove("price"));
+    EXPECT_TRUE(reader.get("price") == NULL);
+    EXPECT_EQ(0u, registry.getVersion("price"));
+    EXPECT_EQ(4u, registry.publish("price", "x"));
+    EXPECT_TRUE(reader.get("price") != NULL);
+
+    /* a name got before it is published */
+    EXPECT_FALSE(registry.remove("volume"));
+    EXPECT_EQ(0u, registry.getVersion("volume"));
+    EXPECT_TRUE(reader.get("volume") == NULL);
+    EXPECT_EQ(5u, registry.publish("volume", "x + 1"));
+    EXPECT_TRUE(reader.get("volume") != NULL);
+}
+
+struct RegistryWork {
+    Registry* registry;
+    int evaluations;
+    int errors; /* results of a version older than the previous one */
+};
+
+static void* readRegistry(void* arg) {
+    RegistryWork* w = (RegistryWork*) arg;
+    Registry::Reader reader(w->registry);
+    ValueType last = 0;
+    w->errors = 0;
+    for (w->evaluations = 0; w->evaluations < 100000; w->evaluations++) {
+        Expression* e = reader.get("f");
+        e->setVariable('x', w->evaluations);
+        ValueType n = e->evaluate() - w->evaluations; /* the number published with the version */
+        if (n < last)
+            w->errors++;
+        last = n;
+    }
+    return NULL;
+}
+
+TEST(TestRegistry, TestLiveUpdates) {
+    Registry registry;
+    registry.publish("f", "x + 0");
+    RegistryWork work[4];
+    pthread_t threads[4];
+    for (int t = 0; t < 4; t++) {
+        work[t].registry = &registry;
+        ASSERT_EQ(0, pthread_create(&threads[t], NULL, &readRegistry, &work[t]));
+    }
+    for (int n = 1; n <= 300; n++) { /* the readers never wait for the writer */
+        stringstream expr;
+        expr << "x + " << n;
+        registry.publish("f", expr.str());
+    }
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+        EXPECT_EQ(100000, work[t].evaluations);
+        EXPECT_EQ(0, work[t].errors);
+    }
+    registry.reclaim();
+    EXPECT_EQ(0u, registry.getRetiredCount());
+    EXPECT_EQ(301u, registry.getVersion("f"));
+}
+
+TEST(TestTiering, TestPromotion) {
+    Expression* e = new Expression("x*2 + 3*4");
+    e->setVariable('x', 1.5);
+    for (int i = 0; i < 100; i++)
+        EXPECT_EQ(15, e->evaluate(true)); /* not counted */
+    for (int i = 1; i < Expression::DEFAULT_COMPILE_AFTER; i++)
+        EXPECT_EQ(15, e->evaluate());
+    EXPECT_TRUE(e->getExprCodeString() == NULL); /* still the tree */
+
+    EXPECT_EQ(15, e->evaluate()); /* compiled */
+    string* s = e->getExprCodeString();
+    ASSERT_TRUE(s != NULL);
+    EXPECT_NE(string::npos, s->find("VAL: 3\n"));
+    delete s;
+    for (int i = 1; i < Expression::DEFAULT_OPTIMIZE_AFTER; i++)
+        e->evaluate();
+    s = e->getExprCodeString();
+    EXPECT_NE(string::npos, s->find("VAL: 3\n"));
+    delete s;
+
+    EXPECT_EQ(15, e->evaluate()); /* optimized */
+    s = e->getExprCodeString();
+    EXPECT_NE(string::npos, s->find("VAL: 12\n"));
+    delete s;
+    delete e;
+
+    /* the tiers chosen by the caller */
+    e = new Expression("x*2 + 3*4");
+    e->setVariable('x', 1.5);
+    e->setTiering(0, 0);
+    for (int i = 0; i < 100; i++)
+        e->evaluate();
+    EXPECT_TRUE(e->getExprCodeString() == NULL);
+    e->setTiering(1, 0);
+    e->evaluate();
+    s = e->getExprCodeString();
+    ASSERT_TRUE(s != NULL);
+    EXPECT_NE(string::npos, s->find("VAL: 3\n"));
+    delete s;
+    e->setTiering(1, 2);
+    e->evaluate();
+    e->evaluate();
+    s = e->getExprCodeString();
+    EXPECT_NE(string::npos, s->find("VAL: 12\n"));
+    delete s;
+    delete e;
+
+    e = new Expression("x*2 + 3*4");
+    e->setVariable('x', 1.5);
+    e->compile(false); /* the compilation requested by the caller is kept */
+    for (int i = 0; i < 2 * Expression::DEFAULT_OPTIMIZE_AFTER; i++)
+        e->evaluate();
+    s = e->getExprCodeString();
+    EXPECT_NE(string::npos, s->find("VAL: 3\n"));
+    delete s;
+    delete e;
+}
+
+TEST(TestIncremental, TestChangedVariables) {
+    Expression* e = new Expression("_csqrt(x) * 2 + _csqrt(y + z)/w");
+    e->setFunction("_csqrt", &countedSqrt, 1, fnPURE);
+    e->setVariable('x', 16);
+    e->setVariable('y', 5);
+    e->setVariable('z', 4);
+    e->setVariable('w', 2);
+    e->setIncrementalEvaluation(true);
+
+    countedCalls = 0;
+    EXPECT_EQ(9.5, e->evaluate());
+    EXPECT_EQ(2, countedCalls);
+
+    EXPECT_EQ(9.5, e->evaluate()); /* nothing changed */
+    e->setVariable('x', 16); /* same value */
+    EXPECT_EQ(9.5, e->evaluate());
+    EXPECT_EQ(2, countedCalls);
+
+    e->setVariable('w', 3); /* only the division */
+    EXPECT_EQ(9, e->evaluate());
+    EXPECT_EQ(2, countedCalls);
+
+    e->setVariable('x', 25); /* only the first call */
+    EXPECT_EQ(11, e->evaluate());
+    EXPECT_EQ(3, countedCalls);
+
+    e->setVariable('w', 0); /* a failed evaluation is evaluated again */
+    e->setVariable('y', 12);
+    EXPECT_THROW(e->evaluate(), Error);
+    e->setVariable('w', 1);
+    EXPECT_EQ(14, e->evaluate());
+    EXPECT_EQ(e->evaluate(true), e->evaluate());
+
+    e->setFunction("_csqrt", &countedSqrt, 1, fnPURE); /* a changed function evaluates again all the calls */
+    countedCalls = 0;
+    EXPECT_EQ(14, e->evaluate());
+    EXPECT_EQ(2, countedCalls);
+
+    e->setFunction("_csqrt", &countedSqrt, 1); /* not pure: always called */
+    EXPECT_EQ(14, e->evaluate());
+    EXPECT_EQ(14, e->evaluate());
+    EXPECT_EQ(6, countedCalls);
+    delete e;
+}
+
+TEST(TestIncremental, TestBoundVariables) {
+    Expression* e = new Expression("_csqrt(x) + y*2");
+    e->setFunction("_csqrt", &countedSqrt, 1, fnPURE);
+    TestRow row = { 16, 1, 3 };
+    e->bindVariable('x', &row.price);
+    e->bindVariable('y', &row.qty);
+    EXPECT_EQ(10, e->evaluate());
+    row.qty = 4; /* no call to set the variables */
+    EXPECT_EQ(12, e->evaluate());
+    e->compile();
+    row.price = 25;
+    EXPECT_EQ(13, e->evaluate());
+
+    e->setIncrementalEvaluation(true); /* the bound variables are always evaluated again */
+    EXPECT_EQ(13, e->evaluate());
+    row.price = 36;
+    EXPECT_EQ(14, e->evaluate());
+
+    e->unbindVariable('x'); /* it keeps the last value */
+    row.price = 49;
+    countedCalls = 0;
+    EXPECT_EQ(14, e->evaluate());
+    EXPECT_EQ(14, e->evaluate());
+    EXPECT_EQ(1, countedCalls); /* only after the unbinding, y is still bound but it is not an argument */
+    e->setVariable('y', 1); /* setVariable unbinds */
+    row.qty = 100;
+    EXPECT_EQ(8, e->evaluate());
+    EXPECT_THROW(e->bindVariable('-', &row.qty), Error);
+    delete e;
+}
+
+TEST(TestOptimizer, TestConstantFolding) {
+    Expression* e = new Expression("x * (2 + 3) + _csqrt(16) + _sin(0) + 1/0");
+    e->setFunction("_csqrt", &countedSqrt, 1, fnCONST);
+    e->setVariable('x', 2);
+    countedCalls = 0;
+    e->compile(true);
+    EXPECT_EQ(1, countedCalls); /* computed by the compilation */
+    string* s = e->getExprCodeString();
+    EXPECT_EQ(string::npos, s->find("FUN")); /* _csqrt(16) and _sin(0) are values */
+    EXPECT_NE(string::npos, s->find("DIV")); /* the error is left to the evaluation */
+    delete s;
+    EXPECT_THROW(e->evaluate(), Error);
+    delete e;
+
+    e = new Expression("x * (2 + 3) + _csqrt(16)");
+    e->setFunction("_csqrt", &countedSqrt, 1, fnPURE); /* pure but not const */
+    e->setVariable('x', 2);
+    e->compile(true);
+    countedCalls = 0;
+    EXPECT_EQ(14, e->evaluate());
+    EXPECT_EQ(1, countedCalls);
+    delete e;
+}
+
+TEST(TestOptimizer, TestCommonSubexpressions) {
+    Expression* e = new Expression("_csqrt(x + y) * 2 + _sin(_csqrt(x + y)) / (x*y - _csqrt(y + x))");
+    e->setFunction("_csqrt", &countedSqrt, 1, fnPURE);
+    e->setVariable('x', 9);
+    e->setVariable('y', 16);
+    ValueType expected = e->evaluate();
+    e->compile(true);
+    string* s = e->getExprCodeString();
+    EXPECT_NE(string::npos, s->find("STORE: 0"));
+    EXPECT_NE(string::npos, s->find("LOAD: 0"));
+    delete s;
+
+    countedCalls = 0;
+    EXPECT_EQ(expected, e->evaluate());
+    EXPECT_EQ(2, countedCalls); /* _csqrt(y + x) is a different subexpression */
+
+    const size_t rows = 300;
+    vector<ValueType> xs(rows), res(rows);
+    for (size_t i = 0; i < rows; i++)
+        xs[i] = i;
+    Batch b(rows);
+    b.setColumn('x', &xs[0]);
+    countedCalls = 0;
+    e->evaluateBatch(&b, &res[0]);
+    EXPECT_EQ(2 * rows, countedCalls);
+    e->setVariable('x', 42);
+    EXPECT_EQ(e->evaluate(), res[42]);
+
+    e->setFunction("_csqrt", &countedSqrt, 1); /* not pure: the code is built again without slots */
+    countedCalls = 0;
+    EXPECT_EQ(e->evaluate(true), e->evaluate());
+    EXPECT_EQ(6, countedCalls);
+    s = e->getExprCodeString();
+    size_t calls = 0;
+    for (size_t p = s->find("_csqrt"); p != string::npos; p = s->find("_csqrt", p + 1))
+        calls++;
+    EXPECT_EQ(3, calls);
+    delete s;
+    delete e;
+}
+
+TEST(TestOptimizer, TestReassociation) {
+    Expression* e = new Expression("x + 1 - y + 2 + z - 4x - 2*x*3*y + _sin(x + y + 5 + z)");
+    e->setVariable('x', 1.5);
+    e->setVariable('y', -2.25);
+    e->setVariable('z', 0.75);
+    ValueType expected = e->evaluate(true);
+    e->compile();
+    EXPECT_EQ(expected, e->evaluate()); /* by default the order is kept */
+    string* inOrder = e->getExprCodeString();
+
+    e->setFastMath(true); /* optimized again at the next evaluation */
+    EXPECT_NEAR(expected, e->evaluate(), 1e-12);
+    string* s = e->getExprCodeString();
+    EXPECT_NE(*inOrder, *s);
+    EXPECT_NE(string::npos, s->find("POLY: 3 -3\n")); /* 1 + 2 + x - 4x */
+    EXPECT_NE(string::npos, s->find("VAL: 5\n"));
+    EXPECT_NE(string::npos, s->find("VAL: 6\n")); /* 2*3 */
+    delete s;
+
+    e->setFastMath(false);
+    EXPECT_EQ(expected, e->evaluate());
+    s = e->getExprCodeString();
+    EXPECT_EQ(*inOrder, *s);
+    delete s;
+    delete inOrder;
+    delete e;
+
+    /* a chain of n terms becomes a tree of depth log(n) */
+    string chain = "x";
+    for (int i = 0; i < 63; i++)
+        chain += (i % 3 == 0) ? "-x" : "+y";
+    ASTNode* ast = MExpr_ParseExpression(&chain);
+    ASTNode* balanced = Optimizer::reassociate(ast);
+    Code code(ast);
+    Code balancedCode(balanced);
+    EXPECT_EQ(7u, balancedCode.getStackSize()); /* the partial sums of the levels wait in the stack */
+    EXPECT_GT(balancedCode.getStackSize(), code.getStackSize());
+    Environment env;
+    env.setVar('x', 0.5);
+    env.setVar('y', 3);
+    EXPECT_EQ(code.evaluate(&env), balancedCode.evaluate(&env)); /* exact with these values */
+    ast->deleteTree();
+    balanced->deleteTree();
+}
+
+TEST(TestOptimizer, TestPolynomials) {
+    Expression* e = new Expression("3x^4 + 2x^3 - x^2 + 5x + 1");
+    e->setFastMath(true);
+    e->compile();
+    string* s = e->getExprCodeString();
+    EXPECT_EQ("VAR: x\nPOLY: 1 5 -1 2 3\n", *s);
+    delete s;
+    for (ValueType x = -3; x <= 3; x += 0.375) {
+        e->setVariable('x', x);
+        EXPECT_NEAR(3*x*x*x*x + 2*x*x*x - x*x + 5*x + 1, e->evaluate(), 1e-12);
+    }
+    delete e;
+
+    /* a polynomial for each variable, the constants in the first one */
+    e = new Expression("y^2 - 3 + x*x*2 + _sin(z) - 3y + x + 4");
+    e->setVariable('x', 1.25);
+    e->setVariable('y', -0.5);
+    e->setVariable('z', 2);
+    ValueType expected = e->evaluate(true);
+    e->setFastMath(true);
+    e->compile();
+    EXPECT_NEAR(expected, e->evaluate(), 1e-12);
+    s = e->getExprCodeString();
+    EXPECT_NE(string::npos, s->find("POLY: 1 -3 1\n"));
+    EXPECT_NE(string::npos, s->find("POLY: 0 1 2\n"));
+    delete s;
+    delete e;
+
+    /* the Estrin's scheme from ESTRIN_MIN_DEGREE, the batches have the same results of the code */
+    string poly = "1";
+    for (int k = 1; k <= 12; k++) {
+        stringstream term;
+        term << ((k % 2 == 0) ? " + " : " - ") << 1.0 / k << "x^" << k;
+        poly += term.str();
+    }
+    for (int degree = 3; degree <= 12; degree += 9) {
+        e = new Expression(degree == 3 ? "2x^3 - x + 0.5" : poly);
+        e->setFastMath(true);
+        e->compile();
+        const size_t rows = 100;
+        vector<ValueType> xs(rows), res(rows);
+        for (size_t i = 0; i < rows; i++)
+            xs[i] = -1 + i / 50.0;
+        Batch b(rows);
+        b.setColumn('x', &xs[0]);
+        e->evaluateBatch(&b, &res[0]);
+        for (size_t i = 0; i < rows; i++) {
+            e->setVariable('x', xs[i]);
+            EXPECT_EQ(e->evaluate(), res[i]);
+            Expression written(degree == 3 ? "2x^3 - x + 0.5" : poly);
+            written.setVariable('x', xs[i]);
+            EXPECT_NEAR(written.evaluate(), res[i], 1e-12);
+        }
+        delete e;
+    }
+
+    ValueType square[] = { 0, 0, 1 };
+    EXPECT_EQ(0, ASTPolynomial::evaluatePolynomial(square, 2, 0));
+    EXPECT_EQ(6.25, ASTPolynomial::evaluatePolynomial(square, 2, -2.5));
+}
+
+static vector<ValueType> recordedCalls;
+
+void recordArg(StackType* s) { //recordArg(n) = n, and records n
+    recordedCalls.push_back(s->stack[s->stp - 1]);
+}
+
+TEST(TestOptimizer, TestEvaluationOrder) {
+    Environment env;
+    const char* exprs[] = { "1-(x-(y-(z-(x-(y-1)))))", "2^(x^(y^0.5))", "x/(y/(z/(x+1)))", "x<(y+z*(x-1))",
+            "-3xy^2 - 3(xy + 3)(-5x + y)" };
+    env.setVar('x', 1.5);
+    env.setVar('y', 2.5);
+    env.setVar('z', -4);
+    for (int i = 0; i < 5; i++) {
+        string expr(exprs[i]);
+        ASTNode* ast = MExpr_ParseExpression(&expr);
+        Code inOrder(ast);
+        Code reordered(ast, &env);
+        EXPECT_GT(inOrder.getStackSize(), reordered.getStackSize()) << expr;
+        if (i < 4) /* chains: the heavier operand is always the chain */
+            EXPECT_EQ(2u, reordered.getStackSize()) << expr;
+        EXPECT_EQ(inOrder.evaluate(&env), reordered.evaluate(&env)) << expr;
+        ast->deleteTree();
+    }
+
+    Expression* e = new Expression("1/(x - (y - 1))");
+    e->compile(true);
+    string* s = e->getExprCodeString();
+    EXPECT_NE(string::npos, s->find("RDIV"));
+    delete s;
+    e->setVariable('x', 1);
+    e->setVariable('y', 2);
+    EXPECT_THROW(e->evaluate(), Error); /* the divisor is the first operand on the stack */
+    delete e;
+
+    /* the calls of functions that are not pure keep their order */
+    e = new Expression("_rec(1) - (_rec(2) + x*(x - 1))");
+    e->setFunction("_rec", &recordArg, 1);
+    e->setVariable('x', 3);
+    e->compile(true);
+    recordedCalls.clear();
+    EXPECT_EQ(-7, e->evaluate());
+    ASSERT_EQ(2u, recordedCalls.size());
+    EXPECT_EQ(1, recordedCalls[0]);
+    e->setFunction("_rec", &recordArg, 1, fnPURE);
+    recordedCalls.clear();
+    EXPECT_EQ(-7, e->evaluate());
+    EXPECT_EQ(2, recordedCalls[0]); /* the heavier operand first */
+    delete e;
+}
+
+TEST(TestGenerator, TestValidExpressions) {
+    Bench::Shape shapes[4];
+    shapes[1].nodes = 500;
+    shapes[1].skew = 0;
+    shapes[2].nodes = 200;
+    shapes[2].functionRatio = 0.4;
+    shapes[2].implicitRatio = 0.4;
+    shapes[3].nodes = 300;
+    shapes[3].variables = 52;
+
+    for (int s = 0; s < 4; s++) {
+        for (int seed = 0; seed < 50; seed++) {
+            Bench::ExprGenerator gen(seed);
+            string expr = gen.generate(shapes[s]);
+            ASSERT_NO_THROW(delete new Expression(expr)) << expr;
+        }
+    }
+}
+
+TEST(TestGenerator, TestSeed) {
+    Bench::Shape shape;
+    Bench::ExprGenerator a(42), b(42), c(43);
+    string ea = a.generate(shape);
+    EXPECT_EQ(ea, b.generate(shape));
+    EXPECT_NE(ea, c.generate(shape));
+}
+
+/* true if the two trees have the same nodes (the values are compared bit by bit) */
+static bool sameTree(ASTNode* a, ASTNode* b) {
+    Instruction ia = a->getMExprInstr();
+    Instruction ib = b->getMExprInstr();
+    if (ia.type != ib.type || a->countChildren() != b->countChildren())
+        return false;
+    if (ia.type == iVAL && memcmp(&ia.arg.value, &ib.arg.value, sizeof(ValueType)) != 0)
+        return false;
+    if (ia.type == iVAR && ia.arg.variable != ib.arg.variable)
+        return false;
+    if (ia.type == iFUN && *ia.arg.funName != *ib.arg.funName)
+        return false;
+    for (unsigned int i = 0; i < a->countChildren(); i++)
+        if (!sameTree(a->getChild(i), b->getChild(i)))
+            return false;
+    return true;
+}
+
+/* parses the expression with both parsers: they must build the same tree or both throw a syntax error */
+static ::testing::AssertionResult sameParse(const string& expr) {
+    ASTNode* fast = NULL;
+    ASTNode* bison = NULL;
+    bool fastError = false, bisonError = false;
+    try {
+        fast = MExpr_ParseExpression(&expr);
+    } catch (Error& e) {
+        fastError = true;
+    }
+    try {
+        bison = MExpr_ParseExpressionBison(&expr);
+    } catch (Error& e) {
+        bisonError = true;
+    }
+
+    bool same = (fastError == bisonError) && (fastError || sameTree(fast, bison));
+    string fastTree("syntax error");
+    string bisonTree("syntax error");
+    if (fast != NULL) {
+        string* s = fast->getExprTreeString();
+        fastTree = *s;
+        delete s;
+        fast->deleteTree();
+    }
+    if (bison != NULL) {
+        string* s = bison->getExprTreeString();
+        bisonTree = *s;
+        delete s;
+        bison->deleteTree();
+    }
+
+    if (same)
+        return ::testing::AssertionSuccess();
+    return ::testing::AssertionFailure() << "\"" << expr << "\"\nfast:\n" << fastTree << "\nbison:\n" << bisonTree;
+}
+
+TEST(TestFastParser, TestSameTrees) {
+    const char* exprs[] = { "42", "1.5", "0.25 + 007", "123456789012345678901234567890", "0.1000000000000000055511",
+            "x", "-x", "+x", "--x", "-x^2", "-2^-3", "2^+x", "2^-x", "x^-(y+1)", "x^(2)(3)", "(x)^2y",
+            "a+b-c", "a-b+c", "a*b/c", "a/b*c", "a-b*c+d/e-f", "a*-b", "a+-b*c", "a - -b", "-a*b+c", "a/-b^2",
+            "xyz", "2x", "2 3", "3x^2y", "2(x+1)", "(x)(y)(z)", "x_sin(y)", "x^2_cos(y)", "-3(4xy^2x-2x)(8x^-(3x)+2y^-2)",
+            "_sin(x)", "_hypot(x, y)", "_f(a,b,c,d,e,f,g,h,i,j,k)", "_sin(_cos(_tan(x)))", "_a1B2(x)",
+            "1 2 . 3", "x # y", "x\ty\n", "_(x)", "_Ab(x)", "x^2^3", "", "()", "x+", "*x", "x(", "_sin(x)y",
+            "_sin(x)^2", "_sin()", "_sin(x,)", "x^", "x^*y", "x^-+y", "2^--3", "(x", "x)", "1..2", "1.", ".5",
+            "x<y", "x<=y>=z", "a==b!=c", "a&&b||c&&d", "a||b&&c", "a+b<c*d==e", "-x<y", "x<-y", "x<+2",
+            "_if(x<y, x, y)", "_if(a, _if(b, c, d), e)", "_if(x)", "_if(a,b,c,d)", "x = y", "x ! y", "x & y", "x | y",
+            "x===y", "x<", "<x", "x<=>y", "x=<y", "x&&&y", "x^(y<z)", "x^y<z" };
+
+    for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++)
+        EXPECT_TRUE(sameParse(exprs[i]));
+}
+
+TEST(TestFastParser, TestGenerated) {
+    Bench::Shape shapes[4];
+    shapes[1].nodes = 400;
+    shapes[1].skew = 0;
+    shapes[2].nodes = 200;
+    shapes[2].functionRatio = 0.3;
+    shapes[2].powerRatio = 0.3;
+    shapes[2].implicitRatio = 0.3;
+    shapes[2].unaryRatio = 0.2;
+    shapes[2].variables = 52;
+    shapes[3].nodes = 200;
+    shapes[3].conditionRatio = 0.3;
+
+    for (int s = 0; s < 4; s++) {
+        Bench::ExprGenerator gen(s);
+        for (int i = 0; i < 200; i++)
+            ASSERT_TRUE(sameParse(gen.generate(shapes[s])));
+    }
+}
+
+TEST(TestFastParser, TestRandomTokens) {
+    /* random sequences of tokens, mostly invalid expressions */
+    static const char* tokens[] = { "x", "y", "2", "0.5", "+", "-", "*", "/", "^", "(", ")", ",", "_sin", "_f", " ",
+            "<", "<=", "==", "!", "&&", "|", "_if" };
+    Bench::ExprGenerator gen(7);
+    for (int i = 0; i < 5000; i++) {
+        string expr;
+        unsigned int len = 1 + gen.below(12);
+        for (unsigned int t = 0; t < len; t++)
+            expr += tokens[gen.below(sizeof(tokens) / sizeof(tokens[0]))];
+        ASSERT_TRUE(sameParse(expr));
+    }
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
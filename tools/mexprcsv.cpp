@@ -0,0 +1,172 @@
+/*
+ * MExpr Delimited Files Evaluator
+ * Evaluates an expression for each row of a CSV (or TSV, ...) file and writes the results
+ *
+ * @author Miro Mannino
+ *
+ * Copyright (c) 2012 Miro Mannino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <MExpr.h>
+#include <MExprCsv.h>
+using namespace std;
+using namespace MExpr;
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [options] expression input.csv\n\n", name);
+    fprintf(stderr, "  -o file      output file (default: standard output)\n");
+    fprintf(stderr, "  -d char      delimiter (default: ',')\n");
+    fprintf(stderr, "  -t           tab delimited\n");
+    fprintf(stderr, "  -n           the input doesn't have a header\n");
+    fprintf(stderr, "  -a           write the input rows followed by the result\n");
+    fprintf(stderr, "  -r name      name of the result column (default: result)\n");
+    fprintf(stderr, "  -p digits    significant digits of the results, from 1 to 17 (default: 17)\n");
+    fprintf(stderr, "  -m accuracy  accuracy of _exp, _log, _sin, _cos and _tanh: accurate (math.h, default),\n");
+    fprintf(stderr, "               ulp1 (within 1 ULP) or fast (within 4 ULP)\n");
+    fprintf(stderr, "  -c x=name    binds the variable x to the column with the given name\n");
+    fprintf(stderr, "  -i x=index   binds the variable x to the column with the given index (from 0)\n");
+    fprintf(stderr, "  -s x=value   sets the variable x to a constant value\n\n");
+    fprintf(stderr, "With a header, the columns named with a single letter are bound to that variable.\n");
+}
+
+/* splits "x=something", it returns false if the format is wrong */
+static bool splitBinding(const char* arg, char* var, string* value) {
+    if (strlen(arg) < 3 || arg[1] != '=')
+        return false;
+    *var = arg[0];
+    *value = string(arg + 2);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    string outPath("-");
+    char delimiter = ',';
+    bool header = true;
+    bool append = false;
+    string resultName("result");
+    int precision = 17;
+    MathAccuracy accuracy = mathACCURATE;
+    vector<string> bindings; /* options -c, -i and -s, applied when the expression is created */
+    vector<string> args;
+
+    for (int i = 1; i < argc; i++) {
+        string a(argv[i]);
+        bool hasValue = (i + 1 < argc);
+        if (a == "-o" && hasValue)
+            outPath = argv[++i];
+        else if (a == "-d" && hasValue)
+            delimiter = argv[++i][0];
+        else if (a == "-t")
+            delimiter = '\t';
+        else if (a == "-n")
+            header = false;
+        else if (a == "-a")
+            append = true;
+        else if (a == "-r" && hasValue)
+            resultName = argv[++i];
+        else if (a == "-p" && hasValue) {
+            precision = atoi(argv[++i]);
+            if (precision < 1 || precision > CsvEvaluator::MAX_PRECISION) {
+                fprintf(stderr, "the digits must be between 1 and %d\n", (int) CsvEvaluator::MAX_PRECISION);
+                return 1;
+            }
+        }
+        else if (a == "-m" && hasValue) {
+            string m(argv[++i]);
+            if (m == "accurate")
+                accuracy = mathACCURATE;
+            else if (m == "ulp1")
+                accuracy = mathULP1;
+            else if (m == "fast")
+                accuracy = mathFAST;
+            else {
+                fprintf(stderr, "unknown accuracy: %s\n", m.c_str());
+                return 1;
+            }
+        }
+        else if ((a == "-c" || a == "-i" || a == "-s") && hasValue)
+            bindings.push_back(a.substr(1) + argv[++i]);
+        else if (a.length() > 1 && a[0] == '-' && a != "-") {
+            fprintf(stderr, "unknown option or missing value: %s\n", a.c_str());
+            usage(argv[0]);
+            return 1;
+        }
+        else
+            args.push_back(a);
+    }
+    if (args.size() != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Expression* e = NULL;
+    CsvEvaluator* csv = NULL;
+    try {
+        e = new Expression(args[0]);
+        e->setMathAccuracy(accuracy);
+        csv = new CsvEvaluator(e);
+        csv->setDelimiter(delimiter);
+        csv->setHeader(header);
+        csv->setAppend(append);
+        csv->setResultName(resultName);
+        csv->setPrecision(precision);
+
+        for (size_t i = 0; i < bindings.size(); i++) {
+            char kind = bindings[i][0];
+            char var;
+            string value;
+            if (!splitBinding(bindings[i].c_str() + 1, &var, &value)) {
+                fprintf(stderr, "illegal binding: %s\n", bindings[i].c_str() + 1);
+                delete csv;
+                delete e;
+                return 1;
+            }
+            if (kind == 'c')
+                csv->bindColumn(var, value);
+            else if (kind == 'i')
+                csv->bindColumn(var, (size_t) atol(value.c_str()));
+            else
+                e->setVariable(var, atof(value.c_str()));
+        }
+
+        e->compile();
+        csv->evaluateFile(args[1], outPath);
+
+    } catch (Error& ex) {
+        if (csv != NULL && csv->getLine() > 0)
+            fprintf(stderr, "Err: %s (%s, line %lu)\n", ex.what(), args[1].c_str(), (unsigned long) csv->getLine());
+        else
+            fprintf(stderr, "Err: %s\n", ex.what());
+        delete csv;
+        delete e;
+        return 1;
+    }
+
+    delete csv;
+    delete e;
+    return 0;
+}